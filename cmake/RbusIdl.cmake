@@ -0,0 +1,58 @@
+#############################################################################
+# If not stated otherwise in this file or this component's Licenses.txt file
+# the following copyright and licenses apply:
+#
+# Copyright 2019 RDK Management
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#############################################################################
+
+# rbus_idl_generate(<file.idl> <sources variable>)
+#
+# Runs rbus_idl.py on <file.idl> at build time and sets <sources variable> to the generated .c file, to be added to a
+# target. The generated header is written next to it in the current binary directory, which is added to the include
+# path. A target named <file>_idl regenerates both when the idl or the generator changes. Python 3 is only looked for
+# on the first call, so including this module (as the rbus-core package config does) doesn't require it.
+
+# Installed next to this module, or in the source tree when building rbus-core itself.
+if (EXISTS "${CMAKE_CURRENT_LIST_DIR}/rbus_idl.py")
+    set(RBUS_IDL_GENERATOR "${CMAKE_CURRENT_LIST_DIR}/rbus_idl.py")
+else ()
+    set(RBUS_IDL_GENERATOR "${CMAKE_CURRENT_LIST_DIR}/../rbus-core/tools/rbus_idl.py")
+endif ()
+
+function(rbus_idl_generate IDL_FILE SOURCES_VAR)
+    if (CMAKE_VERSION VERSION_LESS 3.12)
+        find_package(PythonInterp 3 REQUIRED)
+        set(RBUS_IDL_PYTHON ${PYTHON_EXECUTABLE})
+    else ()
+        find_package(Python3 COMPONENTS Interpreter REQUIRED)
+        set(RBUS_IDL_PYTHON ${Python3_EXECUTABLE})
+    endif ()
+
+    get_filename_component(IDL_PATH ${IDL_FILE} ABSOLUTE)
+    get_filename_component(IDL_NAME ${IDL_FILE} NAME_WE)
+    set(IDL_SOURCE "${CMAKE_CURRENT_BINARY_DIR}/${IDL_NAME}.c")
+    set(IDL_HEADER "${CMAKE_CURRENT_BINARY_DIR}/${IDL_NAME}.h")
+
+    add_custom_command(
+        OUTPUT ${IDL_SOURCE} ${IDL_HEADER}
+        COMMAND ${RBUS_IDL_PYTHON} ${RBUS_IDL_GENERATOR} ${IDL_PATH} ${CMAKE_CURRENT_BINARY_DIR}
+        DEPENDS ${IDL_PATH} ${RBUS_IDL_GENERATOR}
+        COMMENT "Generating rbus stubs from ${IDL_NAME}.idl")
+    add_custom_target(${IDL_NAME}_idl DEPENDS ${IDL_SOURCE} ${IDL_HEADER})
+
+    include_directories(${CMAKE_CURRENT_BINARY_DIR})
+    set(${SOURCES_VAR} ${IDL_SOURCE} PARENT_SCOPE)
+endfunction()
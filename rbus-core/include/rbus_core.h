@@ -28,8 +28,8 @@
 #define MAX_OBJECT_NAME_LENGTH RTMSG_HEADER_MAX_TOPIC_LENGTH
 #define MAX_METHOD_NAME_LENGTH 64
 #define MAX_EVENT_NAME_LENGTH MAX_OBJECT_NAME_LENGTH
-#define MAX_SUPPORTED_METHODS 32
-#define MAX_REGISTERED_OBJECTS 64
+#define MAX_SUPPORTED_METHODS 32 /*no longer enforced, an object can register any number of methods*/
+#define MAX_REGISTERED_OBJECTS 64 /*no longer used, a component can register any number of objects*/
 
 #ifdef __cplusplus
 extern "C" {
@@ -198,6 +198,25 @@ rbuscore_bus_status_t rbuscore_checkBusStatus(void);
 
 rbus_error_t rbus_sendResponse(const rtMessageHeader* hdr, rbusMessage response);
 
+/* Compress outbound messages of at least 'threshold' bytes; 0, the default, disables compression. Responses are only compressed
+ * for requesters that advertise support for it, so mixed-version peers keep working. Requests and events are compressed only if
+ * 'flags' includes RBUS_COMPRESS_REQUESTS or RBUS_COMPRESS_EVENTS, which needs every receiving peer to support compression.
+ * Returns RTMESSAGE_BUS_ERROR_INVALID_STATE if rbus-core was built without ENABLE_RBUS_COMPRESSION. */
+#define RBUS_COMPRESS_REQUESTS 0x1
+#define RBUS_COMPRESS_EVENTS 0x2
+rbus_error_t rbus_setCompression(unsigned int threshold, int flags);
+
+/* Send requests and events in wire format 'version': 0, the default, or 2, which puts a fixed-size routing header in front of
+ * the payload. Every peer decodes both formats and answers in the format of the request, so 2 is only needed where all
+ * receivers of requests and events are new enough to read it. */
+rbus_error_t rbus_setWireVersion(int version);
+
+/* Dispatch requests on 'num_threads' worker threads instead of the connection's callback thread; 0, the default, turns this off.
+ * Requests to different objects then run in parallel while those to one object still run one at a time, in the order they
+ * arrived. Responses are sent with rbus_sendResponse as before. Changing the count lets the current workers finish the requests
+ * already queued first. Must not be called from a request handler. */
+rbus_error_t rbus_setDispatchThreads(unsigned int num_threads);
+
 #ifdef __cplusplus
 }
 #endif
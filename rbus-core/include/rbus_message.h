@@ -21,6 +21,7 @@
 #define __rbusMessage_H__ 
 
 #include <rtError.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,13 +34,56 @@ void rbusMessage_Init(rbusMessage* message);
 void rbusMessage_Retain(rbusMessage message);
 void rbusMessage_Release(rbusMessage message);
 void rbusMessage_FromBytes(rbusMessage* message, uint8_t const* buff, uint32_t n);
+/* Same as rbusMessage_FromBytes but decodes straight out of 'buff' instead of copying it. 'buff' must stay valid until the message
+ * is released. rbusMessage_Retain and the Set functions take a private copy first, so a message can still be kept beyond the lifetime of 'buff'.
+ * rbusMessage_Retain aborts if it can't allocate that copy. */
+void rbusMessage_FromBytesNoCopy(rbusMessage* message, uint8_t const* buff, uint32_t n);
 void rbusMessage_ToBytes(rbusMessage message, uint8_t** buff, uint32_t* n);
 void rbusMessage_ToDebugString(rbusMessage message, char** s, uint32_t* n);
 
+/* Message pool. Released messages are recycled through per-thread free lists instead of going back to the heap.
+ * Each thread caches at most 'max_cached' messages and keeps a message's buffer only if it is no larger than
+ * 'max_buffer_size' bytes. The pool is disabled by default, and max_cached = 0 disables it again. Lowering the limit
+ * drains the calling thread's free list right away and every other thread's on its next release. */
+typedef struct
+{
+    uint64_t hits;      /* messages served from a free list */
+    uint64_t misses;    /* messages allocated from the heap while the pool was enabled */
+    uint64_t trimmed;   /* released or cached messages freed because the free list was at its high-water mark */
+    uint32_t cached;    /* messages currently in the calling thread's free list */
+} rbusMessagePoolStats;
+
+void rbusMessage_ConfigurePool(uint32_t max_cached, uint32_t max_buffer_size);
+void rbusMessage_GetPoolStats(rbusMessagePoolStats* stats);
+
+/* Capacity reservation. Large messages can be built with a single allocation by reserving their encoded size up front.
+ * 'capacity' is the total size of the fields the caller will set; room for rbus-core's own routing data is added internally.
+ * The rbusMessage_SizeOf* functions return the exact number of bytes the matching Set call adds to a message. */
+void rbusMessage_InitWithCapacity(rbusMessage* message, uint32_t capacity);
+rtError rbusMessage_Reserve(rbusMessage message, uint32_t capacity);
+
+uint32_t rbusMessage_SizeOfString(char const* value);
+uint32_t rbusMessage_SizeOfBytes(uint32_t size);
+uint32_t rbusMessage_SizeOfInt32(int32_t value);
+uint32_t rbusMessage_SizeOfInt64(int64_t value);
+uint32_t rbusMessage_SizeOfDouble(double value);
+uint32_t rbusMessage_SizeOfMessage(rbusMessage const item);
+uint32_t rbusMessage_SizeOfInt32Array(uint32_t count);
+uint32_t rbusMessage_SizeOfInt64Array(uint32_t count);
+uint32_t rbusMessage_SizeOfDoubleArray(uint32_t count);
+uint32_t rbusMessage_SizeOfMap(uint32_t count); /* the header only */
+
 /*data types*/
 rtError rbusMessage_SetString(rbusMessage message, char const* value);
 rtError rbusMessage_GetString(rbusMessage const message, char const** value);
 
+/* Name table encoding. Once enabled, rbusMessage_SetString stores a string that shares a long prefix with the last plain
+ * string in the message as a reference to that prefix plus the remaining suffix. This shrinks messages full of
+ * hierarchical parameter names. rbusMessage_GetString decodes either form and returns an ordinary string that stays valid
+ * until the message is released. rbusMessage_SizeOfString becomes an upper bound. Enable it only for peers whose rbus-core
+ * understands the encoding. */
+void rbusMessage_EnableNameTable(rbusMessage message, int enable);
+
 rtError rbusMessage_SetBytes(rbusMessage message, uint8_t const* value, uint32_t size);
 rtError rbusMessage_GetBytes(rbusMessage message, uint8_t const** value, uint32_t *size);
 
@@ -53,8 +97,92 @@ rtError rbusMessage_SetDouble(rbusMessage message, double value);
 rtError rbusMessage_GetDouble(rbusMessage const message, double* value);
 
 rtError rbusMessage_SetMessage(rbusMessage message, rbusMessage const item);
+/* The message returned by rbusMessage_GetMessage is a view that shares 'message's buffer and keeps it alive until the view is
+ * released. Writing to the view gives it a private copy. 'message' may still be written to; a buffer it outgrows is kept for
+ * its views until 'message' itself is destroyed. */
 rtError rbusMessage_GetMessage(rbusMessage const message, rbusMessage* value);
 
+/* Numeric arrays are packed as a single field rather than one field per element. The Get functions copy into 'values',
+ * which holds 'capacity' elements, and set '*count' to the number of elements in the field. If the field does not fit,
+ * they fail without consuming it, so the caller can retry with an array of '*count' elements. */
+rtError rbusMessage_SetInt32Array(rbusMessage message, int32_t const* values, uint32_t count);
+rtError rbusMessage_GetInt32Array(rbusMessage const message, int32_t* values, uint32_t capacity, uint32_t* count);
+
+rtError rbusMessage_SetInt64Array(rbusMessage message, int64_t const* values, uint32_t count);
+rtError rbusMessage_GetInt64Array(rbusMessage const message, int64_t* values, uint32_t capacity, uint32_t* count);
+
+rtError rbusMessage_SetDoubleArray(rbusMessage message, double const* values, uint32_t count);
+rtError rbusMessage_GetDoubleArray(rbusMessage const message, double* values, uint32_t capacity, uint32_t* count);
+
+/* Maps. rbusMessage_SetMap starts a field of 'count' entries, each written as a key with rbusMessage_SetString followed by
+ * its value. rbusMessage_GetMap opens the next field as a map and moves to its first key, so the entries can be read in
+ * order. rbusMessage_GetMapValue moves to the value of 'key' in the open map, for the next Get call to read, and fails if
+ * the map has no such key. The keys are hashed on the first lookup, so looking up a few keys of a large map does not scan
+ * it. rbusMessage_EndMapRead moves past the open map. Only one map is open at a time; a map inside a map closes the outer
+ * one. */
+rtError rbusMessage_SetMap(rbusMessage message, uint32_t count);
+rtError rbusMessage_GetMap(rbusMessage const message, uint32_t* count);
+rtError rbusMessage_GetMapValue(rbusMessage const message, char const* key);
+void rbusMessage_EndMapRead(rbusMessage const message);
+
+/* Scatter-gather building. rbusMessage_SetBytesRef and rbusMessage_AppendMessage add a bytes field that references its data
+ * instead of copying it. Memory passed to rbusMessage_SetBytesRef must stay valid until 'message' is released. An appended
+ * message is retained by 'message' and must not be written to afterwards. rbusMessage_ToIovec returns the encoded message as
+ * a list of segments, without copying. It fails if the list holds more than 'capacity' entries, and sets '*count' to the
+ * number needed. rbusMessage_ToBytes and the Get functions first copy the segments into one contiguous buffer. */
+rtError rbusMessage_SetBytesRef(rbusMessage message, uint8_t const* value, uint32_t size);
+rtError rbusMessage_AppendMessage(rbusMessage message, rbusMessage item);
+rtError rbusMessage_ToIovec(rbusMessage message, struct iovec* iov, uint32_t capacity, uint32_t* count);
+
+/* Cursor. The Get functions read the fields in order; these move the read position without decoding the fields in between,
+ * using an index of field offsets built on first use. Fields are numbered from 0 and the routing data rbus-core adds is not
+ * counted. rbusMessage_PeekType returns RBUS_MESSAGE_FIELD_NONE at the end of the message. rbusMessage_Skip and
+ * rbusMessage_Seek fail, leaving the read position alone, if the message has fewer fields. Seeking to the field count moves
+ * to the end. */
+typedef enum
+{
+    RBUS_MESSAGE_FIELD_NONE = 0,
+    RBUS_MESSAGE_FIELD_INT,             /* read with rbusMessage_GetInt32 or rbusMessage_GetInt64 */
+    RBUS_MESSAGE_FIELD_DOUBLE,
+    RBUS_MESSAGE_FIELD_STRING,
+    RBUS_MESSAGE_FIELD_BYTES,           /* also a nested message */
+    RBUS_MESSAGE_FIELD_INT32_ARRAY,
+    RBUS_MESSAGE_FIELD_INT64_ARRAY,
+    RBUS_MESSAGE_FIELD_DOUBLE_ARRAY,
+    RBUS_MESSAGE_FIELD_MAP,
+    RBUS_MESSAGE_FIELD_UNKNOWN          /* written by something other than rbusMessage */
+} rbusMessageFieldType;
+
+rbusMessageFieldType rbusMessage_PeekType(rbusMessage const message);
+rtError rbusMessage_Skip(rbusMessage const message, uint32_t count);
+void rbusMessage_Rewind(rbusMessage const message);
+rtError rbusMessage_Seek(rbusMessage const message, uint32_t index);
+uint32_t rbusMessage_CountFields(rbusMessage const message);
+
+/* Random access. Each reads field 'index' like the matching Get function but leaves the read position where it was, so
+ * sequential reads are not affected. After the index is built this costs the same for every field. For messages with many
+ * fields, a sender can call rbusMessage_EnableFieldIndex before writing the meta section to have the index sent in it;
+ * receivers then take it from there instead of walking the body. Receivers without this support ignore it. */
+void rbusMessage_EnableFieldIndex(rbusMessage message, int enable);
+rtError rbusMessage_GetStringAt(rbusMessage const message, uint32_t index, char const** value);
+rtError rbusMessage_GetBytesAt(rbusMessage const message, uint32_t index, uint8_t const** value, uint32_t* size);
+rtError rbusMessage_GetInt32At(rbusMessage const message, uint32_t index, int32_t* value);
+rtError rbusMessage_GetInt64At(rbusMessage const message, uint32_t index, int64_t* value);
+rtError rbusMessage_GetDoubleAt(rbusMessage const message, uint32_t index, double* value);
+
+/* JSON. rbusMessage_ToJson writes the fields as a JSON array, passing the text to 'writer' in pieces as it goes; 'writer'
+ * returns 0 to continue. Strings are JSON strings, integers and doubles are numbers (doubles always with a '.' or an
+ * exponent) and maps are objects. The types JSON lacks are objects with a single tagged member: {"$bin":"<base64>"} for
+ * bytes and nested messages, and {"$int32":[...]}, {"$int64":[...]} and {"$double":[...]} for the numeric arrays. NaN and
+ * infinities, which JSON cannot represent, are written as null. rbusMessage_FromJson builds a message from such an array,
+ * so every other message survives the round trip; a map whose first key is one of the tags does not. Maps and arrays are
+ * packed with 32-bit headers, so the encoding may be a few bytes larger than the original.
+ * rbusMessage_ToJsonString returns the whole text in '*s', which the caller frees. */
+typedef int (*rbusMessageJsonWriter)(void* user_data, char const* data, uint32_t length);
+rtError rbusMessage_ToJson(rbusMessage const message, rbusMessageJsonWriter writer, void* user_data);
+rtError rbusMessage_ToJsonString(rbusMessage const message, char** s, uint32_t* n);
+rtError rbusMessage_FromJson(rbusMessage* message, char const* json, uint32_t length);
+
 #ifdef __cplusplus
 }
 #endif
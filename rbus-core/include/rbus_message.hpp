@@ -0,0 +1,238 @@
+/*
+  * If not stated otherwise in this file or this component's Licenses.txt file
+  * the following copyright and licenses apply:
+  *
+  * Copyright 2019 RDK Management
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+*/
+
+#ifndef __rbusMessage_HPP__
+#define __rbusMessage_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#include "rbus_message.h"
+
+/* C++ wrapper for rbusMessage, header only and C++11.
+ *
+ * rbus::Message owns one reference to an rbusMessage. It can be moved but not copied, so passing it around costs no
+ * reference counting; share() takes another reference explicitly. A moved-from Message is empty and may only be assigned
+ * to or destroyed.
+ *
+ * The set functions return the message so calls can be chained. If one fails, the rest are skipped and status() returns
+ * the error. The get functions return rtError like the C API. Strings and bytes are returned as views into the message
+ * and stay valid until the message is released; they are not copied. */
+namespace rbus
+{
+
+#if __cplusplus >= 201703L
+using string_view = std::string_view;
+#else
+/* What rbus::Message needs of std::string_view, for C++11 and C++14. */
+class string_view
+{
+public:
+    string_view() : m_data(nullptr), m_size(0) {}
+    string_view(char const* s) : m_data(s), m_size(s ? strlen(s) : 0) {}
+    string_view(char const* s, size_t n) : m_data(s), m_size(n) {}
+    string_view(std::string const& s) : m_data(s.data()), m_size(s.size()) {}
+
+    char const* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    char const* begin() const { return m_data; }
+    char const* end() const { return m_data + m_size; }
+    char operator[](size_t i) const { return m_data[i]; }
+    explicit operator std::string() const { return std::string(m_data, m_size); }
+
+    friend bool operator==(string_view a, string_view b)
+    {
+        return a.m_size == b.m_size && (a.m_size == 0 || memcmp(a.m_data, b.m_data, a.m_size) == 0);
+    }
+    friend bool operator!=(string_view a, string_view b) { return !(a == b); }
+
+private:
+    char const* m_data;
+    size_t m_size;
+};
+#endif
+
+#if __cplusplus >= 202002L
+template<typename T>
+using span = std::span<T>;
+#else
+/* What rbus::Message needs of std::span, for C++11 to C++17. */
+template<typename T>
+class span
+{
+public:
+    span() : m_data(nullptr), m_size(0) {}
+    span(T* data, size_t size) : m_data(data), m_size(size) {}
+    template<size_t N>
+    span(T (&array)[N]) : m_data(array), m_size(N) {}
+    template<typename U, typename = typename std::enable_if<std::is_convertible<U (*)[], T (*)[]>::value>::type>
+    span(span<U> const& other) : m_data(other.data()), m_size(other.size()) {}
+
+    T* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T* begin() const { return m_data; }
+    T* end() const { return m_data + m_size; }
+    T& operator[](size_t i) const { return m_data[i]; }
+
+private:
+    T* m_data;
+    size_t m_size;
+};
+#endif
+
+class Message
+{
+public:
+    Message() : m_message(nullptr), m_status(RT_OK) { rbusMessage_Init(&m_message); }
+    /* Reserves 'capacity' bytes of fields up front, see rbusMessage_InitWithCapacity. */
+    explicit Message(uint32_t capacity) : m_message(nullptr), m_status(RT_OK) { rbusMessage_InitWithCapacity(&m_message, capacity); }
+    ~Message() { reset(); }
+
+    Message(Message&& other) noexcept : m_message(other.m_message), m_status(other.m_status) { other.m_message = nullptr; }
+    Message& operator=(Message&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            m_message = other.m_message;
+            m_status = other.m_status;
+            other.m_message = nullptr;
+        }
+        return *this;
+    }
+    Message(Message const&) = delete;
+    Message& operator=(Message const&) = delete;
+
+    /* Takes over a reference the caller owns. */
+    static Message adopt(rbusMessage message) { return Message(message); }
+    /* Copies 'size' bytes received from a peer. */
+    static Message fromBytes(uint8_t const* data, uint32_t size)
+    {
+        rbusMessage message;
+        rbusMessage_FromBytes(&message, data, size);
+        return Message(message);
+    }
+
+    /* Another owner of the same message. Writing through either one is seen by both. */
+    Message share() const
+    {
+        rbusMessage_Retain(m_message);
+        Message shared(m_message);
+        shared.m_status = m_status;
+        return shared;
+    }
+
+    rbusMessage get() const { return m_message; }
+    /* Gives up ownership without releasing, for C functions that take over a reference. */
+    rbusMessage release()
+    {
+        rbusMessage message = m_message;
+        m_message = nullptr;
+        return message;
+    }
+    void reset()
+    {
+        if(m_message)
+            rbusMessage_Release(m_message);
+        m_message = nullptr;
+    }
+    explicit operator bool() const { return m_message != nullptr; }
+
+    /* The encoded message, valid until the message is released or written to. */
+    span<uint8_t const> bytes() const
+    {
+        uint8_t* data = nullptr;
+        uint32_t size = 0;
+        rbusMessage_ToBytes(m_message, &data, &size);
+        return span<uint8_t const>(data, size);
+    }
+
+    rtError status() const { return m_status; }
+
+    Message& setString(char const* value) { if(m_status == RT_OK) m_status = rbusMessage_SetString(m_message, value); return *this; }
+    Message& setString(std::string const& value) { return setString(value.c_str()); }
+    Message& setBytes(span<uint8_t const> value) { if(m_status == RT_OK) m_status = rbusMessage_SetBytes(m_message, value.data(), (uint32_t)value.size()); return *this; }
+    Message& setInt32(int32_t value) { if(m_status == RT_OK) m_status = rbusMessage_SetInt32(m_message, value); return *this; }
+    Message& setInt64(int64_t value) { if(m_status == RT_OK) m_status = rbusMessage_SetInt64(m_message, value); return *this; }
+    Message& setDouble(double value) { if(m_status == RT_OK) m_status = rbusMessage_SetDouble(m_message, value); return *this; }
+    Message& setMessage(Message const& value) { if(m_status == RT_OK) m_status = rbusMessage_SetMessage(m_message, value.m_message); return *this; }
+    Message& setInt32Array(span<int32_t const> values) { if(m_status == RT_OK) m_status = rbusMessage_SetInt32Array(m_message, values.data(), (uint32_t)values.size()); return *this; }
+    Message& setInt64Array(span<int64_t const> values) { if(m_status == RT_OK) m_status = rbusMessage_SetInt64Array(m_message, values.data(), (uint32_t)values.size()); return *this; }
+    Message& setDoubleArray(span<double const> values) { if(m_status == RT_OK) m_status = rbusMessage_SetDoubleArray(m_message, values.data(), (uint32_t)values.size()); return *this; }
+    Message& setMap(uint32_t count) { if(m_status == RT_OK) m_status = rbusMessage_SetMap(m_message, count); return *this; }
+
+    rtError getString(string_view& value) const
+    {
+        char const* s = nullptr;
+        rtError err = rbusMessage_GetString(m_message, &s);
+        if(err == RT_OK)
+            value = string_view(s);
+        return err;
+    }
+    rtError getBytes(span<uint8_t const>& value) const
+    {
+        uint8_t const* data = nullptr;
+        uint32_t size = 0;
+        rtError err = rbusMessage_GetBytes(m_message, &data, &size);
+        if(err == RT_OK)
+            value = span<uint8_t const>(data, size);
+        return err;
+    }
+    rtError getInt32(int32_t& value) const { return rbusMessage_GetInt32(m_message, &value); }
+    rtError getInt64(int64_t& value) const { return rbusMessage_GetInt64(m_message, &value); }
+    rtError getDouble(double& value) const { return rbusMessage_GetDouble(m_message, &value); }
+    /* A view sharing this message's buffer, see rbusMessage_GetMessage. */
+    rtError getMessage(Message& value) const
+    {
+        rbusMessage message = nullptr;
+        rtError err = rbusMessage_GetMessage(m_message, &message);
+        if(err == RT_OK)
+            value = Message(message);
+        return err;
+    }
+    rtError getMap(uint32_t& count) const { return rbusMessage_GetMap(m_message, &count); }
+    rtError getMapValue(char const* key) const { return rbusMessage_GetMapValue(m_message, key); }
+    void endMapRead() const { rbusMessage_EndMapRead(m_message); }
+
+    rbusMessageFieldType peekType() const { return rbusMessage_PeekType(m_message); }
+    rtError skip(uint32_t count) const { return rbusMessage_Skip(m_message, count); }
+    void rewind() const { rbusMessage_Rewind(m_message); }
+    rtError seek(uint32_t index) const { return rbusMessage_Seek(m_message, index); }
+    uint32_t countFields() const { return rbusMessage_CountFields(m_message); }
+
+private:
+    explicit Message(rbusMessage message) : m_message(message), m_status(RT_OK) {}
+
+    rbusMessage m_message;
+    rtError m_status;
+};
+
+}
+#endif
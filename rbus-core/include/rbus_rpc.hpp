@@ -0,0 +1,393 @@
+/*
+  * If not stated otherwise in this file or this component's Licenses.txt file
+  * the following copyright and licenses apply:
+  *
+  * Copyright 2019 RDK Management
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+*/
+
+#ifndef __rbusRpc_HPP__
+#define __rbusRpc_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "rbus_core.h"
+#include "rbus_message.hpp"
+
+/* Typed remote method calls for C++, header only and C++11.
+ *
+ * rbus::call<R...>(object, method, args...) marshals 'args' in order, invokes 'method' and unmarshals a reply made of an
+ * int32 rbus_error_t followed by one field for each of R, which is the reply layout rbus-core handlers already use.
+ * rbus::bind(object, method, handler) registers a handler whose parameters are unmarshalled from the request and whose
+ * return value is marshalled into such a reply. The Set and Get sequence for both is generated from the types at
+ * compile time.
+ *
+ * Supported field types are int32_t, int64_t, double, std::string and rbus::string_view. A string_view handler parameter
+ * points into the request and is only valid during the handler. A handler returns void, one value, a std::tuple of values, or an
+ * rbus::Result, which converts from either an rbus_error_t or a std::tuple of the values. */
+namespace rbus
+{
+
+/* FNV-1a of a method name, the same hash rbus-core sends in the v2 header, usable in constant expressions, for example as
+ * the case labels of a handler that serves several methods. call and bind don't use it: rbus-core hashes the method name
+ * itself when it writes the header and when it looks the method up. */
+constexpr uint32_t method_hash(char const* name, uint32_t hash = 2166136261u)
+{
+    return *name ? method_hash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+constexpr int default_timeout = 1000; /*milliseconds*/
+
+/* The outcome of a call: an error, or success and the reply values. */
+template<typename... R>
+struct Result
+{
+    Result() : error(RTMESSAGE_BUS_SUCCESS) {}
+    Result(rbus_error_t e) : error(e) {}
+    Result(std::tuple<R...> v) : error(RTMESSAGE_BUS_SUCCESS), values(std::move(v)) {}
+
+    rbus_error_t error;
+    std::tuple<R...> values;
+};
+
+namespace detail
+{
+
+template<typename T>
+struct Codec;
+
+template<>
+struct Codec<int32_t>
+{
+    static rtError set(rbusMessage m, int32_t v) { return rbusMessage_SetInt32(m, v); }
+    static rtError get(rbusMessage m, int32_t& v) { return rbusMessage_GetInt32(m, &v); }
+};
+
+template<>
+struct Codec<int64_t>
+{
+    static rtError set(rbusMessage m, int64_t v) { return rbusMessage_SetInt64(m, v); }
+    static rtError get(rbusMessage m, int64_t& v) { return rbusMessage_GetInt64(m, &v); }
+};
+
+template<>
+struct Codec<double>
+{
+    static rtError set(rbusMessage m, double v) { return rbusMessage_SetDouble(m, v); }
+    static rtError get(rbusMessage m, double& v) { return rbusMessage_GetDouble(m, &v); }
+};
+
+template<>
+struct Codec<std::string>
+{
+    static rtError set(rbusMessage m, std::string const& v) { return rbusMessage_SetString(m, v.c_str()); }
+    static rtError get(rbusMessage m, std::string& v)
+    {
+        char const* s = nullptr;
+        rtError err = rbusMessage_GetString(m, &s);
+        if(err == RT_OK)
+            v = s;
+        return err;
+    }
+};
+
+template<>
+struct Codec<char const*>
+{
+    static rtError set(rbusMessage m, char const* v) { return rbusMessage_SetString(m, v); }
+};
+
+/* The message needs a terminated string, so a view is copied first. */
+template<>
+struct Codec<string_view>
+{
+    static rtError set(rbusMessage m, string_view const& v)
+    {
+        return rbusMessage_SetString(m, std::string(v.data(), v.size()).c_str());
+    }
+    static rtError get(rbusMessage m, string_view& v)
+    {
+        char const* s = nullptr;
+        rtError err = rbusMessage_GetString(m, &s);
+        if(err == RT_OK)
+            v = string_view(s);
+        return err;
+    }
+};
+
+/* String literals and char arrays are sent as strings. */
+template<typename T>
+struct Encoded
+{
+    typedef typename std::conditional<std::is_array<typename std::remove_reference<T>::type>::value ||
+        std::is_pointer<typename std::decay<T>::type>::value, char const*, typename std::decay<T>::type>::type type;
+};
+
+inline rtError pack(rbusMessage)
+{
+    return RT_OK;
+}
+
+template<typename A, typename... Rest>
+rtError pack(rbusMessage m, A const& arg, Rest const&... rest)
+{
+    rtError err = Codec<typename Encoded<A const&>::type>::set(m, arg);
+    return err != RT_OK ? err : pack(m, rest...);
+}
+
+template<size_t... I>
+struct indices {};
+
+template<size_t N, size_t... I>
+struct make_indices : make_indices<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct make_indices<0, I...>
+{
+    typedef indices<I...> type;
+};
+
+template<typename Tuple>
+inline rtError unpack(rbusMessage, Tuple&, indices<>)
+{
+    return RT_OK;
+}
+
+template<typename Tuple, size_t I, size_t... Rest>
+rtError unpack(rbusMessage m, Tuple& values, indices<I, Rest...>)
+{
+    rtError err = Codec<typename std::tuple_element<I, Tuple>::type>::get(m, std::get<I>(values));
+    return err != RT_OK ? err : unpack(m, values, indices<Rest...>());
+}
+
+template<typename Tuple>
+rtError unpack(rbusMessage m, Tuple& values)
+{
+    return unpack(m, values, typename make_indices<std::tuple_size<Tuple>::value>::type());
+}
+
+/* The parameter types of a function pointer or of a lambda's operator(). */
+template<typename F>
+struct Signature : Signature<decltype(&F::operator())> {};
+
+template<typename R, typename... A>
+struct Signature<R (*)(A...)>
+{
+    typedef R result;
+    typedef std::tuple<typename std::decay<A>::type...> arguments;
+};
+
+template<typename C, typename R, typename... A>
+struct Signature<R (C::*)(A...) const> : Signature<R (*)(A...)> {};
+
+template<typename C, typename R, typename... A>
+struct Signature<R (C::*)(A...)> : Signature<R (*)(A...)> {};
+
+template<typename F, typename Tuple, size_t... I>
+typename Signature<F>::result apply(F& f, Tuple& values, indices<I...>)
+{
+    return f(std::get<I>(values)...);
+}
+
+/* A reply: the status, then the values on success. */
+template<typename... R, size_t... I>
+rtError reply(rbusMessage m, Result<R...> const& result, indices<I...>)
+{
+    rtError err = rbusMessage_SetInt32(m, result.error);
+    if(err != RT_OK || result.error != RTMESSAGE_BUS_SUCCESS)
+        return err;
+    return pack(m, std::get<I>(result.values)...);
+}
+
+template<typename... R>
+rtError reply(rbusMessage m, Result<R...> const& result)
+{
+    return reply(m, result, typename make_indices<sizeof...(R)>::type());
+}
+
+template<typename... R>
+rtError reply(rbusMessage m, std::tuple<R...> const& values)
+{
+    return reply(m, Result<R...>(values));
+}
+
+template<typename T>
+rtError reply(rbusMessage m, T const& value)
+{
+    rtError err = rbusMessage_SetInt32(m, RTMESSAGE_BUS_SUCCESS);
+    return err != RT_OK ? err : pack(m, value);
+}
+
+template<typename F, typename R = typename Signature<F>::result>
+struct Invoke
+{
+    template<typename Tuple>
+    static rtError run(F& f, Tuple& args, rbusMessage response)
+    {
+        return reply(response, apply(f, args, typename make_indices<std::tuple_size<Tuple>::value>::type()));
+    }
+};
+
+template<typename F>
+struct Invoke<F, void>
+{
+    template<typename Tuple>
+    static rtError run(F& f, Tuple& args, rbusMessage response)
+    {
+        apply(f, args, typename make_indices<std::tuple_size<Tuple>::value>::type());
+        return rbusMessage_SetInt32(response, RTMESSAGE_BUS_SUCCESS);
+    }
+};
+
+template<typename F>
+int dispatch(const char* destination, const char* method, rbusMessage request, void* user_data, rbusMessage* response,
+    const rtMessageHeader* hdr)
+{
+    typename Signature<F>::arguments args;
+    (void)destination;
+    (void)method;
+    (void)hdr;
+
+    rbusMessage_Init(response);
+    if(unpack(request, args) != RT_OK)
+        rbusMessage_SetInt32(*response, RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    else if(Invoke<F>::run(*static_cast<F*>(user_data), args, *response) != RT_OK)
+    {
+        /*the reply couldn't be packed, so don't send part of one*/
+        rbusMessage_Release(*response);
+        rbusMessage_Init(response);
+        rbusMessage_SetInt32(*response, RTMESSAGE_BUS_ERROR_GENERAL);
+    }
+    return 0;
+}
+
+template<typename F>
+void destroy(void* handler)
+{
+    delete static_cast<F*>(handler);
+}
+
+}
+
+template<typename... R, typename... A>
+Result<R...> call_with_timeout(int timeout_millisecs, char const* object, char const* method, A const&... args)
+{
+    Result<R...> result;
+    rbusMessage request = nullptr;
+    rbusMessage response = nullptr;
+    int32_t status = RTMESSAGE_BUS_SUCCESS;
+
+    rbusMessage_Init(&request);
+    if(detail::pack(request, args...) != RT_OK)
+    {
+        rbusMessage_Release(request);
+        return Result<R...>(RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    }
+    /*rbus_invokeRemoteMethod releases the request*/
+    if((result.error = rbus_invokeRemoteMethod(object, method, request, timeout_millisecs, &response)) != RTMESSAGE_BUS_SUCCESS)
+        return result;
+    if(rbusMessage_GetInt32(response, &status) != RT_OK)
+        result.error = RTMESSAGE_BUS_ERROR_MALFORMED_RESPONSE;
+    else if((result.error = (rbus_error_t)status) == RTMESSAGE_BUS_SUCCESS && detail::unpack(response, result.values) != RT_OK)
+        result.error = RTMESSAGE_BUS_ERROR_MALFORMED_RESPONSE;
+    rbusMessage_Release(response);
+    return result;
+}
+
+template<typename... R, typename... A>
+Result<R...> call(char const* object, char const* method, A const&... args)
+{
+    return call_with_timeout<R...>(default_timeout, object, method, args...);
+}
+
+/* A method registered by rbus::bind. It stays registered until the Binding is destroyed or reset.
+ * rbus-core can still be running the handler for a request that arrived just before the method was unregistered, and
+ * reset frees the handler as soon as rbus_unregisterMethod returns. So a Binding must not be destroyed or reset while a
+ * request for its method may be dispatched: do it after rbus_unregisterObj or rbus_closeBrokerConnection once the
+ * requests in flight are answered, or from a handler of another method of the same object, since one object's requests
+ * are run one at a time. */
+class Binding
+{
+public:
+    Binding() : m_handler(nullptr), m_destroy(nullptr), m_status(RTMESSAGE_BUS_SUCCESS) {}
+    ~Binding() { reset(); }
+
+    Binding(Binding&& other) noexcept
+        : m_object(std::move(other.m_object)), m_method(std::move(other.m_method)), m_handler(other.m_handler),
+          m_destroy(other.m_destroy), m_status(other.m_status)
+    {
+        other.m_handler = nullptr;
+    }
+    Binding& operator=(Binding&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            m_object = std::move(other.m_object);
+            m_method = std::move(other.m_method);
+            m_handler = other.m_handler;
+            m_destroy = other.m_destroy;
+            m_status = other.m_status;
+            other.m_handler = nullptr;
+        }
+        return *this;
+    }
+    Binding(Binding const&) = delete;
+    Binding& operator=(Binding const&) = delete;
+
+    /* The result of rbus_registerMethod. */
+    rbus_error_t status() const { return m_status; }
+
+    /* See above for when this is safe. */
+    void reset()
+    {
+        if(!m_handler)
+            return;
+        if(m_status == RTMESSAGE_BUS_SUCCESS)
+            rbus_unregisterMethod(m_object.c_str(), m_method.c_str());
+        m_destroy(m_handler);
+        m_handler = nullptr;
+    }
+
+private:
+    template<typename F>
+    friend Binding bind(char const* object, char const* method, F handler);
+
+    std::string m_object;
+    std::string m_method;
+    void* m_handler;
+    void (*m_destroy)(void*);
+    rbus_error_t m_status;
+};
+
+/* Registers 'handler' for 'method' of 'object', which must already be registered with rbus_registerObj. */
+template<typename F>
+Binding bind(char const* object, char const* method, F handler)
+{
+    Binding binding;
+    F* copy = new F(std::move(handler));
+
+    binding.m_object = object;
+    binding.m_method = method;
+    binding.m_handler = copy;
+    binding.m_destroy = &detail::destroy<F>;
+    binding.m_status = rbus_registerMethod(object, method, &detail::dispatch<F>, copy);
+    return binding;
+}
+
+}
+#endif
@@ -23,6 +23,8 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
+#include <sched.h>
 
 #include "rbus_core.h"
 #include "rbus_logger.h"
@@ -34,6 +36,22 @@ void rbusMessage_BeginMetaSectionWrite(rbusMessage message);
 void rbusMessage_EndMetaSectionWrite(rbusMessage message);
 void rbusMessage_BeginMetaSectionRead(rbusMessage message);
 void rbusMessage_EndMetaSectionRead(rbusMessage message);
+rtError rbusMessage_GetMetaMethod(rbusMessage message, char const** method);
+rtError rbusMessage_GetMetaEvent(rbusMessage message, char const** event_name, char const** object_name, int32_t* is_rbus2);
+int32_t rbusMessage_GetMetaFlags(rbusMessage message);
+uint32_t rbusMessage_GetMetaMethodHash(rbusMessage message);
+uint32_t rbusMessage_HashName(char const* name);
+rtError rbusMessage_Compress(rbusMessage message, uint32_t threshold, rbusMessage* compressed);
+int rbusMessage_GetWireVersion(rbusMessage message);
+typedef struct _rbusMessageStringTable* rbusMessageStringTable;
+rbusMessageStringTable rbusMessageStringTable_Create(void);
+void rbusMessageStringTable_Reset(rbusMessageStringTable table);
+void rbusMessageStringTable_Destroy(rbusMessageStringTable table);
+rtError rbusMessage_ToBytesV2(rbusMessage message, rbusMessageStringTable table, uint32_t sequence, uint64_t deadline,
+    uint8_t** buff, uint32_t* n);
+void rbusMessage_ConfirmNames(rbusMessage message, rbusMessageStringTable table);
+rtError rbusMessage_ResolveNames(rbusMessage message, rbusMessageStringTable table);
+void rbusMessage_FromBytesAdopt(rbusMessage* message, uint8_t* buff, uint32_t n, void (*release_buffer)(uint8_t* buff));
 
 /* Begin constant definitions.*/
 static const unsigned int TIMEOUT_VALUE_FIRE_AND_FORGET = 1000;
@@ -41,10 +59,328 @@ static const unsigned int MAX_SUBSCRIBER_NAME_LENGTH = MAX_OBJECT_NAME_LENGTH;
 static const char * DEFAULT_EVENT = "";
 #define METHOD_ADD_EVENT_SUBSCRIPTION "_subscribe"
 #define METHOD_REMOVE_EVENT_SUBSCRIPTION "_unsubscribe"
+/*Request flags, sent after the method name in the meta section. Older peers only read the method name.*/
+#define REQUEST_FLAG_ACCEPTS_COMPRESSION 0x1
 /* End constant definitions.*/
 
 /* Begin type definitions.*/
 
+/* Begin epoch reclamation */
+/*The registries below are read without g_mutex: dispatch, publishing and event delivery look things up inside
+  epoch_enter() and epoch_exit(). Writers are still serialized by g_mutex. They unlink what they replace or remove
+  and hand it to epoch_retire() instead of freeing it. Each reading thread announces the epoch it reads in, and the
+  global epoch only advances once every reading thread has seen it. Memory retired in epoch e is therefore
+  unreachable once the epoch is e + 2, and is freed then by whichever thread retires something next.
+  A read section must not take g_mutex, or wait on a thread that holds it.*/
+typedef struct _epoch_thread
+{
+    unsigned long epoch; /*the epoch this thread reads in, or 0 outside of a read section*/
+    int depth; /*read sections nest*/
+    int in_use; /*0 once the thread exited, so another one can take the record*/
+    struct _epoch_thread* next;
+} epoch_thread_t;
+
+typedef struct _epoch_retired
+{
+    void* p;
+    rtVector_Cleanup destroyer;
+    unsigned long epoch;
+    struct _epoch_retired* next;
+} epoch_retired_t;
+
+static epoch_thread_t* g_epoch_threads = NULL; /*never freed, records are reused instead*/
+static unsigned long g_epoch = 1;
+static epoch_retired_t* g_epoch_retired = NULL; /*newest first*/
+static pthread_mutex_t g_epoch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_epoch_key;
+static __thread epoch_thread_t* t_epoch_thread = NULL;
+
+static void epoch_thread_exit(void* p)
+{
+    epoch_thread_t* thread = p;
+    __atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_key_create()
+{
+    pthread_key_create(&g_epoch_key, epoch_thread_exit);
+}
+
+static epoch_thread_t* epoch_thread()
+{
+    epoch_thread_t* thread = t_epoch_thread;
+
+    if(thread)
+        return thread;
+    pthread_once(&g_epoch_once, epoch_key_create);
+    for(thread = __atomic_load_n(&g_epoch_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next)
+    {
+        if(0 == __atomic_load_n(&thread->in_use, __ATOMIC_RELAXED) && __sync_bool_compare_and_swap(&thread->in_use, 0, 1))
+            break;
+    }
+    if(NULL == thread)
+    {
+        thread = rt_calloc(1, sizeof(epoch_thread_t));
+        thread->in_use = 1;
+        thread->next = __atomic_load_n(&g_epoch_threads, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&g_epoch_threads, &thread->next, thread, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(g_epoch_key, thread);
+    t_epoch_thread = thread;
+    return thread;
+}
+
+static void epoch_enter()
+{
+    epoch_thread_t* thread = epoch_thread();
+
+    if(thread->depth++ == 0)
+    {
+        __atomic_store_n(&thread->epoch, __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+        /*the announcement must be visible before anything is read from the registries*/
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+static void epoch_exit()
+{
+    epoch_thread_t* thread = t_epoch_thread;
+
+    if(--thread->depth == 0)
+        __atomic_store_n(&thread->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*Advances the epoch if every thread in a read section has seen the current one and returns what can be freed now.
+  Called with g_epoch_mutex held.*/
+static epoch_retired_t* epoch_collect()
+{
+    epoch_thread_t* thread;
+    epoch_retired_t** link;
+    epoch_retired_t* expired;
+    unsigned long epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for(thread = __atomic_load_n(&g_epoch_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next)
+    {
+        unsigned long e = __atomic_load_n(&thread->epoch, __ATOMIC_ACQUIRE);
+        if(e != 0 && e != epoch)
+            break;
+    }
+    if(NULL == thread)
+        __atomic_store_n(&g_epoch, ++epoch, __ATOMIC_RELEASE);
+    for(link = &g_epoch_retired; *link && (*link)->epoch + 2 > epoch; link = &(*link)->next)
+        ;
+    expired = *link;
+    *link = NULL;
+    return expired;
+}
+
+static void epoch_free(epoch_retired_t* expired)
+{
+    while(expired)
+    {
+        epoch_retired_t* next = expired->next;
+        expired->destroyer(expired->p);
+        free(expired);
+        expired = next;
+    }
+}
+
+/*Frees 'p' with 'destroyer' once no read section can reach it any more. The caller must have unlinked it already.*/
+static void epoch_retire(void* p, rtVector_Cleanup destroyer)
+{
+    epoch_retired_t* retired = rt_malloc(sizeof(epoch_retired_t));
+    epoch_retired_t* expired;
+
+    retired->p = p;
+    retired->destroyer = destroyer;
+    pthread_mutex_lock(&g_epoch_mutex);
+    retired->epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+    retired->next = g_epoch_retired;
+    g_epoch_retired = retired;
+    expired = epoch_collect();
+    pthread_mutex_unlock(&g_epoch_mutex);
+    /*destroyers may retire more, so run them without the mutex*/
+    epoch_free(expired);
+}
+
+/*Waits until everything retired so far is freed. Does nothing inside a read section, which would wait for itself.*/
+static void epoch_drain()
+{
+    if(t_epoch_thread && t_epoch_thread->depth > 0)
+        return;
+    for(;;)
+    {
+        epoch_retired_t* expired;
+        bool pending;
+
+        pthread_mutex_lock(&g_epoch_mutex);
+        expired = epoch_collect();
+        pending = NULL != g_epoch_retired;
+        pthread_mutex_unlock(&g_epoch_mutex);
+        if(NULL == expired && !pending)
+            return;
+        epoch_free(expired);
+        if(pending)
+            sched_yield();
+    }
+}
+/* End epoch reclamation */
+
+/* Begin name maps */
+/*Registered objects, their methods and events, and the client's subscriptions, by name. An open-addressing hash with
+  linear probing keyed by the FNV-1a hash of the name. The name is interned in the entry it maps to, which outlives its
+  slot, so the map keeps only a pointer to it. v2 requests carry the hash of their method in the header, so dispatching
+  them doesn't hash the name again.
+  name_map_find() may run in a read section concurrently with one writer holding g_mutex. A slot's name is published
+  last, and a slot is never reused: removing an entry leaves a marker in its slot, and once used and removed slots reach
+  3/4 of the table the writer builds a new one and retires the old. Removed values must be retired by the caller.*/
+#define NAME_MAP_INITIAL_CAPACITY 16 /*power of 2*/
+
+static char const name_map_removed[] = "";
+
+typedef struct _name_map_slot
+{
+    uint32_t hash;
+    char const* name; /*NULL if the slot is free, name_map_removed once its entry is removed*/
+    void* value;
+} name_map_slot_t;
+
+typedef struct _name_map_table
+{
+    uint32_t capacity; /*power of 2*/
+    uint32_t used; /*slots that are not free*/
+    name_map_slot_t slots[];
+} name_map_table_t;
+
+typedef struct _name_map
+{
+    name_map_table_t* table; /*NULL before the first entry*/
+    uint32_t count;
+} name_map_t;
+
+static void name_map_init(name_map_t* map)
+{
+    map->table = NULL;
+    map->count = 0;
+}
+
+static void* name_map_find(name_map_t const* map, char const* name, uint32_t hash)
+{
+    name_map_table_t const* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+    char const* slot_name;
+    uint32_t mask, i;
+
+    if(NULL == table)
+        return NULL;
+    mask = table->capacity - 1;
+    for(i = hash & mask; (slot_name = __atomic_load_n(&table->slots[i].name, __ATOMIC_ACQUIRE)); i = (i + 1) & mask)
+    {
+        if(slot_name != name_map_removed && table->slots[i].hash == hash && strcmp(slot_name, name) == 0)
+            return table->slots[i].value;
+    }
+    return NULL;
+}
+
+/*Iterates over the entries. '*pos' starts at 0, and NULL is returned after the last entry. Entries added or removed
+  meanwhile may or may not be seen.*/
+static void* name_map_next(name_map_t const* map, uint32_t* pos)
+{
+    name_map_table_t const* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+
+    while(table && *pos < table->capacity)
+    {
+        char const* slot_name = __atomic_load_n(&table->slots[(*pos)++].name, __ATOMIC_ACQUIRE);
+        if(slot_name && slot_name != name_map_removed)
+            return table->slots[*pos - 1].value;
+    }
+    return NULL;
+}
+
+static void name_map_place(name_map_table_t* table, uint32_t hash, char const* name, void* value)
+{
+    uint32_t mask = table->capacity - 1;
+    uint32_t i;
+
+    for(i = hash & mask; table->slots[i].name; i = (i + 1) & mask)
+        ;
+    table->slots[i].hash = hash;
+    table->slots[i].value = value;
+    __atomic_store_n(&table->slots[i].name, name, __ATOMIC_RELEASE);
+    table->used++;
+}
+
+/*Adds 'value' under 'name', which must not be in the map yet and must stay valid until it is removed. Rebuilding drops
+  the removed slots and keeps the table at most half full.*/
+static void name_map_insert(name_map_t* map, char const* name, uint32_t hash, void* value)
+{
+    name_map_table_t* table = map->table;
+
+    if(NULL == table || (table->used + 1) * 4 > table->capacity * 3)
+    {
+        uint32_t i, capacity = NAME_MAP_INITIAL_CAPACITY;
+        name_map_table_t* rebuilt;
+
+        while((map->count + 1) * 2 > capacity)
+            capacity *= 2;
+        rebuilt = rt_calloc(1, sizeof(name_map_table_t) + capacity * sizeof(name_map_slot_t));
+        rebuilt->capacity = capacity;
+        for(i = 0; table && i < table->capacity; ++i)
+        {
+            if(table->slots[i].name && table->slots[i].name != name_map_removed)
+                name_map_place(rebuilt, table->slots[i].hash, table->slots[i].name, table->slots[i].value);
+        }
+        __atomic_store_n(&map->table, rebuilt, __ATOMIC_RELEASE);
+        if(table)
+            epoch_retire(table, rtVector_Cleanup_Free);
+        table = rebuilt;
+    }
+    name_map_place(table, hash, name, value);
+    map->count++;
+}
+
+/*Takes the entry out of the map and returns its value, or NULL if there is no such entry.*/
+static void* name_map_remove(name_map_t* map, char const* name, uint32_t hash)
+{
+    name_map_table_t* table = map->table;
+    uint32_t mask, i;
+
+    if(0 == map->count)
+        return NULL;
+    mask = table->capacity - 1;
+    for(i = hash & mask; table->slots[i].name; i = (i + 1) & mask)
+    {
+        if(table->slots[i].name != name_map_removed && table->slots[i].hash == hash && strcmp(table->slots[i].name, name) == 0)
+        {
+            __atomic_store_n(&table->slots[i].name, name_map_removed, __ATOMIC_RELEASE);
+            map->count--;
+            return table->slots[i].value;
+        }
+    }
+    return NULL;
+}
+
+/*Empties the map, passing each value to 'destroyer', which must retire rather than free values readers may still hold.*/
+static void name_map_destroy(name_map_t* map, rtVector_Cleanup destroyer)
+{
+    name_map_table_t* table = map->table;
+    uint32_t i;
+
+    if(NULL == table)
+        return;
+    __atomic_store_n(&map->table, NULL, __ATOMIC_RELEASE);
+    for(i = 0; i < table->capacity; ++i)
+    {
+        if(table->slots[i].name && table->slots[i].name != name_map_removed && destroyer)
+            destroyer(table->slots[i].value);
+    }
+    epoch_retire(table, rtVector_Cleanup_Free);
+    name_map_init(map);
+}
+/* End name maps */
+
 /* Begin rbus_server */
 
 struct _server_object;
@@ -58,25 +394,43 @@ typedef struct _server_method
 } *server_method_t;
 
 
+/*An event's listeners. Publishing reads the current set without g_mutex, so a change replaces the whole set.*/
+typedef struct _listener_set
+{
+    uint32_t count;
+    char* names[]; /*owned by the event; a removed name is retired along with the set that held it*/
+} *listener_set_t;
+
 typedef struct _server_event
 {
     char name[MAX_EVENT_NAME_LENGTH+1];
     server_object_t object;
-    rtVector listeners /*list of strings*/;
+    listener_set_t listeners;
     rbus_event_subscribe_callback_t sub_callback;
     void * sub_data;
 } *server_event_t;
 
+struct _queued_request;
+
 typedef struct _server_object
 {
     char name[MAX_OBJECT_NAME_LENGTH+1];
     void* data;
     rbus_callback_t callback;
     bool process_event_subscriptions;
-    rtVector methods; /*list of server_method_t*/
-    rtVector subscriptions; /*list of server_event_t*/
+    uint32_t hash; /*of name*/
+    uintptr_t listener_id; /*the closure of its rtConnection listener, unique to this registration*/
+    char listener_key[2 * sizeof(uintptr_t) + 1]; /*listener_id in hex*/
+    name_map_t methods; /*server_method_t by name*/
+    name_map_t events; /*server_event_t by name*/
     rbus_event_subscribe_callback_t subscribe_handler_override;
     void* subscribe_handler_data;
+    int refcount; /*held by the registries until retired, by onMessage, and by the dispatch executor while requests are queued*/
+    bool registered;
+    pthread_mutex_t mailbox_mutex;
+    struct _queued_request* mailbox_head; /*requests waiting for a dispatch worker, oldest first*/
+    struct _queued_request* mailbox_tail;
+    bool mailbox_scheduled; /*on a worker's ready list or being run by a worker*/
 } *server_object_t;
 
 void server_method_create(server_method_t* meth, char const* name, rbus_callback_t callback, void* data)
@@ -87,20 +441,10 @@ void server_method_create(server_method_t* meth, char const* name, rbus_callback
     (*meth)->data = data;
 }
 
-int server_method_compare(const void* left, const void* right)
-{
-    return strncmp(((server_event_t)left)->name, (char*)right, MAX_METHOD_NAME_LENGTH);
-}
-
-int server_event_compare(const void* left, const void* right)
-{
-    return strncmp(((server_event_t)left)->name, (char*)right, MAX_EVENT_NAME_LENGTH);
-}
-
 void server_event_create(server_event_t* event, const char * event_name, server_object_t obj, rbus_event_subscribe_callback_t sub_callback, void* sub_data)
 {
     (*event) = rt_malloc(sizeof(struct _server_event));
-    rtVector_Create(&(*event)->listeners);
+    (*event)->listeners = rt_calloc(1, sizeof(struct _listener_set));
     strcpy((*event)->name, event_name);
     (*event)->object = obj;
     (*event)->sub_callback = sub_callback;
@@ -110,85 +454,146 @@ void server_event_create(server_event_t* event, const char * event_name, server_
 void server_event_destroy(void* p)
 {
     server_event_t event = p;
-    rtVector_Destroy(event->listeners, rtVector_Cleanup_Free);
+    uint32_t i;
+    for(i = 0; i < event->listeners->count; ++i)
+        free(event->listeners->names[i]);
+    free(event->listeners);
     free(event);
 }
 
-void server_event_addListener(server_event_t event, char const* listener)
+static bool listener_set_contains(listener_set_t set, char const* listener)
+{
+    uint32_t i;
+    for(i = 0; i < set->count; ++i)
+    {
+        if(strcmp(set->names[i], listener) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*Adds or removes a listener, with g_mutex held. Returns whether the listeners changed.*/
+bool server_event_addListener(server_event_t event, char const* listener)
 {
     if(!listener)
     {
         RBUSCORELOG_ERROR("Listener is empty.");
     }
-    else if(!rtVector_HasItem(event->listeners, listener, rtVector_Compare_String))
+    else if(!listener_set_contains(event->listeners, listener))
     {
-        rtVector_PushBack(event->listeners, strdup(listener));
+        listener_set_t old = event->listeners;
+        listener_set_t set = rt_malloc(sizeof(struct _listener_set) + (old->count + 1) * sizeof(char*));
 
-        if(event->sub_callback)
-        {
-            event->sub_callback(event->object->name, event->name, listener, 1, NULL, event->sub_data);
-        }
+        memcpy(set->names, old->names, old->count * sizeof(char*));
+        set->names[old->count] = strdup(listener);
+        set->count = old->count + 1;
+        __atomic_store_n(&event->listeners, set, __ATOMIC_RELEASE);
+        epoch_retire(old, rtVector_Cleanup_Free);
 
         RBUSCORELOG_INFO("Listener %s added for event %s.", listener, event->name);
+        return true;
     }
     else
     {
         RBUSCORELOG_WARN("Listener %s is already registered for event %s.", listener, event->name);
     }
+    return false;
 }
 
-void server_event_removeListener(server_event_t event, char const* listener)
+bool server_event_removeListener(server_event_t event, char const* listener)
 {
     if(!listener)
     {
         RBUSCORELOG_ERROR("Listener is empty.");
     }
-    else if(rtVector_HasItem(event->listeners, listener, rtVector_Compare_String))
+    else if(listener_set_contains(event->listeners, listener))
     {
-        RBUSCORELOG_WARN("Removing listener %s for event %s.", listener, event->name);
+        listener_set_t old = event->listeners;
+        listener_set_t set = rt_malloc(sizeof(struct _listener_set) + (old->count - 1) * sizeof(char*));
+        char* removed = NULL;
+        uint32_t i;
 
-        rtVector_RemoveItemByCompare(event->listeners, listener, rtVector_Compare_String, rtVector_Cleanup_Free);
+        RBUSCORELOG_WARN("Removing listener %s for event %s.", listener, event->name);
 
-        if(event->sub_callback)
+        set->count = 0;
+        for(i = 0; i < old->count; ++i)
         {
-            event->sub_callback(event->object->name, event->name, listener, 0, NULL, event->sub_data);
+            if(strcmp(old->names[i], listener) == 0)
+                removed = old->names[i];
+            else
+                set->names[set->count++] = old->names[i];
         }
+        __atomic_store_n(&event->listeners, set, __ATOMIC_RELEASE);
+        epoch_retire(old, rtVector_Cleanup_Free);
+        epoch_retire(removed, rtVector_Cleanup_Free);
+        return true;
     }
     else
     {
         RBUSCORELOG_ERROR("Listener %s not found for event %s.", listener, event->name);
     }
-}
-
-int server_object_compare(const void* left, const void* right)
-{
-    return strncmp(((server_object_t)left)->name, (char*)right, MAX_OBJECT_NAME_LENGTH);
+    return false;
 }
 
 void server_object_create(server_object_t* obj, char const* name, rbus_callback_t callback, void* data)
 {
+    static uintptr_t listener_ids = 0;
+
     (*obj) = rt_malloc(sizeof(struct _server_object));
     strcpy((*obj)->name, name);
+    (*obj)->hash = rbusMessage_HashName(name);
+    (*obj)->listener_id = __sync_add_and_fetch(&listener_ids, 1);
+    snprintf((*obj)->listener_key, sizeof((*obj)->listener_key), "%lx", (unsigned long)(*obj)->listener_id);
     (*obj)->callback = callback;
     (*obj)->data = data;
     (*obj)->process_event_subscriptions = false;
     (*obj)->subscribe_handler_override = NULL;
     (*obj)->subscribe_handler_data = NULL;
-    rtVector_Create(&(*obj)->methods);
-    rtVector_Create(&(*obj)->subscriptions);
+    (*obj)->refcount = 1;
+    (*obj)->registered = true;
+    pthread_mutex_init(&(*obj)->mailbox_mutex, NULL);
+    (*obj)->mailbox_head = NULL;
+    (*obj)->mailbox_tail = NULL;
+    (*obj)->mailbox_scheduled = false;
+    name_map_init(&(*obj)->methods);
+    name_map_init(&(*obj)->events);
 }
 
-void server_object_destroy(void* p)
+void server_object_retain(server_object_t obj)
+{
+    __sync_add_and_fetch(&obj->refcount, 1);
+}
+
+void server_object_release(void* p)
 {
     server_object_t obj = p;
-    rtVector_Destroy(obj->methods, rtVector_Cleanup_Free);
-    rtVector_Destroy(obj->subscriptions, server_event_destroy);
+    if(__sync_sub_and_fetch(&obj->refcount, 1) != 0)
+        return;
+    name_map_destroy(&obj->methods, rtVector_Cleanup_Free);
+    name_map_destroy(&obj->events, server_event_destroy);
+    pthread_mutex_destroy(&obj->mailbox_mutex);
     free(obj);
 }
 
+/*Unregisters the object once it is out of g_server_objects and g_server_listeners. Requests the dispatch executor still
+  holds for it are answered without calling its handlers, and the registries' reference is dropped when no read section
+  can reach it.*/
+void server_object_destroy(void* p)
+{
+    server_object_t obj = p;
+    __atomic_store_n(&obj->registered, false, __ATOMIC_RELEASE);
+    epoch_retire(obj, server_object_release);
+}
+
+static int lock();
+static int unlock();
+
 rbus_error_t server_object_subscription_handler(server_object_t obj, const char * event, char const* subscriber, int added, rbusMessage payload)
 {
     rbus_error_t ret;
+    rbus_event_subscribe_callback_t handler_override;
+    void* handler_data;
+    server_event_t server_event;
 
     if((NULL == event) || (NULL == subscriber) ||
        (MAX_SUBSCRIBER_NAME_LENGTH <= strlen(subscriber)) || 
@@ -197,30 +602,36 @@ rbus_error_t server_object_subscription_handler(server_object_t obj, const char
         RBUSCORELOG_ERROR("Cannot %s subscriber %s to event %s. Length exceeds limits.", added ? "add":"remove", subscriber, event);
         return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
     }
-    
-    if(obj->subscribe_handler_override)
+
+    lock();
+    handler_override = obj->subscribe_handler_override;
+    handler_data = obj->subscribe_handler_data;
+    unlock();
+    if(handler_override)
     {
-        ret = (rbus_error_t)obj->subscribe_handler_override(obj->name, event, subscriber, added, payload, obj->subscribe_handler_data);
+        ret = (rbus_error_t)handler_override(obj->name, event, subscriber, added, payload, handler_data);
         if(ret != RTMESSAGE_BUS_SUBSCRIBE_NOT_HANDLED)
             return ret;
     }
 
-    server_event_t server_event = rtVector_Find(obj->subscriptions, event, server_event_compare);
+    lock();
+    server_event = name_map_find(&obj->events, event, rbusMessage_HashName(event));
 
     if(server_event)
     {
-        if(added)
-        {
-            server_event_addListener(server_event, subscriber);
-        }
-        else
-        {
-            server_event_removeListener(server_event, subscriber);
-        }
+        bool changed = added ? server_event_addListener(server_event, subscriber) : server_event_removeListener(server_event, subscriber);
+        rbus_event_subscribe_callback_t sub_callback = server_event->sub_callback;
+        void* sub_data = server_event->sub_data;
+
+        /*the event may be unregistered once g_mutex is released, so its callback is called with our copies*/
+        unlock();
+        if(changed && sub_callback)
+            sub_callback(obj->name, event, subscriber, added, NULL, sub_data);
         return RTMESSAGE_BUS_SUCCESS;
     }
     else
     {
+        unlock();
         RBUSCORELOG_ERROR("Object %s doesn't support event %s. Cannot %s listener.", obj->name, event, added ? "add":"remove");
         return RTMESSAGE_BUS_ERROR_UNSUPPORTED_EVENT;
     }
@@ -231,6 +642,7 @@ typedef struct _queued_request
     rtMessageHeader hdr;
     rbusMessage msg;
     server_object_t obj;
+    struct _queued_request* next; /*in the object's mailbox*/
 } *queued_request_t;
 
 void queued_request_create(queued_request_t* req, rtMessageHeader hdr, rbusMessage msg, server_object_t obj)
@@ -239,6 +651,7 @@ void queued_request_create(queued_request_t* req, rtMessageHeader hdr, rbusMessa
     (*req)->hdr = hdr;
     (*req)->msg = msg;
     (*req)->obj = obj;
+    (*req)->next = NULL;
 }
 
 /* End rbus_server */
@@ -253,204 +666,903 @@ typedef struct _client_event
 
 typedef struct _client_subscription
 {
-    char object[MAX_OBJECT_NAME_LENGTH+1];
-    rtVector events; /*list of client_event_t*/
-} *client_subscription_t;
+    char object[MAX_OBJECT_NAME_LENGTH+1];
+    name_map_t events; /*client_event_t by name*/
+} *client_subscription_t;
+
+void client_event_create(client_event_t* event, const char* name, rbus_event_callback_t callback, void* data)
+{
+    (*event) = rt_malloc(sizeof(struct _client_event));
+    (*event)->callback = callback;
+    (*event)->data = data;
+    strcpy((*event)->name, name);
+}
+
+void client_subscription_create(client_subscription_t* sub, const char * object_name)
+{
+    (*sub) = rt_malloc(sizeof(struct _client_subscription));
+    strcpy((*sub)->object, object_name);
+    name_map_init(&(*sub)->events);
+}
+
+void client_subscription_destroy(void* p)
+{
+    client_subscription_t sub = p;
+    name_map_destroy(&sub->events, rtVector_Cleanup_Free);
+    free(sub);
+}
+
+void client_subscription_retire(void* p)
+{
+    epoch_retire(p, client_subscription_destroy);
+}
+
+/* End rbus_client */
+
+/* Begin string tables */
+/*The key is the peer and the local name separated by NAME_TABLE_KEY_SEPARATOR.*/
+#define NAME_TABLE_KEY_SEPARATOR '\x1f'
+#define NAME_TABLE_KEY_LENGTH (2 * MAX_OBJECT_NAME_LENGTH + 2)
+
+typedef struct _name_table
+{
+    char key[NAME_TABLE_KEY_LENGTH];
+    pthread_mutex_t mutex; /*the table is changed by every message encoded or decoded with it*/
+    unsigned long last_used; /*for evicting the least recently used table*/
+    rbusMessageStringTable table;
+} *name_table_t;
+
+void name_table_create(name_table_t* entry, const char* key)
+{
+    (*entry) = rt_malloc(sizeof(struct _name_table));
+    strcpy((*entry)->key, key);
+    pthread_mutex_init(&(*entry)->mutex, NULL);
+    (*entry)->last_used = 0;
+    (*entry)->table = rbusMessageStringTable_Create();
+}
+
+void name_table_destroy(void* p)
+{
+    name_table_t entry = p;
+    rbusMessageStringTable_Destroy(entry->table);
+    pthread_mutex_destroy(&entry->mutex);
+    free(entry);
+}
+
+void name_table_retire(void* p)
+{
+    epoch_retire(p, name_table_destroy);
+}
+/* End string tables */
+
+/* End type definitions.*/
+
+/* Begin global variables*/
+#define MAX_DAEMON_ADDRESS_LEN 256
+static char g_daemon_address[MAX_DAEMON_ADDRESS_LEN] = "unix:///tmp/rtrouted";
+static rtConnection g_connection = NULL;
+static name_map_t g_server_objects; /*server_object_t by name*/
+static name_map_t g_server_listeners; /*the same server_object_t by listener_key*/
+static pthread_mutex_t g_mutex;
+static int g_mutex_init = 0;
+static bool g_run_event_client_dispatch = false;
+static name_map_t g_event_subscriptions_for_client; /*client_subscription_t by object name. Used by the subscriber to track all active subscriptions. */
+
+/*client disconnect detection*/
+static bool g_advisory_listener_installed = false;
+static rbus_client_disconnect_callback_t g_client_disconnect_callback = NULL;
+
+rbus_event_callback_t g_master_event_callback = NULL;
+void* g_master_event_user_data = NULL;
+
+/*compression of outbound messages. Disabled while the threshold is 0.*/
+static unsigned int g_compression_threshold = 0;
+static int g_compression_flags = 0;
+/*set while this thread dispatches a request whose sender can decompress our response*/
+static __thread bool t_requester_accepts_compression = false;
+
+/*wire format of the messages we originate. Responses use the format of the request they answer.*/
+static int g_wire_version = 0;
+static uint32_t g_wire_sequence = 0;
+static __thread int t_request_wire_version = 0;
+
+/*string tables for the names in v2 messages, one per peer and direction. They are looked up in a read section and each
+  has its own mutex, as they are used while sending and receiving, with or without g_mutex held. g_name_table_mutex
+  serializes adding and evicting tables.*/
+#define MAX_NAME_TABLES 256 /*per direction*/
+#define METHOD_UNKNOWN_NAMES "_rbus_unknown_names"
+static name_map_t g_name_tables_out; /*name_table_t by destination and sender*/
+static name_map_t g_name_tables_in; /*name_table_t by the reply topic and topic of received messages*/
+static pthread_mutex_t g_name_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long g_name_table_clock = 0;
+
+/* End global variables*/
+
+static int lock()
+{
+	return pthread_mutex_lock(&g_mutex);
+}
+
+static int unlock()
+{
+	return pthread_mutex_unlock(&g_mutex);
+}
+
+static rbus_error_t send_subscription_request(const char * object_name, const char * event_name, bool activate, const rbusMessage payload, int* providerError, int timeout);
+
+static void perform_init()
+{
+    RBUSCORELOG_DEBUG("Performing init");
+    name_map_init(&g_server_objects);
+    name_map_init(&g_server_listeners);
+    name_map_init(&g_event_subscriptions_for_client);
+}
+
+static void perform_cleanup()
+{
+    uint32_t i, i2;
+    client_subscription_t sub;
+    client_event_t event;
+
+    RBUSCORELOG_DEBUG("Performing cleanup");
+
+    lock();
+
+    name_map_destroy(&g_server_listeners, NULL);
+    name_map_destroy(&g_server_objects, server_object_destroy);
+
+    if(g_event_subscriptions_for_client.count > 0)
+    {
+        RBUSCORELOG_INFO("Cancelling active event subscriptions.");
+        unlock();
+        epoch_enter();
+        for(i = 0; (sub = name_map_next(&g_event_subscriptions_for_client, &i)); )
+        {
+            for(i2 = 0; (event = name_map_next(&sub->events, &i2)); )
+                send_subscription_request(sub->object, event->name, false, NULL, NULL, 0);
+        }
+        epoch_exit();
+        lock();
+    }
+    name_map_destroy(&g_event_subscriptions_for_client, client_subscription_retire);
+
+    unlock();
+
+    pthread_mutex_lock(&g_name_table_mutex);
+    name_map_destroy(&g_name_tables_out, name_table_retire);
+    name_map_destroy(&g_name_tables_in, name_table_retire);
+    pthread_mutex_unlock(&g_name_table_mutex);
+
+    epoch_drain();
+}
+
+rbus_error_t set_message_method(rbusMessage msg, const char *method)
+{
+    rbusMessage_BeginMetaSectionWrite(msg);
+    rbusMessage_SetString(msg, method);
+    rbusMessage_EndMetaSectionWrite(msg);
+	  return RTMESSAGE_BUS_SUCCESS;
+}
+
+static rbus_error_t set_request_method(rbusMessage msg, const char *method)
+{
+    rbusMessage_BeginMetaSectionWrite(msg);
+    rbusMessage_SetString(msg, method);
+#ifdef ENABLE_RBUS_COMPRESSION
+    rbusMessage_SetInt32(msg, REQUEST_FLAG_ACCEPTS_COMPRESSION);
+#endif
+    rbusMessage_EndMetaSectionWrite(msg);
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+/*Returns the message to put on the wire for 'msg', which the caller must release: a compressed copy if 'compress' is set
+  and 'msg' is over the threshold, otherwise 'msg' itself.*/
+static rbusMessage get_outbound_message(rbusMessage msg, bool compress)
+{
+    rbusMessage compressed = NULL;
+
+    if(compress && g_compression_threshold && rbusMessage_Compress(msg, g_compression_threshold, &compressed) == RT_OK && compressed)
+        return compressed;
+    rbusMessage_Retain(msg);
+    return msg;
+}
+
+/*Adds a table for 'key' to 'tables'. When there are MAX_NAME_TABLES already the least recently used one goes: peers come
+  and go without telling us, and one that is still around recovers through METHOD_UNKNOWN_NAMES. Called in a read
+  section with g_name_table_mutex held.*/
+static name_table_t add_name_table(name_map_t* tables, const char* key, uint32_t hash)
+{
+    name_table_t entry;
+
+    if(tables->count >= MAX_NAME_TABLES)
+    {
+        name_table_t oldest = NULL;
+        uint32_t i;
+
+        for(i = 0; (entry = name_map_next(tables, &i)); )
+        {
+            if(!oldest || __atomic_load_n(&entry->last_used, __ATOMIC_RELAXED) < __atomic_load_n(&oldest->last_used, __ATOMIC_RELAXED))
+                oldest = entry;
+        }
+        RBUSCORELOG_INFO("Too many peers. Dropping the string table for %s.", oldest->key);
+        name_map_remove(tables, oldest->key, rbusMessage_HashName(oldest->key));
+        name_table_retire(oldest);
+    }
+    name_table_create(&entry, key);
+    if(NULL == entry->table)
+    {
+        name_table_destroy(entry);
+        return NULL;
+    }
+    name_map_insert(tables, entry->key, hash, entry);
+    return entry;
+}
+
+/*Returns the string table for messages between 'peer' and 'local' locked, or NULL if there is none and 'create' isn't
+  set. The table stays valid until it is passed to release_name_table.*/
+static name_table_t acquire_name_table(name_map_t* tables, const char* peer, const char* local, bool create)
+{
+    char key[NAME_TABLE_KEY_LENGTH];
+    name_table_t entry;
+    uint32_t hash;
+
+    snprintf(key, sizeof(key), "%.*s%c%.*s", MAX_OBJECT_NAME_LENGTH, peer, NAME_TABLE_KEY_SEPARATOR,
+        MAX_OBJECT_NAME_LENGTH, local);
+    hash = rbusMessage_HashName(key);
+    epoch_enter();
+    entry = name_map_find(tables, key, hash);
+    if(NULL == entry && create)
+    {
+        pthread_mutex_lock(&g_name_table_mutex);
+        if(NULL == (entry = name_map_find(tables, key, hash)))
+            entry = add_name_table(tables, key, hash);
+        pthread_mutex_unlock(&g_name_table_mutex);
+    }
+    if(NULL == entry)
+    {
+        epoch_exit();
+        return NULL;
+    }
+    pthread_mutex_lock(&entry->mutex);
+    __atomic_store_n(&entry->last_used, __atomic_add_fetch(&g_name_table_clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    return entry;
+}
+
+static void release_name_table(name_table_t entry)
+{
+    pthread_mutex_unlock(&entry->mutex);
+    epoch_exit();
+}
+
+/*Called once 'msg' has been sent to 'destination', so the names it defined can be referred to by id from now on.*/
+static void confirm_message_names(rbusMessage msg, const char* destination, const char* sender)
+{
+    name_table_t entry;
+
+    if(rbusMessage_GetWireVersion(msg) != 2)
+        return;
+    if((entry = acquire_name_table(&g_name_tables_out, destination, sender, false)) != NULL)
+    {
+        rbusMessage_ConfirmNames(msg, entry->table);
+        release_name_table(entry);
+    }
+}
+
+static void reset_name_table(const char* destination, const char* sender)
+{
+    name_table_t entry;
+
+    RBUSCORELOG_INFO("%s lost our string table. Resetting it.", destination);
+    if((entry = acquire_name_table(&g_name_tables_out, destination, sender, false)) != NULL)
+    {
+        rbusMessageStringTable_Reset(entry->table);
+        release_name_table(entry);
+    }
+}
+
+/*Looks up the names of a received message that were sent as string table ids.*/
+static rtError resolve_message_names(rbusMessage msg, rtMessageHeader const* hdr)
+{
+    name_table_t entry;
+    rtError err;
+
+    if(rbusMessage_GetWireVersion(msg) != 2 || rbusMessage_ResolveNames(msg, NULL) == RT_OK)
+        return RT_OK;
+    if((entry = acquire_name_table(&g_name_tables_in, hdr->reply_topic, hdr->topic, true)) == NULL)
+        return rbusMessage_ResolveNames(msg, NULL);
+    err = rbusMessage_ResolveNames(msg, entry->table);
+    release_name_table(entry);
+    return err;
+}
+
+static bool is_unknown_names_report(rbusMessage msg)
+{
+    const char* method = NULL;
+    return rbusMessage_GetMetaMethod(msg, &method) == RT_OK && strcmp(method, METHOD_UNKNOWN_NAMES) == 0;
+}
+
+/*Tells the sender of a message with string table ids we don't know to start its table for us over.*/
+static void report_unknown_names(rtMessageHeader const* hdr)
+{
+    rbusMessage msg;
+    uint8_t* data = NULL;
+    uint32_t dataLength = 0;
+    rtError err;
+
+    RBUSCORELOG_WARN("Unknown string table ids from %s.", hdr->reply_topic);
+    rbusMessage_Init(&msg);
+    set_message_method(msg, METHOD_UNKNOWN_NAMES);
+    rbusMessage_ToBytes(msg, &data, &dataLength);
+    if(rtMessageHeader_IsRequest(hdr))
+        err = rtConnection_SendBinaryResponse(g_connection, hdr, data, dataLength, TIMEOUT_VALUE_FIRE_AND_FORGET);
+    else
+        err = rtConnection_SendBinaryDirect(g_connection, data, dataLength, hdr->reply_topic, hdr->topic);
+    if(RT_OK != err)
+        RBUSCORELOG_ERROR("Failed to report unknown string table ids to %s. Error code: 0x%x", hdr->reply_topic, err);
+    rbusMessage_Release(msg);
+}
+
+/*Encodes 'msg' for sending in 'wire_version' format. Messages that can't be sent as v2 fall back to v0. For v2 the names
+  are encoded against the string table for 'destination' and 'sender', unless 'destination' is NULL. A positive 'timeout'
+  becomes the v2 deadline.*/
+static void get_message_bytes(rbusMessage msg, int wire_version, const char* destination, const char* sender, int32_t timeout,
+    uint8_t** data, uint32_t* dataLength)
+{
+    if(wire_version == 2)
+    {
+        uint64_t deadline = 0;
+        name_table_t entry;
+        rtError err;
+
+        if(timeout > 0)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            deadline = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout;
+        }
+        entry = destination ? acquire_name_table(&g_name_tables_out, destination, sender, true) : NULL;
+        err = rbusMessage_ToBytesV2(msg, entry ? entry->table : NULL, __sync_add_and_fetch(&g_wire_sequence, 1), deadline,
+            data, dataLength);
+        if(entry)
+            release_name_table(entry);
+        if(err == RT_OK)
+            return;
+    }
+    rbusMessage_ToBytes(msg, data, dataLength);
+}
+
+/*Called with g_mutex held or in a read section, which the object is valid for.*/
+static server_object_t get_object(const char * object_name)
+{
+    return name_map_find(&g_server_objects, object_name, rbusMessage_HashName(object_name));
+}
+
+/*The object registered with the listener 'closure' is for, or NULL once it is unregistered. Called in a read section.*/
+static server_object_t get_listener_object(void* closure)
+{
+    char key[2 * sizeof(uintptr_t) + 1];
+
+    snprintf(key, sizeof(key), "%lx", (unsigned long)(uintptr_t)closure);
+    return name_map_find(&g_server_listeners, key, rbusMessage_HashName(key));
+}
+
+static rbus_error_t translate_rt_error(rtError err)
+{
+    if(RT_OK == err)
+        return RTMESSAGE_BUS_SUCCESS;
+    else
+        return RTMESSAGE_BUS_ERROR_GENERAL;
+}
+
+static void dispatch_method_call(rbusMessage msg, const rtMessageHeader *hdr, server_object_t obj)
+{
+    rtError err = RT_OK;
+    const char* method_name = NULL;
+    rbusMessage response = NULL;
+    rbus_callback_t method_callback = NULL;
+    void* method_data = NULL;
+    bool accepts_compression = t_requester_accepts_compression;
+    int request_wire_version = t_request_wire_version;
+    
+    err = rbusMessage_GetMetaMethod(msg, &method_name);
+    t_requester_accepts_compression = (rbusMessage_GetMetaFlags(msg) & REQUEST_FLAG_ACCEPTS_COMPRESSION) != 0;
+    t_request_wire_version = rbusMessage_GetWireVersion(msg);
+    if(RT_OK == err)
+    {
+        server_method_t method;
+
+        epoch_enter();
+        method = name_map_find(&obj->methods, method_name, rbusMessage_GetMetaMethodHash(msg));
+
+        /*a v2 sender hashed the name it routed the request by, which is the same name unless it's broken*/
+        if(NULL == method && rbusMessage_GetWireVersion(msg) == 2)
+            method = name_map_find(&obj->methods, method_name, rbusMessage_HashName(method_name));
+
+        /*the method can be unregistered and freed once we leave the read section, so the handler is called with copies*/
+        if(method)
+        {
+            method_callback = method->callback;
+            method_data = method->data;
+        }
+        epoch_exit();
+    }
+    if(method_callback)
+    {
+        method_callback(hdr->topic, method_name, msg, method_data, &response, hdr);
+    }
+    else
+    {
+        /*the caller holds a reference to obj*/
+        if(obj->callback(hdr->topic, method_name, msg, obj->data, &response, hdr) == RTMESSAGE_BUS_SUCCESS_ASYNC)
+        {
+            t_requester_accepts_compression = accepts_compression;
+            t_request_wire_version = request_wire_version;
+            return;/*provider will send response async later on*/
+        }
+    }
+    
+    rbus_sendResponse(hdr, response);
+    t_requester_accepts_compression = accepts_compression;
+    t_request_wire_version = request_wire_version;
+}
+
+/* Begin dispatch executor.*/
+/*Requests are dispatched on the rtConnection callback thread unless rbus_setDispatchThreads asks for workers. Then each
+  object has a mailbox of requests, and an object with requests waiting is on exactly one worker's ready list or being run
+  by exactly one worker, so its requests stay in order while different objects run in parallel. A worker takes objects from
+  the front of its own list and, when that is empty, steals from the back of another worker's list.*/
+#define MAX_DISPATCH_THREADS 64
+#define DISPATCH_BATCH_SIZE 16 /*requests an object gets before going to the back of its worker's list*/
+#define DISPATCH_READY_INITIAL_CAPACITY 16
+
+struct _dispatch_executor;
+
+typedef struct _dispatch_worker
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    server_object_t* ready; /*ring of scheduled objects*/
+    size_t capacity;
+    size_t head;
+    size_t count;
+    struct _dispatch_executor* executor;
+} dispatch_worker_t;
+
+typedef struct _dispatch_executor
+{
+    unsigned int num_threads;
+    dispatch_worker_t* workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /*signalled when an object is scheduled and when stopping*/
+    size_t pending; /*objects on ready lists not yet claimed by a worker, guarded by mutex*/
+    bool stopping;
+    unsigned int next_worker;
+} *dispatch_executor_t;
 
-void client_event_create(client_event_t* event, const char* name, rbus_event_callback_t callback, void* data)
+static unsigned int g_dispatch_threads = 0;
+static dispatch_executor_t g_executor = NULL; /*started by the first request after rbus_setDispatchThreads*/
+static bool g_executor_closing = false; /*set while rbus_closeBrokerConnection runs, so no request starts an executor*/
+static pthread_mutex_t g_executor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread dispatch_worker_t* t_dispatch_worker = NULL;
+
+static void dispatch_push(dispatch_executor_t executor, dispatch_worker_t* worker, server_object_t obj)
 {
-    (*event) = rt_malloc(sizeof(struct _client_event));
-    (*event)->callback = callback;
-    (*event)->data = data;
-    strcpy((*event)->name, name);
+    pthread_mutex_lock(&worker->mutex);
+    if(worker->count == worker->capacity)
+    {
+        size_t i, capacity = worker->capacity ? worker->capacity * 2 : DISPATCH_READY_INITIAL_CAPACITY;
+        server_object_t* ready = rt_malloc(capacity * sizeof(server_object_t));
+
+        for(i = 0; i < worker->count; ++i)
+            ready[i] = worker->ready[(worker->head + i) % worker->capacity];
+        free(worker->ready);
+        worker->ready = ready;
+        worker->capacity = capacity;
+        worker->head = 0;
+    }
+    worker->ready[(worker->head + worker->count) % worker->capacity] = obj;
+    worker->count++;
+    pthread_mutex_unlock(&worker->mutex);
+
+    pthread_mutex_lock(&executor->mutex);
+    executor->pending++;
+    pthread_cond_signal(&executor->cond);
+    pthread_mutex_unlock(&executor->mutex);
 }
 
-int client_event_compare(const void* left, const void* right)
+static server_object_t dispatch_pop(dispatch_worker_t* worker, bool steal)
 {
-    return strncmp(((const client_event_t)left)->name, (char const*)right, MAX_EVENT_NAME_LENGTH);
+    server_object_t obj = NULL;
+
+    pthread_mutex_lock(&worker->mutex);
+    if(worker->count > 0)
+    {
+        worker->count--;
+        if(steal)
+            obj = worker->ready[(worker->head + worker->count) % worker->capacity];
+        else
+        {
+            obj = worker->ready[worker->head];
+            worker->head = (worker->head + 1) % worker->capacity;
+        }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return obj;
 }
 
-int client_subscription_compare(const void* left, const void* right)
+/*Takes the object this worker claimed by decrementing 'pending'. One is on some list, though not necessarily on the first
+  pass, as other workers push and pop while we look.*/
+static server_object_t dispatch_take(dispatch_executor_t executor, dispatch_worker_t* worker)
 {
-    return strncmp(((const client_subscription_t)left)->object, (char const*)right, MAX_OBJECT_NAME_LENGTH);
+    size_t self = worker - executor->workers;
+
+    for(;;)
+    {
+        unsigned int i;
+        server_object_t obj = dispatch_pop(worker, false);
+
+        for(i = 1; !obj && i < executor->num_threads; ++i)
+            obj = dispatch_pop(&executor->workers[(self + i) % executor->num_threads], true);
+        if(obj)
+            return obj;
+        sched_yield();
+    }
 }
 
-void client_subscription_create(client_subscription_t* sub, const char * object_name)
+static void send_error_response(rtMessageHeader const* hdr, rbus_error_t error)
 {
-    (*sub) = rt_malloc(sizeof(struct _client_subscription));
-    strcpy((*sub)->object, object_name);
-    rtVector_Create(&(*sub)->events); 
+    rbusMessage response;
+
+    if(!rtMessageHeader_IsRequest(hdr))
+        return;
+    rbusMessage_Init(&response);
+    rbusMessage_SetInt32(response, error);
+    rbus_sendResponse(hdr, response);
 }
 
-void client_subscription_destroy(void* p)
+/*Dispatches a request that was queued, unless its object was unregistered in the meantime, and releases its message.*/
+static void dispatch_queued_request(queued_request_t req)
 {
-    client_subscription_t sub = p;
-    rtVector_Destroy(sub->events, rtVector_Cleanup_Free);
-    free(sub);
+    if(__atomic_load_n(&req->obj->registered, __ATOMIC_ACQUIRE))
+        dispatch_method_call(req->msg, &req->hdr, req->obj);
+    else
+        send_error_response(&req->hdr, RTMESSAGE_BUS_ERROR_DESTINATION_UNREACHABLE);
+    rbusMessage_Release(req->msg);
 }
 
-/* End rbus_client */
+static void dispatch_run_object(dispatch_worker_t* worker, server_object_t obj)
+{
+    int i;
 
-/* End type definitions.*/
+    for(i = 0; i < DISPATCH_BATCH_SIZE; ++i)
+    {
+        queued_request_t req;
 
-/* Begin global variables*/
-#define MAX_DAEMON_ADDRESS_LEN 256
-static char g_daemon_address[MAX_DAEMON_ADDRESS_LEN] = "unix:///tmp/rtrouted";
-static rtConnection g_connection = NULL;
-static rtVector g_server_objects; /*server_object_t list*/
-static pthread_mutex_t g_mutex;
-static int g_mutex_init = 0;
-static bool g_run_event_client_dispatch = false;
-static rtVector g_event_subscriptions_for_client; /*client_subscription_t list. Used by the subscriber to track all active subscriptions. */
-static rtVector g_queued_requests; /*list of queued_request */
+        pthread_mutex_lock(&obj->mailbox_mutex);
+        req = obj->mailbox_head;
+        if(req)
+        {
+            obj->mailbox_head = req->next;
+            if(NULL == obj->mailbox_head)
+                obj->mailbox_tail = NULL;
+        }
+        else
+            obj->mailbox_scheduled = false;
+        pthread_mutex_unlock(&obj->mailbox_mutex);
 
-/*client disconnect detection*/
-static bool g_advisory_listener_installed = false;
-static rbus_client_disconnect_callback_t g_client_disconnect_callback = NULL;
+        if(NULL == req)
+        {
+            server_object_release(obj);
+            return;
+        }
+        dispatch_queued_request(req);
+        free(req);
+    }
+    /*give other objects on this worker a turn; the object stays scheduled*/
+    dispatch_push(worker->executor, worker, obj);
+}
 
-rbus_event_callback_t g_master_event_callback = NULL;
-void* g_master_event_user_data = NULL;
+static void* dispatch_worker_run(void* p)
+{
+    dispatch_worker_t* worker = p;
+    dispatch_executor_t executor = worker->executor;
 
-/* End global variables*/
+    t_dispatch_worker = worker;
+    for(;;)
+    {
+        pthread_mutex_lock(&executor->mutex);
+        while(0 == executor->pending && !executor->stopping)
+            pthread_cond_wait(&executor->cond, &executor->mutex);
+        if(0 == executor->pending)
+        {
+            pthread_mutex_unlock(&executor->mutex);
+            break;
+        }
+        executor->pending--;
+        pthread_mutex_unlock(&executor->mutex);
 
-static int lock()
-{
-	return pthread_mutex_lock(&g_mutex);
+        dispatch_run_object(worker, dispatch_take(executor, worker));
+    }
+    return NULL;
 }
 
-static int unlock()
+static dispatch_executor_t dispatch_executor_create(unsigned int num_threads)
 {
-	return pthread_mutex_unlock(&g_mutex);
+    unsigned int i;
+    dispatch_executor_t executor = rt_calloc(1, sizeof(struct _dispatch_executor));
+
+    executor->workers = rt_calloc(num_threads, sizeof(dispatch_worker_t));
+    pthread_mutex_init(&executor->mutex, NULL);
+    pthread_cond_init(&executor->cond, NULL);
+    for(i = 0; i < num_threads; ++i)
+    {
+        int err;
+        dispatch_worker_t* worker = &executor->workers[i];
+
+        pthread_mutex_init(&worker->mutex, NULL);
+        worker->executor = executor;
+        if((err = pthread_create(&worker->thread, NULL, dispatch_worker_run, worker)) != 0)
+        {
+            RBUSCORELOG_ERROR("Failed to start dispatch thread %u. Error: %d", i, err);
+            pthread_mutex_destroy(&worker->mutex);
+            break;
+        }
+    }
+    /*workers only read this once something is scheduled, which is after we return*/
+    executor->num_threads = i;
+    if(0 == executor->num_threads)
+    {
+        pthread_cond_destroy(&executor->cond);
+        pthread_mutex_destroy(&executor->mutex);
+        free(executor->workers);
+        free(executor);
+        return NULL;
+    }
+    RBUSCORELOG_INFO("Started %u dispatch threads.", executor->num_threads);
+    return executor;
 }
 
-static rbus_error_t send_subscription_request(const char * object_name, const char * event_name, bool activate, const rbusMessage payload, int* providerError, int timeout);
+/*Runs the requests already queued, then stops the workers.*/
+static void dispatch_executor_destroy(dispatch_executor_t executor)
+{
+    unsigned int i;
 
-static void perform_init()
+    pthread_mutex_lock(&executor->mutex);
+    executor->stopping = true;
+    pthread_cond_broadcast(&executor->cond);
+    pthread_mutex_unlock(&executor->mutex);
+
+    for(i = 0; i < executor->num_threads; ++i)
+        pthread_join(executor->workers[i].thread, NULL);
+    for(i = 0; i < executor->num_threads; ++i)
+    {
+        pthread_mutex_destroy(&executor->workers[i].mutex);
+        free(executor->workers[i].ready);
+    }
+    pthread_cond_destroy(&executor->cond);
+    pthread_mutex_destroy(&executor->mutex);
+    free(executor->workers);
+    free(executor);
+}
+
+static void stop_dispatch_executor(bool closing)
 {
-    RBUSCORELOG_DEBUG("Performing init");
-    rtVector_Create(&g_server_objects);
-    rtVector_Create(&g_event_subscriptions_for_client);
+    dispatch_executor_t executor;
+
+    pthread_mutex_lock(&g_executor_mutex);
+    executor = g_executor;
+    g_executor = NULL;
+    g_executor_closing = closing;
+    pthread_mutex_unlock(&g_executor_mutex);
+    if(executor)
+        dispatch_executor_destroy(executor);
 }
 
-static void perform_cleanup()
+/*Queues the request for a dispatch worker. Returns false if it is to be dispatched on this thread instead, which is the
+  case when there are no workers and none of the object's requests are still queued from when there were.*/
+static bool dispatch_enqueue(rtMessageHeader const* hdr, rbusMessage msg, server_object_t obj)
 {
-    size_t i, sz;
+    queued_request_t req;
+    dispatch_executor_t executor;
+    bool schedule;
 
-    RBUSCORELOG_DEBUG("Performing cleanup");
+    pthread_mutex_lock(&g_executor_mutex);
+    if(NULL == g_executor && g_dispatch_threads > 0 && !g_executor_closing)
+        g_executor = dispatch_executor_create(g_dispatch_threads);
+    executor = g_executor;
 
-    lock();
+    pthread_mutex_lock(&obj->mailbox_mutex);
+    if(NULL == executor && !obj->mailbox_scheduled)
+    {
+        pthread_mutex_unlock(&obj->mailbox_mutex);
+        pthread_mutex_unlock(&g_executor_mutex);
+        return false;
+    }
+    rbusMessage_Retain(msg); /*outlives this callback, so this takes a private copy of data*/
+    queued_request_create(&req, *hdr, msg, obj);
+    if(obj->mailbox_tail)
+        obj->mailbox_tail->next = req;
+    else
+        obj->mailbox_head = req;
+    obj->mailbox_tail = req;
+    schedule = !obj->mailbox_scheduled;
+    obj->mailbox_scheduled = true;
+    pthread_mutex_unlock(&obj->mailbox_mutex);
+
+    if(schedule)
+    {
+        server_object_retain(obj);
+        dispatch_push(executor, &executor->workers[__sync_fetch_and_add(&executor->next_worker, 1) % executor->num_threads], obj);
+    }
+    pthread_mutex_unlock(&g_executor_mutex);
+    return true;
+}
+/* End dispatch executor.*/
+
+/* Begin nested request queue.*/
+/*A handler that waits on the bus, for example for the response to a request of its own, can have further requests
+  delivered to onMessage before it returns. Those are queued here and dispatched by the outermost onMessage once the
+  handler is done. The queue is a fixed-size ring that any thread can add to while only the thread holding
+  g_nested_queue_consumer dispatches, so requests from other threads also wait their turn instead of running
+  alongside. A slot's sequence is the first position of the lap it is free to be filled in, or that plus 1 once it
+  holds a request, so the all-zero initial state is an empty queue.*/
+#define NESTED_QUEUE_SIZE 256 /*power of 2*/
+#define NESTED_QUEUE_LAP(pos) ((pos) & ~(uint32_t)(NESTED_QUEUE_SIZE - 1))
+
+typedef struct
+{
+    uint32_t sequence;
+    struct _queued_request req;
+} nested_queue_slot_t;
+
+static nested_queue_slot_t g_nested_queue[NESTED_QUEUE_SIZE];
+static uint32_t g_nested_queue_head = 0; /*next position to dispatch, only written by the consumer*/
+static uint32_t g_nested_queue_tail = 0; /*next position to fill*/
+static int g_nested_queue_consumer = 0; /*1 while a thread is dispatching*/
 
-    rtVector_Destroy(g_server_objects, server_object_destroy);
+static bool nested_queue_push(rtMessageHeader const* hdr, rbusMessage msg, server_object_t obj)
+{
+    uint32_t pos = __atomic_load_n(&g_nested_queue_tail, __ATOMIC_RELAXED);
 
-    sz = rtVector_Size(g_event_subscriptions_for_client);
-    if(sz>0)
+    for(;;)
     {
-        RBUSCORELOG_INFO("Cancelling active event subscriptions.");
-        unlock();
-        for(i = 0; i < sz; ++i)
-        {
-            size_t i2, sz2;
-            client_subscription_t sub = rtVector_At(g_event_subscriptions_for_client, i);
+        nested_queue_slot_t* slot = &g_nested_queue[pos & (NESTED_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - NESTED_QUEUE_LAP(pos));
 
-            sz2 = rtVector_Size(sub->events);
-            for(i2 = 0; i2 < sz2; i2++)
-            {   
-                client_event_t event = rtVector_At(sub->events, i2);
-                send_subscription_request(sub->object, event->name, false, NULL, NULL, 0);
+        if(0 == diff)
+        {
+            if(__atomic_compare_exchange_n(&g_nested_queue_tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                slot->req.hdr = *hdr;
+                slot->req.msg = msg;
+                slot->req.obj = obj;
+                slot->req.next = NULL;
+                __atomic_store_n(&slot->sequence, NESTED_QUEUE_LAP(pos) + 1, __ATOMIC_RELEASE);
+                return true;
             }
+            /*pos was reloaded by the failed exchange*/
         }
-        lock();
+        else if(diff < 0)
+            return false; /*full*/
+        else
+            pos = __atomic_load_n(&g_nested_queue_tail, __ATOMIC_RELAXED);
     }
-    rtVector_Destroy(g_event_subscriptions_for_client, client_subscription_destroy);
+}
 
-    unlock();
+static bool nested_queue_pop(struct _queued_request* req)
+{
+    uint32_t pos = __atomic_load_n(&g_nested_queue_head, __ATOMIC_RELAXED);
+    nested_queue_slot_t* slot = &g_nested_queue[pos & (NESTED_QUEUE_SIZE - 1)];
+
+    if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != NESTED_QUEUE_LAP(pos) + 1)
+        return false;
+    *req = slot->req;
+    __atomic_store_n(&slot->sequence, NESTED_QUEUE_LAP(pos) + NESTED_QUEUE_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_nested_queue_head, pos + 1, __ATOMIC_RELAXED);
+    return true;
 }
 
-rbus_error_t set_message_method(rbusMessage msg, const char *method)
+/*A push that is not finished yet counts as empty. Its producer runs the queue when it is.*/
+static bool nested_queue_empty()
 {
-    rbusMessage_BeginMetaSectionWrite(msg);
-    rbusMessage_SetString(msg, method);
-    rbusMessage_EndMetaSectionWrite(msg);
-	  return RTMESSAGE_BUS_SUCCESS;
+    uint32_t pos = __atomic_load_n(&g_nested_queue_head, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&g_nested_queue[pos & (NESTED_QUEUE_SIZE - 1)].sequence, __ATOMIC_ACQUIRE) != NESTED_QUEUE_LAP(pos) + 1;
 }
 
-static server_object_t get_object(const char * object_name)
+static bool nested_queue_acquire()
 {
-    return rtVector_Find(g_server_objects, object_name, server_object_compare);
+    return __sync_bool_compare_and_swap(&g_nested_queue_consumer, 0, 1);
 }
 
-static rbus_error_t translate_rt_error(rtError err)
+static void nested_queue_drain()
 {
-    if(RT_OK == err)
-        return RTMESSAGE_BUS_SUCCESS;
-    else
-        return RTMESSAGE_BUS_ERROR_GENERAL;
+    struct _queued_request req;
+
+    while(nested_queue_pop(&req))
+    {
+        dispatch_queued_request(&req);
+        server_object_release(req.obj);
+    }
 }
 
-static void dispatch_method_call(rbusMessage msg, const rtMessageHeader *hdr, server_object_t obj)
+/*Drains the queue and gives up being the consumer, then drains again if a request was queued in between and no other
+  thread took over.*/
+static void nested_queue_release()
 {
-    rtError err = RT_OK;
-    const char* method_name = NULL;
-    rbusMessage response = NULL;
-    bool handler_invoked = false;
-    
-    rbusMessage_BeginMetaSectionRead(msg);
-    err = rbusMessage_GetString(msg, &method_name);
-    rbusMessage_EndMetaSectionRead(msg);
-    lock();
-    if( rtVector_Size(obj->methods) > 0 && RT_OK == err)
+    do
     {
-        server_method_t method = rtVector_Find(obj->methods, method_name, server_method_compare);
+        nested_queue_drain();
+        __atomic_store_n(&g_nested_queue_consumer, 0, __ATOMIC_SEQ_CST);
+    } while(!nested_queue_empty() && nested_queue_acquire());
+}
 
-        if(method)
-        {
-            unlock();
-            method->callback(hdr->topic, method_name, msg, method->data, &response, hdr); //FIXME: potential for race.
-            handler_invoked = true;
-        }
-    }
-    if(false == handler_invoked)
+/*Queues a request that arrived while another is being dispatched. When the queue is full the request is answered with
+  RTMESSAGE_BUS_ERROR_OUT_OF_RESOURCES: nested requests are delivered on the thread that empties the queue, which can't
+  wait for room while it still has to read the response its handler is waiting for.*/
+static void nested_queue_add(rtMessageHeader const* hdr, rbusMessage msg, server_object_t obj)
+{
+    rbusMessage_Retain(msg); /*outlives this callback, so this takes a private copy of data*/
+    server_object_retain(obj);
+    if(!nested_queue_push(hdr, msg, obj))
     {
-        unlock();
-        if(obj->callback(hdr->topic, method_name, msg, obj->data, &response, hdr) == RTMESSAGE_BUS_SUCCESS_ASYNC) //FIXME: potential for race
-            return;/*provider will send response async later on*/
+        RBUSCORELOG_WARN("Request queue is full. Rejecting request for %s.", obj->name);
+        send_error_response(hdr, RTMESSAGE_BUS_ERROR_OUT_OF_RESOURCES);
+        server_object_release(obj);
+        rbusMessage_Release(msg);
+        return;
     }
-    
-    rbus_sendResponse(hdr, response);
+    if(nested_queue_acquire())
+        nested_queue_release();
 }
+/* End nested request queue.*/
 
 static void onMessage(rtMessageHeader const* hdr, uint8_t const* data, uint32_t dataLen, void* closure)
 {
     rbusMessage msg;
-    rbusMessage_FromBytes(&msg, data, dataLen);
+    /*data is owned by rtConnection and stays valid until we return, so decode it in place*/
+    rbusMessage_FromBytesNoCopy(&msg, data, dataLen);
 
-    /*using namespace rbus_server;*/
-    static int stack_counter = 0;
-    stack_counter++;
-    server_object_t obj = (server_object_t)closure;
+    if(resolve_message_names(msg, hdr) != RT_OK)
+    {
+        report_unknown_names(hdr);
+        rbusMessage_Release(msg);
+        return;
+    }
 
-    if(1 != stack_counter)
+    /*rtConnection can still be delivering to a listener that rbus_unregisterObj has just removed, so the closure is the
+      registration's id rather than the object, and the object is looked up by it. While it is found the registry's
+      reference keeps it alive, which is long enough to take our own.*/
+    server_object_t obj;
+    epoch_enter();
+    obj = get_listener_object(closure);
+    if(obj)
+        server_object_retain(obj);
+    epoch_exit();
+    if(NULL == obj)
     {
-        //We're in the midst of handling another request. Queue this one for later.
-        queued_request_t req;
-        queued_request_create(&req, *hdr, msg, obj);
-        rtVector_PushBack(g_queued_requests, req);
+        send_error_response(hdr, RTMESSAGE_BUS_ERROR_DESTINATION_UNREACHABLE);
+        rbusMessage_Release(msg);
+        return;
+    }
+    if(dispatch_enqueue(hdr, msg, obj))
+    {
+        server_object_release(obj);
+        rbusMessage_Release(msg);
+        return;
     }
-    else
-        dispatch_method_call(msg, hdr, obj);
 
-    if((1 == stack_counter) && rtVector_Size(g_queued_requests) > 0)
+    if(nested_queue_acquire())
     {
+        dispatch_method_call(msg, hdr, obj);
         //Consume the request queue now that the earlier request has been fully handled.
-        while(rtVector_Size(g_queued_requests) > 0)
-        {
-            queued_request_t req = rtVector_At(g_queued_requests, 0);
-            dispatch_method_call(req->msg, &req->hdr, req->obj);
-            rtVector_RemoveItem(g_queued_requests, req, rtVector_Cleanup_Free);
-        }
+        nested_queue_release();
     }
-    stack_counter--;
-
+    else
+    {
+        //We're in the midst of handling another request. Queue this one for later.
+        nested_queue_add(hdr, msg, obj);
+    }
+    server_object_release(obj);
     rbusMessage_Release(msg);
     return;
 }
@@ -578,10 +1690,14 @@ rbus_error_t rbus_openBrokerConnection2(const char * component_name, const char*
 rbus_error_t rbus_closeBrokerConnection()
 {
     rtError err = RT_OK;
+    /*workers take g_mutex, so let them finish before we hold it. Requests arriving until the connection is destroyed
+      are then dispatched on the connection's thread rather than starting a new executor.*/
+    stop_dispatch_executor(true);
     lock();
     if(NULL == g_connection)
     {
         RBUSCORELOG_INFO("No connection exist to close.");
+        stop_dispatch_executor(false);
         return RTMESSAGE_BUS_ERROR_INVALID_STATE;
     }
     perform_cleanup();
@@ -589,10 +1705,13 @@ rbus_error_t rbus_closeBrokerConnection()
     if(RT_OK != err)
     {
         RBUSCORELOG_ERROR("Could not destroy connection. Error: 0x%x.", err);
+        stop_dispatch_executor(false);
         return RTMESSAGE_BUS_ERROR_GENERAL;
     }
     g_connection = NULL;
     unlock();
+    /*the connection's thread is gone, so the next connection may start workers again*/
+    stop_dispatch_executor(false);
 
     pthread_mutex_destroy(&g_mutex);
     g_mutex_init = 0;
@@ -697,7 +1816,7 @@ rbus_error_t rbus_registerObj(const char * object_name, rbus_callback_t handler,
     }
 
     lock();
-    obj = rtVector_Find(g_server_objects, object_name, server_object_compare);
+    obj = get_object(object_name);
     unlock();
     if(obj)
     {
@@ -706,28 +1825,28 @@ rbus_error_t rbus_registerObj(const char * object_name, rbus_callback_t handler,
     }
 
     server_object_create(&obj, object_name, handler, user_data);
+    /*findable by onMessage as soon as the listener is*/
+    lock();
+    name_map_insert(&g_server_listeners, obj->listener_key, rbusMessage_HashName(obj->listener_key), obj);
+    unlock();
 
     //TODO: callback signature translation. rbusMessage uses a significantly wider signature for callbacks. Translate to something simpler.
-    err = rtConnection_AddListener(g_connection, object_name, onMessage, obj);
+    err = rtConnection_AddListener(g_connection, object_name, onMessage, (void*)obj->listener_id);
 
     if(RT_OK == err)
     {
-        size_t sz;
-
         lock();
-        rtVector_PushBack(g_server_objects, obj);
-        sz = rtVector_Size(g_server_objects);
+        name_map_insert(&g_server_objects, obj->name, obj->hash, obj);
         unlock();
         RBUSCORELOG_DEBUG("Registered object %s", object_name);
-        if(sz >= MAX_REGISTERED_OBJECTS)
-        {
-            RBUSCORELOG_WARN("Number of registered objects is %lu", sz);
-        }
         return RTMESSAGE_BUS_SUCCESS;
     }
     else
     {
         RBUSCORELOG_ERROR("Failed to register object. Error: 0x%x", err);
+        lock();
+        name_map_remove(&g_server_listeners, obj->listener_key, rbusMessage_HashName(obj->listener_key));
+        unlock();
         server_object_destroy(obj);
         return RTMESSAGE_BUS_ERROR_GENERAL;
     }
@@ -745,27 +1864,19 @@ rbus_error_t rbus_registerMethod(const char * object_name, const char *method_na
     server_object_t obj = get_object(object_name);
     if(obj)
     {
-        if(MAX_SUPPORTED_METHODS <= rtVector_Size(obj->methods))
+        server_method_t method = name_map_find(&obj->methods, method_name, rbusMessage_HashName(method_name));
+
+        if(method)
         {
-            RBUSCORELOG_ERROR("Too many methods registered with object %s. Cannot register more.", object_name);
-            ret = RTMESSAGE_BUS_ERROR_OUT_OF_RESOURCES;
+           unlock();
+           RBUSCORELOG_ERROR("Method %s is already registered,Rejecting duplicate registration.", method_name);
+           return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
         }
         else
         {
-            server_method_t method = rtVector_Find(obj->methods, method_name, server_method_compare);
-
-            if(method)
-            {
-               unlock();
-               RBUSCORELOG_ERROR("Method %s is already registered,Rejecting duplicate registration.", method_name);
-               return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
-            }
-            else
-            {
-                server_method_create(&method, method_name, handler, user_data);
-                rtVector_PushBack(obj->methods, method);
-                RBUSCORELOG_DEBUG("Successfully registered method %s with object %s", method_name, object_name);
-            }
+            server_method_create(&method, method_name, handler, user_data);
+            name_map_insert(&obj->methods, method->name, rbusMessage_HashName(method_name), method);
+            RBUSCORELOG_DEBUG("Successfully registered method %s with object %s", method_name, object_name);
         }
     }
     else
@@ -787,10 +1898,10 @@ rbus_error_t rbus_unregisterMethod(const char * object_name, const char *method_
     server_object_t obj = get_object(object_name);
     if(obj)
     {
-        server_method_t method = rtVector_Find(obj->methods, method_name, server_method_compare);
+        server_method_t method = name_map_remove(&obj->methods, method_name, rbusMessage_HashName(method_name));
         if(method)
         {
-            rtVector_RemoveItem(obj->methods, method, rtVector_Cleanup_Free);
+            epoch_retire(method, rtVector_Cleanup_Free);
             RBUSCORELOG_INFO("Successfully unregistered method %s from object %s", method_name, object_name);
         }
         else
@@ -862,10 +1973,11 @@ rbus_error_t rbus_unregisterObj(const char * object_name)
     }
 
     lock();
-    server_object_t obj = get_object(object_name);
+    server_object_t obj = name_map_remove(&g_server_objects, object_name, rbusMessage_HashName(object_name));
     if(NULL != obj)
     {
-        rtVector_RemoveItem(g_server_objects, obj, server_object_destroy);
+        name_map_remove(&g_server_listeners, obj->listener_key, rbusMessage_HashName(obj->listener_key));
+        server_object_destroy(obj);
         RBUSCORELOG_INFO("Unregistered object %s.", object_name);
     }
     else
@@ -972,6 +2084,11 @@ rbus_error_t rbus_pushObj(const char * object_name, rbusMessage message, int tim
     return ret;
 }
 
+static void free_response_buffer(uint8_t* buff)
+{
+    rtMessage_FreeByteArray(buff);
+}
+
 static rtError rbus_sendRequest(rtConnection con, rbusMessage req, char const* topic, rbusMessage* res, int32_t timeout)
 {
     rtError err = RT_OK;
@@ -979,17 +2096,35 @@ static rtError rbus_sendRequest(rtConnection con, rbusMessage req, char const* t
     uint32_t dataLength = 0;
     uint8_t* rspData = NULL;
     uint32_t rspDataLength = 0;
+    rbusMessage wire = get_outbound_message(req, (g_compression_flags & RBUS_COMPRESS_REQUESTS) != 0);
+    bool retry = true;
 
-    rbusMessage_ToBytes(req, &data, &dataLength);
+    while(true)
+    {
+        get_message_bytes(wire, g_wire_version, topic, "", timeout, &data, &dataLength);
 
-    err = rtConnection_SendBinaryRequest(con, data, dataLength, topic, &rspData, &rspDataLength, timeout);
+        err = rtConnection_SendBinaryRequest(con, data, dataLength, topic, &rspData, &rspDataLength, timeout);
+        if(err != RT_OK)
+        {
+            rtMessage_FreeByteArray(rspData);
+            break;
+        }
 
-    if(err == RT_OK)
-    {
-        rbusMessage_FromBytes(res, rspData, rspDataLength);
+        /*the response buffer is ours to free, so hand it to the message instead of copying it*/
+        rbusMessage_FromBytesAdopt(res, rspData, rspDataLength, free_response_buffer);
+        if(g_wire_version == 2 && retry && is_unknown_names_report(*res))
+        {
+            /*the provider doesn't know the ids we used, probably because it restarted. Send the names again.*/
+            rbusMessage_Release(*res);
+            reset_name_table(topic, "");
+            rspData = NULL;
+            retry = false;
+            continue;
+        }
+        confirm_message_names(wire, topic, "");
+        break;
     }
-
-    rtMessage_FreeByteArray(rspData);
+    rbusMessage_Release(wire);
 
     return err;
 }
@@ -1015,7 +2150,7 @@ rbus_error_t rbus_invokeRemoteMethod(const char * object_name, const char *metho
     if(NULL == out)
         rbusMessage_Init(&out);
 
-    set_message_method(out, method);
+    set_request_method(out, method);
     err = rbus_sendRequest(g_connection, out, object_name, in, timeout_millisecs);
     if(RT_OK != err)
     {
@@ -1039,9 +2174,7 @@ rbus_error_t rbus_invokeRemoteMethod(const char * object_name, const char *metho
     {
 
         method = NULL;
-        rbusMessage_BeginMetaSectionRead(*in);
-		    rbusMessage_GetString(*in, &method);
-        rbusMessage_EndMetaSectionRead(*in);
+        rbusMessage_GetMetaMethod(*in, &method);
         if(NULL != method)
         {
             if(0 != strncmp(METHOD_RESPONSE, method, MAX_METHOD_NAME_LENGTH))
@@ -1102,6 +2235,8 @@ rbus_error_t rbus_pullObj(const char * object_name, int timeout_millisecs, rbusM
     return ret;
 }
 
+/*Sends an event. Events carry their names in full, even in v2: a subscriber that lost its string table could only ask
+  for the names again after the event it couldn't read was gone.*/
 static rbus_error_t rbus_sendMessage(rbusMessage msg, const char * destination, const char * sender)
 {
     rtError ret;
@@ -1114,7 +2249,7 @@ static rbus_error_t rbus_sendMessage(rbusMessage msg, const char * destination,
         return RTMESSAGE_BUS_ERROR_INVALID_STATE;
     }
 
-    rbusMessage_ToBytes(msg, &data, &dataLength);
+    get_message_bytes(msg, g_wire_version, NULL, NULL, 0, &data, &dataLength);
     ret = rtConnection_SendBinaryDirect(g_connection, data, dataLength, destination, sender);
     return translate_rt_error(ret);
 }
@@ -1200,7 +2335,8 @@ static rbus_error_t install_subscription_handlers(server_object_t object)
 {
     rbus_error_t ret = RTMESSAGE_BUS_SUCCESS; 
 
-    server_method_t method = rtVector_Find(object->methods, METHOD_ADD_EVENT_SUBSCRIPTION, server_method_compare);
+    server_method_t method = name_map_find(&object->methods, METHOD_ADD_EVENT_SUBSCRIPTION,
+        rbusMessage_HashName(METHOD_ADD_EVENT_SUBSCRIPTION));
 
     if(method)
     {
@@ -1258,7 +2394,7 @@ rbus_error_t rbus_registerEvent(const char* object_name, const char * event_name
     obj = get_object(object_name);
     if(obj)
     {
-        server_event_t evt = rtVector_Find(obj->subscriptions, event_name, server_event_compare);
+        server_event_t evt = name_map_find(&obj->events, event_name, rbusMessage_HashName(event_name));
 
         if(evt)
         {
@@ -1267,7 +2403,7 @@ rbus_error_t rbus_registerEvent(const char* object_name, const char * event_name
         else
         {
             server_event_create(&evt, event_name, obj, callback, user_data);
-            rtVector_PushBack(obj->subscriptions, evt);
+            name_map_insert(&obj->events, evt->name, rbusMessage_HashName(event_name), evt);
             RBUSCORELOG_INFO("Registered event %s::%s.", object_name, event_name);
         }
         if(!obj->process_event_subscriptions)
@@ -1294,11 +2430,11 @@ rbus_error_t rbus_unregisterEvent(const char* object_name, const char * event_na
     server_object_t obj = get_object(object_name);
     if(obj)
     {
-        server_event_t evt = rtVector_Find(obj->subscriptions, event_name, server_event_compare);
+        server_event_t evt = name_map_remove(&obj->events, event_name, rbusMessage_HashName(event_name));
 
         if(evt)
         {
-            rtVector_RemoveItem(obj->subscriptions, evt, server_event_destroy);
+            epoch_retire(evt, server_event_destroy);
             RBUSCORELOG_INFO("Event %s::%s has been unregistered.", object_name, event_name);
             /* If we've removed all events and RPC registrations, delete the object itself.*/
         }
@@ -1318,6 +2454,13 @@ rbus_error_t rbus_unregisterEvent(const char* object_name, const char * event_na
     return ret;
 }
 
+/*Called with g_mutex held or in a read section, which the event is valid for.*/
+static client_event_t get_client_event(char const* object_name, char const* event_name)
+{
+    client_subscription_t sub = name_map_find(&g_event_subscriptions_for_client, object_name, rbusMessage_HashName(object_name));
+    return sub ? name_map_find(&sub->events, event_name, rbusMessage_HashName(event_name)) : NULL;
+}
+
 static void master_event_callback(rtMessageHeader const* hdr, uint8_t const* data, uint32_t dataLen, void* closure)
 {
     /*using namespace rbus_client;*/
@@ -1327,8 +2470,9 @@ static void master_event_callback(rtMessageHeader const* hdr, uint8_t const* dat
     const char * object_name = NULL;
     int32_t is_rbus_flag = 1;
     rtError err;
-    size_t subs_len;
-    size_t i;
+    client_event_t evt;
+    rbus_event_callback_t callback = NULL;
+    void* callback_data = NULL;
     (void)closure;
 
    /*Sanitize the incoming data.*/
@@ -1338,13 +2482,17 @@ static void master_event_callback(rtMessageHeader const* hdr, uint8_t const* dat
         return;
     }
 
-    rbusMessage_FromBytes(&msg, data, dataLen);
+    rbusMessage_FromBytesNoCopy(&msg, data, dataLen);
 
-    rbusMessage_BeginMetaSectionRead(msg);
-    err = rbusMessage_GetString(msg, &event_name);
-    err = rbusMessage_GetString(msg, &object_name);
-    err = rbusMessage_GetInt32(msg, &is_rbus_flag);
-    rbusMessage_EndMetaSectionRead(msg);
+    /*events are sent with their names in full, so ids here mean the message is malformed*/
+    if(rbusMessage_GetWireVersion(msg) == 2 && rbusMessage_ResolveNames(msg, NULL) != RT_OK)
+    {
+        RBUSCORELOG_ERROR("Event from %s uses string table ids.", sender);
+        rbusMessage_Release(msg);
+        return;
+    }
+
+    err = rbusMessage_GetMetaEvent(msg, &event_name, &object_name, &is_rbus_flag);
     if(RT_OK != err)
     {
         RBUSCORELOG_ERROR("Event message doesn't contain an event name.");
@@ -1369,29 +2517,26 @@ static void master_event_callback(rtMessageHeader const* hdr, uint8_t const* dat
         }
     }
 
-    lock();
-    subs_len = rtVector_Size(g_event_subscriptions_for_client);
-    for(i = 0; i < subs_len; ++i)
+    epoch_enter();
+    evt = get_client_event(sender, event_name);
+    /* support rbus events being elements : the object name will be the event name */
+    if(NULL == evt && strncmp(sender, event_name, MAX_OBJECT_NAME_LENGTH) != 0)
+        evt = get_client_event(event_name, event_name);
+    /*the subscription can be removed and freed once we leave the read section, so the callback is called with copies*/
+    if(evt)
     {
-        client_subscription_t sub = rtVector_At(g_event_subscriptions_for_client, i);
-
-        if( strncmp(sub->object, sender, MAX_OBJECT_NAME_LENGTH) == 0 ||
-            strncmp(sub->object, event_name, MAX_OBJECT_NAME_LENGTH) == 0 ) /* support rbus events being elements : the object name will be the event name */
-        {
-            client_event_t evt = rtVector_Find(sub->events, event_name, client_event_compare);
+        callback = evt->callback;
+        callback_data = evt->data;
+    }
+    epoch_exit();
 
-            if(evt)
-            {
-                unlock();
-                evt->callback(sender, event_name, msg, evt->data);
-                rbusMessage_Release(msg);
-                return;
-            }
-            /* support rbus events being elements : keep searching */
-        }
+    if(callback)
+    {
+        callback(sender, event_name, msg, callback_data);
+        rbusMessage_Release(msg);
+        return;
     }
     /* If no matching objects exist in records. Create a new entry.*/
-    unlock();
     rbusMessage_Release(msg);
     RBUSCORELOG_WARN("Received event %s::%s for which no subscription exists.", sender, event_name);
     return;
@@ -1404,20 +2549,21 @@ static rbus_error_t remove_subscription_callback(const char * object_name,  cons
     rbus_error_t ret = RTMESSAGE_BUS_ERROR_INVALID_PARAM;
 
     lock();
-    sub = rtVector_Find(g_event_subscriptions_for_client, object_name, client_subscription_compare);
+    sub = name_map_find(&g_event_subscriptions_for_client, object_name, rbusMessage_HashName(object_name));
     if(sub)
     {
-        client_event_t evt = rtVector_Find(sub->events, event_name, client_event_compare);
+        client_event_t evt = name_map_remove(&sub->events, event_name, rbusMessage_HashName(event_name));
         if(evt)
         {
-            rtVector_RemoveItem(sub->events, evt, rtVector_Cleanup_Free);
+            epoch_retire(evt, rtVector_Cleanup_Free);
             RBUSCORELOG_DEBUG("Subscription removed for event %s::%s.", object_name, event_name);
             ret = RTMESSAGE_BUS_SUCCESS;
 
-            if(rtVector_Size(sub->events) == 0)
+            if(sub->events.count == 0)
             {
                 RBUSCORELOG_DEBUG("Zero event subscriptions remaining for object %s. Cleaning up.", object_name);
-                rtVector_RemoveItem(g_event_subscriptions_for_client, sub, client_subscription_destroy);
+                name_map_remove(&g_event_subscriptions_for_client, object_name, rbusMessage_HashName(object_name));
+                epoch_retire(sub, client_subscription_destroy);
             }
         }
         else
@@ -1476,10 +2622,10 @@ static rbus_error_t rbus_subscribeToEventInternal(const char * object_name,  con
 
     if(g_master_event_callback == NULL)
     {
-        sub = rtVector_Find(g_event_subscriptions_for_client, object_name, client_subscription_compare);
+        sub = name_map_find(&g_event_subscriptions_for_client, object_name, rbusMessage_HashName(object_name));
         if(sub)
         {
-            if(rtVector_Find(sub->events, event_name, client_event_compare))
+            if(name_map_find(&sub->events, event_name, rbusMessage_HashName(event_name)))
             {
                 /*sub already exist and event already registered so do nothing*/
                 RBUSCORELOG_WARN("Subscription exists for event %s::%s.", object_name, event_name);
@@ -1491,12 +2637,12 @@ static rbus_error_t rbus_subscribeToEventInternal(const char * object_name,  con
         {
             /*sub didn't exist so create it*/
             client_subscription_create(&sub, object_name);
-            rtVector_PushBack(g_event_subscriptions_for_client, sub);
+            name_map_insert(&g_event_subscriptions_for_client, sub->object, rbusMessage_HashName(object_name), sub);
         }
 
         /*create event and add to sub*/
         client_event_create(&evt, event_name, callback, user_data);
-        rtVector_PushBack(sub->events, evt);
+        name_map_insert(&sub->events, evt->name, rbusMessage_HashName(event_name), evt);
     }
     RBUSCORELOG_DEBUG("Added subscription for event %s::%s.", object_name, event_name);
 
@@ -1576,26 +2722,30 @@ rbus_error_t rbus_publishEvent(const char* object_name,  const char * event_name
     rbusMessage_SetInt32(out, 0); /*is ccsp and not rbus 2.0*/
     rbusMessage_EndMetaSectionWrite(out);
 
-    lock();
+    /*the object, event and listeners stay valid until epoch_exit, however long sending takes*/
+    epoch_enter();
     server_object_t obj = get_object(object_name);
     if(obj)
     {
-        server_event_t evt = rtVector_Find(obj->subscriptions, event_name, server_event_compare);
+        server_event_t evt = name_map_find(&obj->events, event_name, rbusMessage_HashName(event_name));
 
         if(evt)
         {
-            size_t nlistener, i;
+            uint32_t i;
+            listener_set_t listeners = __atomic_load_n(&evt->listeners, __ATOMIC_ACQUIRE);
+            /*compressed once for all listeners*/
+            rbusMessage wire = get_outbound_message(out, (g_compression_flags & RBUS_COMPRESS_EVENTS) != 0);
 
-            nlistener = rtVector_Size(evt->listeners);
-            RBUSCORELOG_DEBUG("Event %s exists in subscription table. Dispatching to %lu subscribers.", event_name, nlistener);
-            for(i=0; i < nlistener; ++i)
+            RBUSCORELOG_DEBUG("Event %s exists in subscription table. Dispatching to %u subscribers.", event_name, listeners->count);
+            for(i=0; i < listeners->count; ++i)
             {
-                char const* listener = (char const*)rtVector_At(evt->listeners, i);
-                if(RTMESSAGE_BUS_SUCCESS != rbus_sendMessage(out, listener, object_name))
+                char const* listener = listeners->names[i];
+                if(RTMESSAGE_BUS_SUCCESS != rbus_sendMessage(wire, listener, object_name))
                 {
                     RBUSCORELOG_ERROR("Couldn't send event %s::%s to %s.", object_name, event_name, listener);
                 }
             }
+            rbusMessage_Release(wire);
         }
         else
         {
@@ -1609,7 +2759,7 @@ rbus_error_t rbus_publishEvent(const char* object_name,  const char * event_name
         RBUSCORELOG_ERROR("Could not find object %s", object_name);
         ret = RTMESSAGE_BUS_ERROR_INVALID_PARAM;
     }
-    unlock();
+    epoch_exit();
 
     return ret;
 }
@@ -1688,6 +2838,7 @@ rbus_error_t rbus_publishSubscriberEvent(const char* object_name,  const char *
 {
     /*using namespace rbus_server;*/
     rbus_error_t ret = RTMESSAGE_BUS_SUCCESS;
+    rbusMessage wire;
     if(NULL == event_name)
         event_name = DEFAULT_EVENT;
     if(MAX_OBJECT_NAME_LENGTH <= strnlen(object_name, MAX_OBJECT_NAME_LENGTH))
@@ -1700,19 +2851,21 @@ rbus_error_t rbus_publishSubscriberEvent(const char* object_name,  const char *
     rbusMessage_SetString(out, object_name); 
     rbusMessage_SetInt32(out, 1);/*is rbus 2.0*/ 
     rbusMessage_EndMetaSectionWrite(out);
-    lock();
+    epoch_enter();
     server_object_t obj = get_object(object_name);
+    epoch_exit();
     if(NULL == obj)
     {
         /*Object not present yet. Register it now.*/
         RBUSCORELOG_ERROR("Could not find object %s", object_name);
         ret = RTMESSAGE_BUS_ERROR_INVALID_PARAM;
     }
-    if(rbus_sendMessage(out, listener, object_name) != RTMESSAGE_BUS_SUCCESS)
+    wire = get_outbound_message(out, (g_compression_flags & RBUS_COMPRESS_EVENTS) != 0);
+    if(rbus_sendMessage(wire, listener, object_name) != RTMESSAGE_BUS_SUCCESS)
     {
        RBUSCORELOG_ERROR("Couldn't send event %s::%s to %s.", object_name, event_name, listener);
     }
-    unlock();
+    rbusMessage_Release(wire);
     return ret;
 }
 
@@ -2156,11 +3309,64 @@ rbuscore_bus_status_t rbuscore_checkBusStatus(void)
 #endif /* RBUS_ALWAYS_ON */
 }
 
+rbus_error_t rbus_setCompression(unsigned int threshold, int flags)
+{
+#ifdef ENABLE_RBUS_COMPRESSION
+    g_compression_threshold = threshold;
+    g_compression_flags = flags;
+    return RTMESSAGE_BUS_SUCCESS;
+#else
+    (void)threshold;
+    (void)flags;
+    RBUSCORELOG_ERROR("rbus-core was built without ENABLE_RBUS_COMPRESSION.");
+    return RTMESSAGE_BUS_ERROR_INVALID_STATE;
+#endif
+}
+
+rbus_error_t rbus_setWireVersion(int version)
+{
+    if(version != 0 && version != 2)
+    {
+        RBUSCORELOG_ERROR("Unsupported wire format version %d.", version);
+        return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
+    }
+    g_wire_version = version;
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+rbus_error_t rbus_setDispatchThreads(unsigned int num_threads)
+{
+    dispatch_executor_t executor = NULL;
+
+    if(num_threads > MAX_DISPATCH_THREADS)
+    {
+        RBUSCORELOG_ERROR("At most %d dispatch threads are supported.", MAX_DISPATCH_THREADS);
+        return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
+    }
+    if(t_dispatch_worker)
+    {
+        RBUSCORELOG_ERROR("Cannot change the dispatch threads from a request handler.");
+        return RTMESSAGE_BUS_ERROR_INVALID_STATE;
+    }
+    pthread_mutex_lock(&g_executor_mutex);
+    g_dispatch_threads = num_threads;
+    if(g_executor && g_executor->num_threads != num_threads)
+    {
+        executor = g_executor;
+        g_executor = NULL;
+    }
+    pthread_mutex_unlock(&g_executor_mutex);
+    if(executor)
+        dispatch_executor_destroy(executor);
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
 rbus_error_t rbus_sendResponse(const rtMessageHeader* hdr, rbusMessage response)
 {
     rtError err = RT_OK;
     uint8_t* data;
     uint32_t dataLength;
+    rbusMessage wire;
 
     if(rtMessageHeader_IsRequest(hdr))
     {
@@ -2172,13 +3378,15 @@ rbus_error_t rbus_sendResponse(const rtMessageHeader* hdr, rbusMessage response)
             rbusMessage_SetInt32(response, RTMESSAGE_BUS_ERROR_UNSUPPORTED_METHOD);
         }
         set_message_method(response, METHOD_RESPONSE);
+        wire = get_outbound_message(response, t_requester_accepts_compression);
 
-        rbusMessage_ToBytes(response, &data, &dataLength);
+        get_message_bytes(wire, t_request_wire_version, NULL, NULL, 0, &data, &dataLength);
 
         if((err= rtConnection_SendBinaryResponse(g_connection, hdr, data, dataLength, TIMEOUT_VALUE_FIRE_AND_FORGET)) != RT_OK)
         {
             RBUSCORELOG_ERROR("Failed to send async response. Error code: 0x%x", err);
         }
+        rbusMessage_Release(wire);
         rbusMessage_Release(response);
     }
     return err == RT_OK ? RTMESSAGE_BUS_SUCCESS : RTMESSAGE_BUS_ERROR_GENERAL;
@@ -19,16 +19,35 @@
 #include <msgpack.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <pthread.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef ENABLE_RBUS_COMPRESSION
+#include <zlib.h>
+#endif
 #include "rbus_logger.h"
 #include "rtRetainable.h"
 #include "rtMemory.h"
 #include "rbus_message.h"
 
 #define VERIFY_UNPACK_NEXT_ITEM()\
-    if(msgpack_unpack_next(&message->upk, message->sbuf.data, message->sbuf.size, &message->read_offset) != MSGPACK_UNPACK_SUCCESS)\
+    if(message->segment_count && rbusMessage_Flatten(message) != 0)\
+    {\
+        RBUSCORELOG_ERROR("%s failed to flatten message", __FUNCTION__);\
+        return RT_FAIL;\
+    }\
+    rbusMessageItem next;\
+    if(!rbusMessage_Next(message, &next))\
     {\
         RBUSCORELOG_ERROR("%s failed to unpack next item", __FUNCTION__);\
         return RT_FAIL;\
@@ -36,17 +55,17 @@
 
 #define VERIFY_UNPACK(T)\
     VERIFY_UNPACK_NEXT_ITEM()\
-    if(message->upk.data.type != T)\
+    if(next.type != T)\
     {\
-        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, message->upk.data.type);\
+        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, next.type);\
         return RT_FAIL;\
     }
 
 #define VERIFY_UNPACK2(T,T2)\
     VERIFY_UNPACK_NEXT_ITEM()\
-    if(message->upk.data.type != T && message->upk.data.type != T2)\
+    if(next.type != T && next.type != T2)\
     {\
-        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, message->upk.data.type);\
+        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, next.type);\
         return RT_FAIL;\
     }
 
@@ -71,213 +90,3621 @@
     }\
     return RT_OK;
 
+/*Most messages (subscriptions, acks, int32 results) are a few dozen bytes, so they are packed straight into the
+  message struct. Larger messages spill to the heap in power-of-two size classes.*/
+#define RBUS_MESSAGE_INLINE_SIZE 256
+#define RBUS_MESSAGE_MIN_SIZE_CLASS 1024
+#define RBUS_MESSAGE_MAX_SIZE_CLASS (1024*1024)
+#define RBUS_MESSAGE_LARGE_GRANULE (64*1024)
+/*Room left by rbusMessage_Reserve for the routing section rbus-core appends just before sending,
+  so a message reserved to its exact body size is never reallocated on the way out.*/
+#define RBUS_MESSAGE_META_SECTION_RESERVE 320
+/*The meta section trailer is always packed as a msgpack int32: 0xd2 followed by 4 big-endian bytes.*/
+#define RBUS_MESSAGE_META_TRAILER_SIZE 5
+
+/*msgpack ext type codes used by rbusMessage. Array bodies hold big-endian elements back to back.*/
+#define RBUS_MESSAGE_EXT_INT32_ARRAY 1
+#define RBUS_MESSAGE_EXT_INT64_ARRAY 2
+#define RBUS_MESSAGE_EXT_DOUBLE_ARRAY 3
+/*A string sharing a prefix with an earlier plain string: [uvarint distance back to that string's field][uvarint prefix length][suffix]*/
+#define RBUS_MESSAGE_EXT_NAME 4
+/*big-endian uint32 offsets of the body fields, written in the meta section by rbusMessage_EnableFieldIndex*/
+#define RBUS_MESSAGE_EXT_FIELD_INDEX 5
+
+/*A compressed message is [int32 original size][bin deflate stream] with this in place of a method name in its meta section.*/
+#define RBUS_MESSAGE_COMPRESSED_MARKER "_rbus_zlib"
+/*Upper bound on the wrapper around the deflate stream; compression is skipped unless it saves at least this much.*/
+#define RBUS_MESSAGE_COMPRESSED_OVERHEAD 32
+/*Deflate expands at most 1032 times, so a larger original size is a lie meant to make the receiver allocate it.*/
+#define RBUS_MESSAGE_MAX_INFLATE_RATIO 1032
+
+/*Wire format v2 puts a fixed-layout, big-endian header in front of the msgpack body and the routing names after it, in place
+  of the v0 meta section:
+    0 magic, 1 version, 2 flags (16), 4 method id (32), 8 name length (16), 10 object name length (16),
+    12 body length (32), 16 sequence (32), 20 deadline in ms since the epoch (64)
+  Name lengths include the terminator. msgpack never uses 0xC1, so a v0 message can't start with the magic.*/
+#define RBUS_MESSAGE_V2_MAGIC 0xC1
+#define RBUS_MESSAGE_V2_VERSION 2
+#define RBUS_MESSAGE_V2_HEADER_SIZE 28
+#define RBUS_MESSAGE_V2_FLAG_EVENT 0x0001
+#define RBUS_MESSAGE_V2_FLAG_RBUS2 0x0002
+#define RBUS_MESSAGE_V2_FLAG_INTERNED 0x0004 /*names are encoded against a per-peer string table, see rbusMessage_WriteRoute*/
+#define RBUS_MESSAGE_V2_MAX_NAME_LENGTH (UINT16_MAX - 16) /*leaves room for the string table code*/
+#define RBUS_MESSAGE_V2_REQUEST_FLAGS_SHIFT 8 /*request flags from the v0 meta section travel in the high byte*/
+
+/*Routing fields from the meta section, parsed once on first use. A request or response carries
+  a method name, optionally followed by request flags; an event carries the event name, object name and rbus 2.0 flag.*/
+typedef struct _rbusMessageMeta
+{
+    bool parsed;
+    uint8_t fields; /*how many of name, object_name and is_rbus2 were present*/
+    char const* name; /*method name, or event name*/
+    char const* object_name;
+    int32_t is_rbus2;
+    int32_t flags;
+    uint32_t method_id; /*v2 only*/
+    uint32_t sequence; /*v2 only*/
+    uint64_t deadline; /*v2 only*/
+} rbusMessageMeta;
+
+/*Bytes referenced rather than copied by rbusMessage_SetBytesRef and rbusMessage_AppendMessage.
+  They logically follow the first 'offset' bytes of sbuf.data (after any earlier segments).*/
+typedef struct _rbusMessageSegment
+{
+    size_t offset;
+    uint8_t const* data;
+    uint32_t size;
+    struct _rbusMessage* owner; /*retained message the bytes belong to, or NULL for caller memory*/
+} rbusMessageSegment;
+
+/*A buffer nested views may still point into, kept until the message that owned it is destroyed.*/
+typedef struct _rbusMessageRetired
+{
+    struct _rbusMessageRetired* next;
+    char* data;
+    void (*release_buffer)(uint8_t* buff); /*NULL for storage we allocated*/
+} rbusMessageRetired;
+
+typedef struct
+{
+    char const* key; /*NULL for an empty slot*/
+    uint32_t key_length;
+    uint32_t hash;
+    size_t value; /*offset of the value*/
+} rbusMessageMapSlot;
+
 struct _rbusMessage
 {
     rtRetainable retainable;
     msgpack_sbuffer sbuf;
     msgpack_packer pk;
-    msgpack_unpacked upk;
     size_t read_offset;
     int meta_offset;
+    bool borrowed; /*sbuf.data belongs to the transport and is only valid for the duration of its callback*/
+    void (*release_buffer)(uint8_t* buff); /*set when sbuf.data was adopted from the transport rather than allocated by sbuf*/
+    struct _rbusMessage* parent; /*set when this message is a view into the buffer of another (retained) message*/
+    msgpack_sbuffer spare; /*our own storage, set aside while sbuf points at a borrowed or adopted buffer*/
+    bool shared; /*rbusMessage_GetMessage handed out a view into sbuf.data, so it must not be moved or freed*/
+    rbusMessageRetired* retired; /*earlier buffers that views may still point into*/
+    struct _rbusMessage* next_free; /*free list link while the message sits in the pool*/
+    rbusMessageMeta meta; /*points into sbuf.data, so any write or detach invalidates it*/
+    rbusMessageSegment* segments;
+    uint32_t segment_count;
+    uint32_t segment_alloc;
+    size_t segment_bytes; /*total size of all segments, so the encoded size is sbuf.size + segment_bytes*/
+    bool name_table; /*front-code strings against the last plain string written*/
+    bool meta_writing; /*inside a meta section, which is always written plainly for older peers*/
+    bool name_base_valid;
+    size_t name_base_field; /*offset of the last plain string field in the flattened message*/
+    size_t name_base_data; /*where its bytes are in sbuf.data*/
+    uint32_t name_base_length;
+    struct _rbusMessageArena* arena; /*strings rebuilt by rbusMessage_GetString*/
+    size_t body_offset; /*where the msgpack body starts: after the v2 header or the headroom kept for one, or 0*/
+    uint8_t wire_version; /*2 once sbuf holds a v2 header and name trailer, otherwise 0*/
+    uint32_t body_length; /*v2 only*/
+    char const* route_name; /*v2: arena copies of the routing names, once written or resolved*/
+    char const* route_object;
+    int32_t route_defined[2]; /*string table ids defined by the last rbusMessage_ToBytesV2, or -1*/
+    uint32_t* field_index; /*offsets of the body fields from body_offset, built on first use by the cursor functions*/
+    uint32_t field_count;
+    uint32_t field_alloc;
+    size_t fields_end; /*where the last body field ends*/
+    bool field_index_valid;
+    bool write_field_index; /*rbusMessage_EndMetaSectionWrite adds the field index to the meta section*/
+    bool map_open; /*set by rbusMessage_GetMap*/
+    size_t map_offset; /*first key of the open map*/
+    size_t map_end;
+    uint32_t map_count;
+    rbusMessageMapSlot* map_slots; /*hash of the open map's keys, built by the first rbusMessage_GetMapValue*/
+    uint32_t map_slot_alloc;
+    uint32_t map_slot_count; /*power of 2*/
+    bool map_index_valid;
+    char inline_buf[RBUS_MESSAGE_INLINE_SIZE];
 };
 
-void rbusMessage_Init(rbusMessage* message)
+/*Offset of the first byte that goes on the wire.*/
+static inline size_t rbusMessage_WireStart(struct _rbusMessage const* m)
 {
-    struct _rbusMessage * ptr = rt_malloc(sizeof(struct _rbusMessage));
-    msgpack_sbuffer_init(&ptr->sbuf);
-    msgpack_packer_init(&ptr->pk, &ptr->sbuf, msgpack_sbuffer_write);
-    msgpack_unpacked_init(&ptr->upk);
-    *message = ptr;
-    ptr->read_offset = 0;
-    ptr->meta_offset = 0;
-    (*message)->retainable.refCount = 1;
+    return m->wire_version == 2 ? m->body_offset - RBUS_MESSAGE_V2_HEADER_SIZE : m->body_offset;
 }
 
-void rbusMessage_Destroy(rtRetainable* r)
+/*End of what sequential reads may consume. For v0 this includes the meta section, which rbusMessage_BeginMetaSectionRead reads.*/
+static inline size_t rbusMessage_BodyEnd(struct _rbusMessage const* m)
 {
-    rbusMessage m = (rbusMessage)r;
+    return m->wire_version == 2 ? m->body_offset + m->body_length : m->sbuf.size;
+}
 
-    msgpack_sbuffer_destroy(&m->sbuf);
-    msgpack_unpacked_destroy(&m->upk);
-    free(m);
+static inline uint32_t rbusMessage_Load16(uint8_t const* p)
+{
+    return ((uint32_t)p[0] << 8) | p[1];
 }
 
-void rbusMessage_Retain(rbusMessage message)
+static inline uint32_t rbusMessage_Load32(uint8_t const* p)
 {
-    rtRetainable_retain(message);
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
 }
 
-void rbusMessage_Release(rbusMessage message)
+static inline uint64_t rbusMessage_Load64(uint8_t const* p)
 {
-    rtRetainable_release(message, rbusMessage_Destroy);
+    return ((uint64_t)rbusMessage_Load32(p) << 32) | rbusMessage_Load32(p + 4);
 }
 
-void rbusMessage_FromBytes(rbusMessage* message, uint8_t const* buff, uint32_t n)
+static inline void rbusMessage_Store16(uint8_t* p, uint32_t v)
 {
-    struct _rbusMessage * ptr = rt_malloc(sizeof(struct _rbusMessage));
-    msgpack_sbuffer_init(&ptr->sbuf);
-    msgpack_unpacked_init(&ptr->upk);
-    msgpack_sbuffer_write((void *)&ptr->sbuf, (const char *)buff, n);
-    *message = ptr;
-    ptr->read_offset = 0;
-    ptr->meta_offset = 0;
-    (*message)->retainable.refCount = 1;
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
 }
 
-void rbusMessage_ToBytes(rbusMessage message, uint8_t** buff, uint32_t* n)
+static inline void rbusMessage_Store32(uint8_t* p, uint32_t v)
 {
-    *buff = (uint8_t *)message->sbuf.data;
-    *n = message->sbuf.size;
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
 }
 
-void rbusMessage_ToDebugString(rbusMessage const m, char** s, uint32_t* n)
+/* Begin decoder.
+  Reads msgpack items in place, without the zone msgpack_unpack_next keeps. Strings, bins and exts point into the buffer.*/
+typedef struct
 {
-    const int ALLOC_INCREMENT = 2048;
-    int size = ALLOC_INCREMENT;
-    char * buffer = (char *)rt_malloc(size);
-    *s = buffer;
+    msgpack_object_type type;
+    int8_t ext_type;
+    uint32_t size; /*bytes of a str, bin or ext, elements of an array or map*/
+    union
+    {
+        int64_t i64;
+        double f64;
+    } via;
+    char const* ptr;
+} rbusMessageItem;
 
-    int saved_offset = m->read_offset;
-    m->read_offset = 0;
+/*Decodes the item at 'p'. Returns the size of its encoding, not counting the elements of an array or map, or 0 if
+  there isn't a valid item before 'end'.*/
+static size_t rbusMessage_Decode(uint8_t const* p, uint8_t const* end, rbusMessageItem* item)
+{
+    size_t avail = end - p;
+    size_t header;
+    uint8_t b;
 
-    int write_offset = 0;
-    while(msgpack_unpack_next(&m->upk, m->sbuf.data, m->sbuf.size, &m->read_offset) == MSGPACK_UNPACK_SUCCESS)
+    if(p >= end)
+        return 0;
+    b = *p;
+    /*the common cases: small ints and short strings*/
+    if(b <= 0x7f)
     {
-        if((1 >= (size - write_offset)) || 
-                //Special handling for text as snprintf will write past a buffer boundary if precision calls for it.
-                ((MSGPACK_OBJECT_STR == m->upk.data.type) && ((int)m->upk.data.via.str.size > (size - write_offset - 3/*account for quotes + terminator in the output*/))))
+        item->type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+        item->via.i64 = b;
+        return 1;
+    }
+    if(b >= 0xe0)
+    {
+        item->type = MSGPACK_OBJECT_NEGATIVE_INTEGER;
+        item->via.i64 = (int8_t)b;
+        return 1;
+    }
+    if((b & 0xe0) == 0xa0)
+    {
+        item->type = MSGPACK_OBJECT_STR;
+        item->size = b & 0x1f;
+        header = 1;
+        goto payload;
+    }
+    if(b <= 0x9f)
+    {
+        item->type = (b & 0x10) ? MSGPACK_OBJECT_ARRAY : MSGPACK_OBJECT_MAP;
+        item->size = b & 0x0f;
+        return 1;
+    }
+
+    switch(b)
+    {
+    case 0xc0:
+        item->type = MSGPACK_OBJECT_NIL;
+        return 1;
+    case 0xc2:
+    case 0xc3:
+        item->type = MSGPACK_OBJECT_BOOLEAN;
+        item->via.i64 = b & 1;
+        return 1;
+    case 0xc4:
+    case 0xd9:
+        header = 2;
+        if(avail < header)
+            return 0;
+        item->type = b == 0xc4 ? MSGPACK_OBJECT_BIN : MSGPACK_OBJECT_STR;
+        item->size = p[1];
+        goto payload;
+    case 0xc5:
+    case 0xda:
+        header = 3;
+        if(avail < header)
+            return 0;
+        item->type = b == 0xc5 ? MSGPACK_OBJECT_BIN : MSGPACK_OBJECT_STR;
+        item->size = rbusMessage_Load16(p + 1);
+        goto payload;
+    case 0xc6:
+    case 0xdb:
+        header = 5;
+        if(avail < header)
+            return 0;
+        item->type = b == 0xc6 ? MSGPACK_OBJECT_BIN : MSGPACK_OBJECT_STR;
+        item->size = rbusMessage_Load32(p + 1);
+        goto payload;
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+        header = b == 0xc7 ? 3 : b == 0xc8 ? 4 : 6;
+        if(avail < header)
+            return 0;
+        item->type = MSGPACK_OBJECT_EXT;
+        item->size = b == 0xc7 ? p[1] : b == 0xc8 ? rbusMessage_Load16(p + 1) : rbusMessage_Load32(p + 1);
+        item->ext_type = (int8_t)p[header - 1];
+        goto payload;
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+        header = 2;
+        if(avail < header)
+            return 0;
+        item->type = MSGPACK_OBJECT_EXT;
+        item->size = 1u << (b - 0xd4);
+        item->ext_type = (int8_t)p[1];
+        goto payload;
+    case 0xca:
+    {
+        uint32_t bits;
+        float f;
+        if(avail < 5)
+            return 0;
+        bits = rbusMessage_Load32(p + 1);
+        memcpy(&f, &bits, sizeof(f));
+        item->type = MSGPACK_OBJECT_FLOAT;
+        item->via.f64 = f;
+        return 5;
+    }
+    case 0xcb:
+    {
+        uint64_t bits;
+        if(avail < 9)
+            return 0;
+        bits = rbusMessage_Load64(p + 1);
+        memcpy(&item->via.f64, &bits, sizeof(item->via.f64));
+        item->type = MSGPACK_OBJECT_FLOAT;
+        return 9;
+    }
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+    {
+        size_t width = (size_t)1 << (b & 0x3);
+        uint64_t v;
+        if(avail < 1 + width)
+            return 0;
+        v = width == 1 ? p[1] : width == 2 ? rbusMessage_Load16(p + 1) : width == 4 ? rbusMessage_Load32(p + 1) : rbusMessage_Load64(p + 1);
+        if(b >= 0xd0)
         {
-            //Truncated output. Indicate so.
-            //First, make room for ellipsis
+            /*sign extend*/
+            int shift = 64 - 8 * (int)width;
+            item->via.i64 = (int64_t)(v << shift) >> shift;
+        }
+        else
+        {
+            item->via.i64 = (int64_t)v;
+        }
+        item->type = (b >= 0xd0 && item->via.i64 < 0) ? MSGPACK_OBJECT_NEGATIVE_INTEGER : MSGPACK_OBJECT_POSITIVE_INTEGER;
+        return 1 + width;
+    }
+    case 0xdc:
+    case 0xde:
+        if(avail < 3)
+            return 0;
+        item->type = b == 0xdc ? MSGPACK_OBJECT_ARRAY : MSGPACK_OBJECT_MAP;
+        item->size = rbusMessage_Load16(p + 1);
+        return 3;
+    case 0xdd:
+    case 0xdf:
+        if(avail < 5)
+            return 0;
+        item->type = b == 0xdd ? MSGPACK_OBJECT_ARRAY : MSGPACK_OBJECT_MAP;
+        item->size = rbusMessage_Load32(p + 1);
+        return 5;
+    default: /*0xc1 is never used*/
+        return 0;
+    }
 
-            if((size - write_offset) <= 4)
-                write_offset = size - 4;
-            buffer[write_offset++] = '.';
-            buffer[write_offset++] = '.';
-            buffer[write_offset++] = '.';
-            buffer[write_offset++] = 0;
-            break;
+payload:
+    if(avail < header || avail - header < item->size)
+        return 0;
+    item->ptr = (char const*)p + header;
+    return header + item->size;
+}
+
+/*Decodes the item at the read offset and moves past it.*/
+static inline bool rbusMessage_Next(struct _rbusMessage* m, rbusMessageItem* item)
+{
+    uint8_t const* data = (uint8_t const*)m->sbuf.data;
+    size_t n;
+
+    if(m->read_offset >= rbusMessage_BodyEnd(m))
+        return false;
+    n = rbusMessage_Decode(data + m->read_offset, data + rbusMessage_BodyEnd(m), item);
+    m->read_offset += n;
+    return n != 0;
+}
+
+/*Returns the size of the whole item at 'p', including the elements of an array or map, or 0 if it isn't valid.*/
+static size_t rbusMessage_SkipItem(uint8_t const* p, uint8_t const* end)
+{
+    uint8_t const* start = p;
+    uint64_t pending = 1;
+    rbusMessageItem item;
+    size_t n;
+
+    while(pending)
+    {
+        if((n = rbusMessage_Decode(p, end, &item)) == 0)
+            return 0;
+        p += n;
+        pending--;
+        if(item.type == MSGPACK_OBJECT_ARRAY)
+            pending += item.size;
+        else if(item.type == MSGPACK_OBJECT_MAP)
+            pending += (uint64_t)item.size * 2;
+        if(pending > (uint64_t)(end - p))
+            return 0; /*every element takes at least a byte*/
+    }
+    return p - start;
+}
+/* End decoder.*/
+
+/* Begin message storage.*/
+static size_t rbusMessage_SizeClass(size_t size)
+{
+    size_t size_class = RBUS_MESSAGE_MIN_SIZE_CLASS;
+
+    if(size > RBUS_MESSAGE_MAX_SIZE_CLASS)
+        return (size + RBUS_MESSAGE_LARGE_GRANULE - 1) & ~((size_t)RBUS_MESSAGE_LARGE_GRANULE - 1);
+    while(size_class < size)
+        size_class <<= 1;
+    return size_class;
+}
+
+static void rbusMessage_StorageInit(struct _rbusMessage* m, msgpack_sbuffer* sbuf)
+{
+    sbuf->data = m->inline_buf;
+    sbuf->size = 0;
+    sbuf->alloc = sizeof(m->inline_buf);
+}
+
+static void rbusMessage_StorageFree(struct _rbusMessage* m, msgpack_sbuffer* sbuf)
+{
+    if(sbuf->data != m->inline_buf)
+        free(sbuf->data);
+    rbusMessage_StorageInit(m, sbuf);
+}
+
+/* Keep a shared buffer that is about to be replaced until the message is destroyed, since the views that point into it
+   only hold the message. The inline buffer lives as long as the message anyway. */
+static int rbusMessage_RetireBuffer(struct _rbusMessage* m, char* data, void (*release_buffer)(uint8_t* buff))
+{
+    rbusMessageRetired* r;
+
+    if(data != m->inline_buf)
+    {
+        if((r = rt_try_malloc(sizeof(rbusMessageRetired))) == NULL)
+        {
+            RBUSCORELOG_ERROR("%s failed to allocate %lu bytes", __FUNCTION__, (unsigned long)sizeof(rbusMessageRetired));
+            return -1;
         }
-        write_offset += msgpack_object_print_buffer(buffer + write_offset, size - write_offset, m->upk.data);
-        if(1 < (size - write_offset))
+        r->data = data;
+        r->release_buffer = release_buffer;
+        r->next = m->retired;
+        m->retired = r;
+    }
+    m->shared = false;
+    return 0;
+}
+
+static void rbusMessage_FreeRetired(struct _rbusMessage* m)
+{
+    while(m->retired)
+    {
+        rbusMessageRetired* r = m->retired;
+        m->retired = r->next;
+        if(r->release_buffer)
+            r->release_buffer((uint8_t*)r->data);
+        else
+            free(r->data);
+        free(r);
+    }
+}
+
+/* Make room for 'size' bytes in total. Growth goes to the next size class unless 'exact' is set. */
+static int rbusMessage_StorageReserve(struct _rbusMessage* m, msgpack_sbuffer* sbuf, size_t size, bool exact)
+{
+    char* data;
+    size_t alloc;
+    bool shared;
+
+    if(size <= sbuf->alloc)
+        return 0;
+
+    alloc = exact ? size : rbusMessage_SizeClass(size);
+    shared = sbuf == &m->sbuf && m->shared;
+    if(sbuf->data == m->inline_buf || shared)
+    {
+        if((data = rt_try_malloc(alloc)) != NULL)
+            memcpy(data, sbuf->data, sbuf->size);
+    }
+    else
+    {
+        data = rt_try_realloc(sbuf->data, alloc);
+    }
+    if(!data)
+    {
+        RBUSCORELOG_ERROR("%s failed to allocate %lu bytes", __FUNCTION__, (unsigned long)alloc);
+        return -1;
+    }
+    if(shared && rbusMessage_RetireBuffer(m, sbuf->data, NULL) != 0)
+    {
+        free(data);
+        return -1;
+    }
+    sbuf->data = data;
+    sbuf->alloc = alloc;
+    return 0;
+}
+
+static int rbusMessage_StorageWrite(struct _rbusMessage* m, msgpack_sbuffer* sbuf, const char* buf, size_t len)
+{
+    if(sbuf->alloc - sbuf->size < len && rbusMessage_StorageReserve(m, sbuf, sbuf->size + len, false) != 0)
+        return -1;
+    if(len)
+        memcpy(sbuf->data + sbuf->size, buf, len);
+    sbuf->size += len;
+    return 0;
+}
+/* End message storage.*/
+
+/* Begin message segments.*/
+static int rbusMessage_AddSegment(struct _rbusMessage* m, uint8_t const* data, uint32_t size, struct _rbusMessage* owner)
+{
+    rbusMessageSegment* seg;
+
+    if(m->segment_count == m->segment_alloc)
+    {
+        uint32_t alloc = m->segment_alloc ? m->segment_alloc * 2 : 4;
+        rbusMessageSegment* segments = rt_try_realloc(m->segments, alloc * sizeof(rbusMessageSegment));
+        if(!segments)
         {
-            buffer[write_offset++] = ' ';
-            buffer[write_offset] = '\0';
+            RBUSCORELOG_ERROR("%s failed to allocate %u segments", __FUNCTION__, alloc);
+            return -1;
         }
+        m->segments = segments;
+        m->segment_alloc = alloc;
     }
-    //Trim the last space.
-    if(write_offset && (' ' == buffer[write_offset - 1]))
+    seg = &m->segments[m->segment_count++];
+    seg->offset = m->sbuf.size;
+    seg->data = data;
+    seg->size = size;
+    seg->owner = owner;
+    m->segment_bytes += size;
+    return 0;
+}
+
+static void rbusMessage_ClearSegments(struct _rbusMessage* m)
+{
+    uint32_t i;
+
+    for(i = 0; i < m->segment_count; ++i)
     {
-        write_offset--;
-        buffer[write_offset] = '\0';
+        if(m->segments[i].owner)
+            rbusMessage_Release(m->segments[i].owner);
     }
+    m->segment_count = 0;
+    m->segment_bytes = 0;
+}
 
-    m->read_offset = saved_offset;
-    *n = write_offset;
+/*Copy the encoded message from 'start' on, segments included, to 'dst', which holds sbuf.size - start + segment_bytes.*/
+static void rbusMessage_CopyFlat(struct _rbusMessage const* m, size_t start, char* dst)
+{
+    size_t pos = start;
+    uint32_t i;
+
+    for(i = 0; i < m->segment_count; ++i)
+    {
+        rbusMessageSegment const* seg = &m->segments[i];
+        memcpy(dst, m->sbuf.data + pos, seg->offset - pos);
+        dst += seg->offset - pos;
+        memcpy(dst, seg->data, seg->size);
+        dst += seg->size;
+        pos = seg->offset;
+    }
+    memcpy(dst, m->sbuf.data + pos, m->sbuf.size - pos);
 }
 
-rtError rbusMessage_SetString(rbusMessage message, char const* value)
+/*Replace the segments with a single exactly sized contiguous buffer.*/
+static int rbusMessage_Flatten(struct _rbusMessage* m)
 {
-    static const char dummy[] = "";
-    if(!value)
-        value = dummy;
-    int length = strlen(value) + 1;
-    VERIFY_PACK_BUFFER(str, value, length);
+    size_t size = m->sbuf.size + m->segment_bytes;
+    char* data;
+
+    if(!m->segment_count)
+        return 0;
+    if((data = rt_try_malloc(size)) == NULL)
+    {
+        RBUSCORELOG_ERROR("%s failed to allocate %lu bytes", __FUNCTION__, (unsigned long)size);
+        return -1;
+    }
+    rbusMessage_CopyFlat(m, 0, data);
+    if(m->shared)
+    {
+        if(rbusMessage_RetireBuffer(m, m->sbuf.data, NULL) != 0)
+        {
+            free(data);
+            return -1;
+        }
+        rbusMessage_StorageInit(m, &m->sbuf);
+    }
+    else
+    {
+        rbusMessage_StorageFree(m, &m->sbuf);
+    }
+    rbusMessage_ClearSegments(m);
+    m->sbuf.data = data;
+    m->sbuf.size = size;
+    m->sbuf.alloc = size;
+    m->meta.parsed = false;
+    m->field_index_valid = false;
+    m->map_open = false;
+    m->name_base_valid = false;
+    return 0;
 }
+/* End message segments.*/
 
-rtError rbusMessage_GetString(rbusMessage const message, char const** value)
+/* Begin name table.*/
+typedef struct _rbusMessageArena
 {
-    VERIFY_UNPACK(MSGPACK_OBJECT_STR);
-    *value = message->upk.data.via.str.ptr;
-    return RT_OK;
+    struct _rbusMessageArena* next;
+    size_t size;
+    size_t used;
+    char data[];
+} rbusMessageArena;
+
+#define RBUS_MESSAGE_ARENA_CHUNK 4096
+
+static char* rbusMessage_ArenaAlloc(struct _rbusMessage* m, size_t size)
+{
+    rbusMessageArena* a = m->arena;
+
+    if(!a || a->size - a->used < size)
+    {
+        size_t chunk = size > RBUS_MESSAGE_ARENA_CHUNK ? size : RBUS_MESSAGE_ARENA_CHUNK;
+        if((a = rt_try_malloc(sizeof(rbusMessageArena) + chunk)) == NULL)
+        {
+            RBUSCORELOG_ERROR("%s failed to allocate %lu bytes", __FUNCTION__, (unsigned long)chunk);
+            return NULL;
+        }
+        a->next = m->arena;
+        a->size = chunk;
+        a->used = 0;
+        m->arena = a;
+    }
+    a->used += size;
+    return a->data + a->used - size;
 }
 
-rtError rbusMessage_SetBytes(rbusMessage message, uint8_t const* bytes, const uint32_t size)
+static void rbusMessage_ArenaFree(struct _rbusMessage* m)
 {
-    VERIFY_PACK_BUFFER(bin, bytes, size);
+    while(m->arena)
+    {
+        rbusMessageArena* a = m->arena;
+        m->arena = a->next;
+        free(a);
+    }
 }
 
-rtError rbusMessage_GetBytes(rbusMessage message, uint8_t const** value, uint32_t* size)
+static uint32_t rbusMessage_PutUvarint(uint8_t* p, uint64_t v)
 {
-    VERIFY_UNPACK(MSGPACK_OBJECT_BIN);
-    *size = message->upk.data.via.bin.size;
-    *value = (uint8_t const*)message->upk.data.via.bin.ptr;
-    return RT_OK;
+    uint32_t n = 0;
+    while(v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
 }
 
-rtError rbusMessage_SetInt32(rbusMessage message, int32_t value)
+static bool rbusMessage_GetUvarint(uint8_t const** p, uint8_t const* end, uint64_t* v)
 {
-    VERIFY_PACK(int32);
+    uint32_t shift = 0;
+    *v = 0;
+    while(*p < end && shift < 64)
+    {
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return true;
+        shift += 7;
+    }
+    return false;
 }
 
-rtError rbusMessage_GetInt32(rbusMessage const message, int32_t* value)
+/*Pack 'value' ('length' bytes including the terminator) as a name if that is smaller than a plain string.
+  Returns 1 if it was packed, 0 if the caller should pack a plain string, -1 on error.*/
+static int rbusMessage_PackName(struct _rbusMessage* m, char const* value, uint32_t length)
 {
-    VERIFY_UNPACK2(MSGPACK_OBJECT_POSITIVE_INTEGER, MSGPACK_OBJECT_NEGATIVE_INTEGER);
-    *value = (int32_t)message->upk.data.via.i64;
+    uint8_t header[20];
+    uint32_t header_size;
+    uint32_t prefix = 0;
+    char const* base;
+    size_t field = m->sbuf.size + m->segment_bytes;
+
+    if(!m->name_table || m->meta_writing || !m->name_base_valid)
+        return 0;
+    base = m->sbuf.data + m->name_base_data;
+    while(prefix < m->name_base_length - 1 && prefix < length - 1 && base[prefix] == value[prefix])
+        prefix++;
+    header_size = rbusMessage_PutUvarint(header, field - m->name_base_field);
+    header_size += rbusMessage_PutUvarint(header + header_size, prefix);
+    /*only worth it when the ext header and varints cost less than the shared prefix*/
+    if(6 + header_size >= prefix)
+        return 0;
+    if(msgpack_pack_ext(&m->pk, header_size + length - prefix, RBUS_MESSAGE_EXT_NAME) != 0 ||
+        msgpack_pack_ext_body(&m->pk, header, header_size) != 0 ||
+        msgpack_pack_ext_body(&m->pk, value + prefix, length - prefix) != 0)
+        return -1;
+    return 1;
+}
+
+/*Rebuild a name written by rbusMessage_PackName. 'field' is the offset of the ext field 'item'.*/
+static rtError rbusMessage_UnpackName(struct _rbusMessage* m, size_t field, rbusMessageItem const* item, char const** value)
+{
+    uint8_t const* p = (uint8_t const*)item->ptr;
+    uint8_t const* end = p + item->size;
+    uint8_t const* base;
+    uint64_t distance, prefix;
+    uint32_t base_length;
+    char* name;
+
+    if(item->ext_type != RBUS_MESSAGE_EXT_NAME ||
+        !rbusMessage_GetUvarint(&p, end, &distance) || !rbusMessage_GetUvarint(&p, end, &prefix) ||
+        distance == 0 || distance > field - m->body_offset || p == end || end[-1] != '\0')
+    {
+        RBUSCORELOG_ERROR("%s malformed name", __FUNCTION__);
+        return RT_FAIL;
+    }
+
+    /*the base is always a plain str, so decode its header directly*/
+    base = (uint8_t const*)m->sbuf.data + field - distance;
+    if((*base & 0xe0) == 0xa0)
+    {
+        base_length = *base & 0x1f;
+        base += 1;
+    }
+    else if(*base == 0xd9)
+    {
+        base_length = base[1];
+        base += 2;
+    }
+    else if(*base == 0xda)
+    {
+        base_length = ((uint32_t)base[1] << 8) | base[2];
+        base += 3;
+    }
+    else if(*base == 0xdb)
+    {
+        base_length = ((uint32_t)base[1] << 24) | ((uint32_t)base[2] << 16) | ((uint32_t)base[3] << 8) | base[4];
+        base += 5;
+    }
+    else
+    {
+        RBUSCORELOG_ERROR("%s name base is not a string", __FUNCTION__);
+        return RT_FAIL;
+    }
+    if(prefix >= base_length || base + prefix > (uint8_t const*)m->sbuf.data + field)
+    {
+        RBUSCORELOG_ERROR("%s malformed name", __FUNCTION__);
+        return RT_FAIL;
+    }
+
+    if((name = rbusMessage_ArenaAlloc(m, prefix + (end - p))) == NULL)
+        return RT_FAIL;
+    memcpy(name, base, prefix);
+    memcpy(name + prefix, p, end - p);
+    *value = name;
     return RT_OK;
 }
+/* End name table.*/
 
-rtError rbusMessage_SetInt64(rbusMessage message, int64_t value)
+/* Begin message pool.*/
+typedef struct _rbusMessagePool
 {
-    VERIFY_PACK(int64);
+    struct _rbusMessage* head;
+    uint32_t count;
+} rbusMessagePool;
+
+static uint32_t g_pool_max_cached = 0; /*0 means the pool is disabled*/
+static uint32_t g_pool_max_buffer = 0;
+static uint64_t g_pool_hits = 0;
+static uint64_t g_pool_misses = 0;
+static uint64_t g_pool_trimmed = 0;
+static pthread_key_t g_pool_key;
+static pthread_once_t g_pool_key_once = PTHREAD_ONCE_INIT;
+static __thread rbusMessagePool t_pool;
+
+static void rbusMessage_FreeStorage(struct _rbusMessage* m)
+{
+    rbusMessage_StorageFree(m, &m->sbuf);
+    rbusMessage_StorageFree(m, &m->spare);
+    free(m->segments);
+    free(m->field_index);
+    free(m->map_slots);
+    free(m);
 }
 
-rtError rbusMessage_GetInt64(rbusMessage const message, int64_t* value)
+static void rbusMessagePool_ThreadExit(void* p)
 {
-    VERIFY_UNPACK2(MSGPACK_OBJECT_POSITIVE_INTEGER, MSGPACK_OBJECT_NEGATIVE_INTEGER);
-    *value = message->upk.data.via.i64;
-    return RT_OK;
+    rbusMessagePool* pool = (rbusMessagePool*)p;
+    while(pool->head)
+    {
+        struct _rbusMessage* m = pool->head;
+        pool->head = m->next_free;
+        rbusMessage_FreeStorage(m);
+    }
+    pool->count = 0;
 }
 
-rtError rbusMessage_SetDouble(rbusMessage message, double value)
+static void rbusMessagePool_CreateKey()
 {
-    VERIFY_PACK(double);
+    pthread_key_create(&g_pool_key, rbusMessagePool_ThreadExit);
 }
 
-rtError rbusMessage_GetDouble(rbusMessage const message, double* value)
+static struct _rbusMessage* rbusMessagePool_Get()
 {
-    VERIFY_UNPACK(MSGPACK_OBJECT_FLOAT);
-    *value = message->upk.data.via.f64;
-    return RT_OK;
+    struct _rbusMessage* m;
+
+    if(__atomic_load_n(&g_pool_max_cached, __ATOMIC_RELAXED) == 0)
+        return NULL;
+    if(!(m = t_pool.head))
+    {
+        __atomic_fetch_add(&g_pool_misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    t_pool.head = m->next_free;
+    t_pool.count--;
+    __atomic_fetch_add(&g_pool_hits, 1, __ATOMIC_RELAXED);
+    return m;
 }
 
-rtError rbusMessage_SetMessage(rbusMessage message, rbusMessage const item)
+/*Frees cached messages until the calling thread's free list holds at most 'max_cached'.*/
+static void rbusMessagePool_Trim(uint32_t max_cached)
 {
-    VERIFY_PACK_BUFFER(bin, item->sbuf.data, item->sbuf.size);
+    while(t_pool.count > max_cached)
+    {
+        struct _rbusMessage* m = t_pool.head;
+        t_pool.head = m->next_free;
+        t_pool.count--;
+        __atomic_fetch_add(&g_pool_trimmed, 1, __ATOMIC_RELAXED);
+        rbusMessage_FreeStorage(m);
+    }
 }
 
-rtError rbusMessage_GetMessage(rbusMessage const message, rbusMessage* value)
+static void rbusMessagePool_Put(struct _rbusMessage* m)
 {
-    VERIFY_UNPACK(MSGPACK_OBJECT_BIN);
-    rbusMessage_FromBytes(value, (uint8_t*)message->upk.data.via.bin.ptr, message->upk.data.via.bin.size);
-    return RT_OK;
+    uint32_t max_cached = __atomic_load_n(&g_pool_max_cached, __ATOMIC_RELAXED);
+
+    /*the limit may have been lowered by another thread since this one filled its list*/
+    rbusMessagePool_Trim(max_cached);
+    if(t_pool.count >= max_cached)
+    {
+        if(max_cached)
+            __atomic_fetch_add(&g_pool_trimmed, 1, __ATOMIC_RELAXED);
+        rbusMessage_FreeStorage(m);
+        return;
+    }
+
+    /*keep small buffers for reuse and trim anything above the high-water mark*/
+    if(m->sbuf.alloc > __atomic_load_n(&g_pool_max_buffer, __ATOMIC_RELAXED))
+        rbusMessage_StorageFree(m, &m->sbuf);
+    m->sbuf.size = 0;
+
+    if(t_pool.count == 0)
+    {
+        /*so the cached messages are freed when this thread exits*/
+        pthread_once(&g_pool_key_once, rbusMessagePool_CreateKey);
+        pthread_setspecific(g_pool_key, &t_pool);
+    }
+    m->next_free = t_pool.head;
+    t_pool.head = m;
+    t_pool.count++;
 }
 
-void rbusMessage_BeginMetaSectionWrite(rbusMessage message)
+void rbusMessage_ConfigurePool(uint32_t max_cached, uint32_t max_buffer_size)
 {
-    message->meta_offset = message->sbuf.size;
+    __atomic_store_n(&g_pool_max_buffer, max_buffer_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_pool_max_cached, max_cached, __ATOMIC_RELAXED);
+    rbusMessagePool_Trim(max_cached);
 }
 
-void rbusMessage_EndMetaSectionWrite(rbusMessage message)
+void rbusMessage_GetPoolStats(rbusMessagePoolStats* stats)
 {
-    msgpack_pack_int32(&message->pk, message->meta_offset | 0x80000000);
-    message->sbuf.data[message->sbuf.size - 4] &= 0x7F; //Clear the effects of mask, now that offset is stored as a 4-byte integer.
+    stats->hits = __atomic_load_n(&g_pool_hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&g_pool_misses, __ATOMIC_RELAXED);
+    stats->trimmed = __atomic_load_n(&g_pool_trimmed, __ATOMIC_RELAXED);
+    stats->cached = t_pool.count;
 }
+/* End message pool.*/
 
-void rbusMessage_BeginMetaSectionRead(rbusMessage message)
+static inline bool rbusMessage_IsForeign(rbusMessage m)
 {
-    int section_offset = 0;
-    message->meta_offset = message->read_offset; //For safekeeping.
-    message->read_offset = message->sbuf.size - 5;
-    rbusMessage_GetInt32(message, &section_offset);
-    message->read_offset = section_offset;
+    return m->borrowed || m->release_buffer || m->parent;
 }
 
-void rbusMessage_EndMetaSectionRead(rbusMessage message)
+/* Take a private copy of a borrowed, adopted or shared buffer so the message can be written to or outlive the transport callback. */
+static int rbusMessage_Detach(rbusMessage m)
 {
-    message->read_offset = message->meta_offset;
+    msgpack_sbuffer sbuf;
+
+    if(!rbusMessage_IsForeign(m))
+        return 0;
+
+    sbuf = m->spare;
+    sbuf.size = 0;
+    if(rbusMessage_StorageWrite(m, &sbuf, m->sbuf.data, m->sbuf.size) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed to copy %lu bytes", __FUNCTION__, (unsigned long)m->sbuf.size);
+        m->spare = sbuf;
+        return -1;
+    }
+    if(m->shared)
+    {
+        if(rbusMessage_RetireBuffer(m, m->sbuf.data, m->release_buffer) != 0)
+        {
+            sbuf.size = 0;
+            m->spare = sbuf;
+            return -1;
+        }
+    }
+    else if(m->release_buffer)
+    {
+        m->release_buffer((uint8_t*)m->sbuf.data);
+    }
+    if(m->parent)
+        rbusMessage_Release(m->parent);
+    m->sbuf = sbuf;
+    rbusMessage_StorageInit(m, &m->spare);
+    m->meta.parsed = false;
+    m->borrowed = false;
+    m->release_buffer = NULL;
+    m->parent = NULL;
+    return 0;
 }
 
+/*Get the message ready to be appended to: take a private copy of a foreign buffer, and drop a v2 name trailer so the
+  body can grow (the routing is written again before the message is next sent).*/
+static int rbusMessage_PrepareWrite(rbusMessage m)
+{
+    if(rbusMessage_IsForeign(m) && rbusMessage_Detach(m) != 0)
+        return -1;
+    if(m->wire_version == 2)
+    {
+        m->sbuf.size = m->body_offset + m->body_length;
+        m->wire_version = 0;
+    }
+    m->meta.parsed = false;
+    m->field_index_valid = false;
+    m->map_open = false;
+    return 0;
+}
+
+static int rbusMessage_Write(void* data, const char* buf, size_t len)
+{
+    rbusMessage m = (rbusMessage)data;
+
+    if(rbusMessage_PrepareWrite(m) != 0)
+        return -1;
+    return rbusMessage_StorageWrite(m, &m->sbuf, buf, len);
+}
+
+static struct _rbusMessage* rbusMessage_Create()
+{
+    struct _rbusMessage * ptr = rbusMessagePool_Get();
+    if(!ptr)
+    {
+        ptr = rt_malloc(sizeof(struct _rbusMessage));
+        rbusMessage_StorageInit(ptr, &ptr->sbuf);
+        rbusMessage_StorageInit(ptr, &ptr->spare);
+        ptr->segments = NULL;
+        ptr->segment_alloc = 0;
+        ptr->field_index = NULL;
+        ptr->field_alloc = 0;
+        ptr->map_slots = NULL;
+        ptr->map_slot_alloc = 0;
+    }
+    msgpack_packer_init(&ptr->pk, ptr, rbusMessage_Write);
+    /*headroom so a v2 header can be put in front of the body without moving it*/
+    ptr->sbuf.size = RBUS_MESSAGE_V2_HEADER_SIZE;
+    ptr->body_offset = RBUS_MESSAGE_V2_HEADER_SIZE;
+    ptr->wire_version = 0;
+    ptr->route_name = NULL;
+    ptr->route_object = NULL;
+    ptr->read_offset = ptr->body_offset;
+    ptr->meta_offset = 0;
+    ptr->borrowed = false;
+    ptr->release_buffer = NULL;
+    ptr->parent = NULL;
+    ptr->shared = false;
+    ptr->retired = NULL;
+    ptr->next_free = NULL;
+    ptr->meta.parsed = false;
+    ptr->field_index_valid = false;
+    ptr->write_field_index = false;
+    ptr->map_open = false;
+    ptr->map_index_valid = false;
+    ptr->segment_count = 0;
+    ptr->segment_bytes = 0;
+    ptr->name_table = false;
+    ptr->meta_writing = false;
+    ptr->name_base_valid = false;
+    ptr->arena = NULL;
+    ptr->retainable.refCount = 1;
+    return ptr;
+}
+
+/*Work out the wire format of bytes just placed in sbuf: v2 if they start with a valid v2 header, otherwise v0.*/
+static void rbusMessage_DetectWireVersion(struct _rbusMessage* m)
+{
+    uint8_t const* p = (uint8_t const*)m->sbuf.data;
+    size_t body, name, object;
+
+    m->body_offset = 0;
+    m->wire_version = 0;
+    m->read_offset = 0;
+    m->meta.parsed = false;
+    m->field_index_valid = false;
+    m->map_open = false;
+    m->route_name = NULL;
+    m->route_object = NULL;
+    if(m->sbuf.size == 0 || p[0] != RBUS_MESSAGE_V2_MAGIC)
+        return;
+    if(m->sbuf.size < RBUS_MESSAGE_V2_HEADER_SIZE || p[1] != RBUS_MESSAGE_V2_VERSION)
+    {
+        RBUSCORELOG_ERROR("%s unsupported wire format version", __FUNCTION__);
+        return;
+    }
+    name = rbusMessage_Load16(p + 8);
+    object = rbusMessage_Load16(p + 10);
+    body = rbusMessage_Load32(p + 12);
+    if(RBUS_MESSAGE_V2_HEADER_SIZE + body + name + object != m->sbuf.size || name == 0 ||
+        (!(rbusMessage_Load16(p + 2) & RBUS_MESSAGE_V2_FLAG_INTERNED) &&
+        (p[RBUS_MESSAGE_V2_HEADER_SIZE + body + name - 1] != '\0' || (object && p[m->sbuf.size - 1] != '\0'))))
+    {
+        RBUSCORELOG_ERROR("%s malformed v2 header", __FUNCTION__);
+        return;
+    }
+    m->wire_version = 2;
+    m->body_offset = RBUS_MESSAGE_V2_HEADER_SIZE;
+    m->body_length = (uint32_t)body;
+    m->read_offset = m->body_offset;
+}
+
+/* Point the message at a buffer it does not own, keeping any pooled storage aside for a later detach.*/
+static void rbusMessage_SetForeignBuffer(struct _rbusMessage* m, uint8_t const* buff, uint32_t n)
+{
+    m->spare = m->sbuf;
+    m->sbuf.data = (char*)buff;
+    m->sbuf.size = n;
+    m->sbuf.alloc = n;
+}
+
+void rbusMessage_Init(rbusMessage* message)
+{
+    *message = rbusMessage_Create();
+}
+
+void rbusMessage_InitWithCapacity(rbusMessage* message, uint32_t capacity)
+{
+    *message = rbusMessage_Create();
+    rbusMessage_Reserve(*message, capacity);
+}
+
+rtError rbusMessage_Reserve(rbusMessage message, uint32_t capacity)
+{
+    if(rbusMessage_IsForeign(message) && rbusMessage_Detach(message) != 0)
+        return RT_FAIL;
+    if(rbusMessage_StorageReserve(message, &message->sbuf,
+        message->body_offset + capacity + RBUS_MESSAGE_META_SECTION_RESERVE, true) != 0)
+        return RT_FAIL;
+    return RT_OK;
+}
+
+/*Drop a borrowed, adopted or shared buffer without copying it, going back to our own storage.*/
+static void rbusMessage_ReleaseForeign(rbusMessage m)
+{
+    if(!rbusMessage_IsForeign(m))
+        return;
+    if(m->release_buffer)
+        m->release_buffer((uint8_t*)m->sbuf.data);
+    if(m->parent)
+        rbusMessage_Release(m->parent);
+    m->sbuf = m->spare;
+    rbusMessage_StorageInit(m, &m->spare);
+    m->borrowed = false;
+    m->release_buffer = NULL;
+    m->parent = NULL;
+}
+
+void rbusMessage_Destroy(rtRetainable* r)
+{
+    rbusMessage m = (rbusMessage)r;
+
+    rbusMessage_ReleaseForeign(m);
+    rbusMessage_FreeRetired(m);
+    rbusMessage_ClearSegments(m);
+    rbusMessage_ArenaFree(m);
+    m->shared = false;
+    rbusMessagePool_Put(m);
+}
+
+void rbusMessage_Retain(rbusMessage message)
+{
+    /*a borrowed buffer dies with the transport callback, so any reference that can outlive it needs its own copy. There
+      is no way to tell the caller the copy failed, and handing out a reference to a buffer about to be freed would be
+      worse than stopping here.*/
+    if(message->borrowed && rbusMessage_Detach(message) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed to copy the borrowed buffer of a retained message", __FUNCTION__);
+        abort();
+    }
+    rtRetainable_retain(message);
+}
+
+void rbusMessage_Release(rbusMessage message)
+{
+    rtRetainable_release(message, rbusMessage_Destroy);
+}
+
+#ifdef ENABLE_RBUS_COMPRESSION
+static void rbusMessage_Inflate(rbusMessage m);
+#else
+#define rbusMessage_Inflate(m)
+#endif
+
+void rbusMessage_FromBytes(rbusMessage* message, uint8_t const* buff, uint32_t n)
+{
+    struct _rbusMessage * ptr = rbusMessage_Create();
+    ptr->sbuf.size = 0;
+    rbusMessage_StorageWrite(ptr, &ptr->sbuf, (const char *)buff, n);
+    rbusMessage_DetectWireVersion(ptr);
+    rbusMessage_Inflate(ptr);
+    *message = ptr;
+}
+
+void rbusMessage_FromBytesNoCopy(rbusMessage* message, uint8_t const* buff, uint32_t n)
+{
+    struct _rbusMessage * ptr = rbusMessage_Create();
+    rbusMessage_SetForeignBuffer(ptr, buff, n);
+    ptr->borrowed = true;
+    rbusMessage_DetectWireVersion(ptr);
+    rbusMessage_Inflate(ptr);
+    *message = ptr;
+}
+
+void rbusMessage_FromBytesAdopt(rbusMessage* message, uint8_t* buff, uint32_t n, void (*release_buffer)(uint8_t* buff))
+{
+    struct _rbusMessage * ptr = rbusMessage_Create();
+    rbusMessage_SetForeignBuffer(ptr, buff, n);
+    ptr->release_buffer = release_buffer;
+    rbusMessage_DetectWireVersion(ptr);
+    rbusMessage_Inflate(ptr);
+    *message = ptr;
+}
+
+void rbusMessage_ToBytes(rbusMessage message, uint8_t** buff, uint32_t* n)
+{
+    if(rbusMessage_Flatten(message) != 0)
+    {
+        *buff = NULL;
+        *n = 0;
+        return;
+    }
+    *buff = (uint8_t *)message->sbuf.data + rbusMessage_WireStart(message);
+    *n = message->sbuf.size - rbusMessage_WireStart(message);
+}
+
+void rbusMessage_ToDebugString(rbusMessage const m, char** s, uint32_t* n)
+{
+    const int ALLOC_INCREMENT = 2048;
+    int size = ALLOC_INCREMENT;
+    char * buffer = (char *)rt_malloc(size);
+    *s = buffer;
+
+    rbusMessage_Flatten(m);
+
+    size_t offset = m->body_offset;
+    msgpack_unpacked upk;
+    msgpack_unpacked_init(&upk);
+
+    int write_offset = 0;
+    while(msgpack_unpack_next(&upk, m->sbuf.data, rbusMessage_BodyEnd(m), &offset) == MSGPACK_UNPACK_SUCCESS)
+    {
+        if((1 >= (size - write_offset)) || 
+                //Special handling for text as snprintf will write past a buffer boundary if precision calls for it.
+                ((MSGPACK_OBJECT_STR == upk.data.type) && ((int)upk.data.via.str.size > (size - write_offset - 3/*account for quotes + terminator in the output*/))))
+        {
+            //Truncated output. Indicate so.
+            //First, make room for ellipsis
+
+            if((size - write_offset) <= 4)
+                write_offset = size - 4;
+            buffer[write_offset++] = '.';
+            buffer[write_offset++] = '.';
+            buffer[write_offset++] = '.';
+            buffer[write_offset++] = 0;
+            break;
+        }
+        write_offset += msgpack_object_print_buffer(buffer + write_offset, size - write_offset, upk.data);
+        if(1 < (size - write_offset))
+        {
+            buffer[write_offset++] = ' ';
+            buffer[write_offset] = '\0';
+        }
+    }
+    //Trim the last space.
+    if(write_offset && (' ' == buffer[write_offset - 1]))
+    {
+        write_offset--;
+        buffer[write_offset] = '\0';
+    }
+
+    msgpack_unpacked_destroy(&upk);
+    *n = write_offset;
+}
+
+rtError rbusMessage_SetString(rbusMessage message, char const* value)
+{
+    static const char dummy[] = "";
+    if(!value)
+        value = dummy;
+    int length = strlen(value) + 1;
+    if(message->name_table && !message->meta_writing)
+    {
+        size_t field;
+        int rc;
+        if(rbusMessage_PrepareWrite(message) != 0)
+            return RT_FAIL;
+        field = message->sbuf.size + message->segment_bytes;
+        rc = rbusMessage_PackName(message, value, length);
+        if(rc < 0)
+        {
+            RBUSCORELOG_ERROR("%s failed pack name", __FUNCTION__);
+            return RT_FAIL;
+        }
+        if(rc > 0)
+            return RT_OK;
+        if(msgpack_pack_str(&message->pk, length) != 0 || msgpack_pack_str_body(&message->pk, value, length) != 0)
+        {
+            RBUSCORELOG_ERROR("%s failed pack buffer", __FUNCTION__);
+            return RT_FAIL;
+        }
+        /*later names are coded against this one*/
+        message->name_base_valid = true;
+        message->name_base_field = field;
+        message->name_base_data = message->sbuf.size - length;
+        message->name_base_length = length;
+        return RT_OK;
+    }
+    VERIFY_PACK_BUFFER(str, value, length);
+}
+
+rtError rbusMessage_GetString(rbusMessage const message, char const** value)
+{
+    size_t field = message->read_offset;
+    VERIFY_UNPACK2(MSGPACK_OBJECT_STR, MSGPACK_OBJECT_EXT);
+    if(next.type == MSGPACK_OBJECT_EXT)
+        return rbusMessage_UnpackName(message, field, &next, value);
+    *value = next.ptr;
+    return RT_OK;
+}
+
+void rbusMessage_EnableNameTable(rbusMessage message, int enable)
+{
+    message->name_table = enable != 0;
+    message->name_base_valid = false;
+}
+
+rtError rbusMessage_SetBytes(rbusMessage message, uint8_t const* bytes, const uint32_t size)
+{
+    VERIFY_PACK_BUFFER(bin, bytes, size);
+}
+
+rtError rbusMessage_GetBytes(rbusMessage message, uint8_t const** value, uint32_t* size)
+{
+    VERIFY_UNPACK(MSGPACK_OBJECT_BIN);
+    *size = next.size;
+    *value = (uint8_t const*)next.ptr;
+    return RT_OK;
+}
+
+rtError rbusMessage_SetInt32(rbusMessage message, int32_t value)
+{
+    VERIFY_PACK(int32);
+}
+
+rtError rbusMessage_GetInt32(rbusMessage const message, int32_t* value)
+{
+    VERIFY_UNPACK2(MSGPACK_OBJECT_POSITIVE_INTEGER, MSGPACK_OBJECT_NEGATIVE_INTEGER);
+    *value = (int32_t)next.via.i64;
+    return RT_OK;
+}
+
+rtError rbusMessage_SetInt64(rbusMessage message, int64_t value)
+{
+    VERIFY_PACK(int64);
+}
+
+rtError rbusMessage_GetInt64(rbusMessage const message, int64_t* value)
+{
+    VERIFY_UNPACK2(MSGPACK_OBJECT_POSITIVE_INTEGER, MSGPACK_OBJECT_NEGATIVE_INTEGER);
+    *value = next.via.i64;
+    return RT_OK;
+}
+
+rtError rbusMessage_SetDouble(rbusMessage message, double value)
+{
+    VERIFY_PACK(double);
+}
+
+rtError rbusMessage_GetDouble(rbusMessage const message, double* value)
+{
+    VERIFY_UNPACK(MSGPACK_OBJECT_FLOAT);
+    *value = next.via.f64;
+    return RT_OK;
+}
+
+rtError rbusMessage_SetMessage(rbusMessage message, rbusMessage const item)
+{
+    size_t start = rbusMessage_WireStart(item);
+    size_t size;
+
+    if(!item->segment_count)
+    {
+        VERIFY_PACK_BUFFER(bin, item->sbuf.data + start, item->sbuf.size - start);
+    }
+    /*copy item with its segments, leaving item itself as it is*/
+    size = item->sbuf.size - start + item->segment_bytes;
+    if(msgpack_pack_bin(&message->pk, size) != 0 ||
+        rbusMessage_StorageReserve(message, &message->sbuf, message->sbuf.size + size, false) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack buffer", __FUNCTION__);
+        return RT_FAIL;
+    }
+    rbusMessage_CopyFlat(item, start, message->sbuf.data + message->sbuf.size);
+    message->sbuf.size += size;
+    return RT_OK;
+}
+
+rtError rbusMessage_SetBytesRef(rbusMessage message, uint8_t const* bytes, uint32_t size)
+{
+    if(msgpack_pack_bin(&message->pk, size) != 0 || rbusMessage_AddSegment(message, bytes, size, NULL) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack buffer", __FUNCTION__);
+        return RT_FAIL;
+    }
+    return RT_OK;
+}
+
+rtError rbusMessage_AppendMessage(rbusMessage message, rbusMessage item)
+{
+    /*a borrowed item gets its own copy here, and segments are flattened so the bytes have a single stable owner*/
+    if(rbusMessage_Flatten(item) != 0)
+        return RT_FAIL;
+    rbusMessage_Retain(item);
+    if(msgpack_pack_bin(&message->pk, item->sbuf.size - rbusMessage_WireStart(item)) != 0 ||
+        rbusMessage_AddSegment(message, (uint8_t const*)item->sbuf.data + rbusMessage_WireStart(item),
+            item->sbuf.size - rbusMessage_WireStart(item), item) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack buffer", __FUNCTION__);
+        rbusMessage_Release(item);
+        return RT_FAIL;
+    }
+    return RT_OK;
+}
+
+rtError rbusMessage_ToIovec(rbusMessage message, struct iovec* iov, uint32_t capacity, uint32_t* count)
+{
+    size_t pos = rbusMessage_WireStart(message);
+    uint32_t n = 0;
+    uint32_t i;
+
+    /*each segment splits the sbuf, so at most 2 * segment_count + 1 pieces*/
+    for(i = 0; i < message->segment_count; ++i)
+    {
+        rbusMessageSegment const* seg = &message->segments[i];
+        n += (seg->offset > pos) + (seg->size > 0);
+        pos = seg->offset;
+    }
+    n += (message->sbuf.size > pos);
+    *count = n;
+    if(n > capacity)
+        return RT_FAIL;
+
+    pos = rbusMessage_WireStart(message);
+    n = 0;
+    for(i = 0; i < message->segment_count; ++i)
+    {
+        rbusMessageSegment const* seg = &message->segments[i];
+        if(seg->offset > pos)
+        {
+            iov[n].iov_base = message->sbuf.data + pos;
+            iov[n++].iov_len = seg->offset - pos;
+        }
+        if(seg->size > 0)
+        {
+            iov[n].iov_base = (void*)seg->data;
+            iov[n++].iov_len = seg->size;
+        }
+        pos = seg->offset;
+    }
+    if(message->sbuf.size > pos)
+    {
+        iov[n].iov_base = message->sbuf.data + pos;
+        iov[n++].iov_len = message->sbuf.size - pos;
+    }
+    return RT_OK;
+}
+
+rtError rbusMessage_GetMessage(rbusMessage const message, rbusMessage* value)
+{
+    struct _rbusMessage * view;
+    VERIFY_UNPACK(MSGPACK_OBJECT_BIN);
+    /*the nested message is a view into our buffer rather than a copy of it*/
+    view = rbusMessage_Create();
+    rbusMessage_SetForeignBuffer(view, (uint8_t const*)next.ptr, next.size);
+    rbusMessage_DetectWireVersion(view);
+    if(message->borrowed)
+    {
+        /*shares the transport buffer's lifetime, and copies on retain just like its parent*/
+        view->borrowed = true;
+    }
+    else
+    {
+        /*always hold the message that owns the buffer, so nested views don't form chains. That message keeps the buffer
+          until it is destroyed, even if it is written to and grows meanwhile.*/
+        if(!message->parent)
+            message->shared = true;
+        view->parent = message->parent ? message->parent : message;
+        rtRetainable_retain(view->parent);
+    }
+    *value = view;
+    return RT_OK;
+}
+
+/* Begin cursor.*/
+static rtError rbusMessage_GetMetaOffset(rbusMessage message, size_t* offset);
+static void rbusMessage_Swap32(void* dst, void const* src, uint32_t count);
+
+static int rbusMessage_ReserveFields(struct _rbusMessage* m, uint32_t count)
+{
+    uint32_t alloc = m->field_alloc ? m->field_alloc : 16;
+    uint32_t* index;
+
+    if(count <= m->field_alloc)
+        return 0;
+    while(alloc < count)
+        alloc = alloc > UINT32_MAX / 2 ? count : alloc * 2;
+    if((index = rt_try_realloc(m->field_index, (size_t)alloc * sizeof(uint32_t))) == NULL)
+    {
+        RBUSCORELOG_ERROR("%s failed to allocate %u entries", __FUNCTION__, alloc);
+        return -1;
+    }
+    m->field_index = index;
+    m->field_alloc = alloc;
+    return 0;
+}
+
+/*Index the fields from body_offset until 'stop' or 'end', whichever comes first.*/
+static int rbusMessage_WalkFields(struct _rbusMessage* m, size_t stop, size_t end)
+{
+    uint8_t const* data = (uint8_t const*)m->sbuf.data;
+    size_t offset = m->body_offset;
+
+    m->field_count = 0;
+    while(offset < end && offset != stop)
+    {
+        size_t n = rbusMessage_SkipItem(data + offset, data + end);
+        if(n == 0)
+        {
+            RBUSCORELOG_ERROR("%s malformed field at offset %lu", __FUNCTION__, (unsigned long)offset);
+            return -1;
+        }
+        if(rbusMessage_ReserveFields(m, m->field_count + 1) != 0)
+            return -1;
+        m->field_index[m->field_count++] = (uint32_t)(offset - m->body_offset);
+        offset += n;
+    }
+    m->fields_end = offset;
+    return 0;
+}
+
+/*Take the index from the meta section when the sender wrote one. Its offsets are only trusted if they are in order and
+  inside the body; a bad index is ignored and the fields are walked instead.*/
+static bool rbusMessage_LoadFieldIndex(struct _rbusMessage* m, size_t meta)
+{
+    uint8_t const* p = (uint8_t const*)m->sbuf.data + meta;
+    uint8_t const* end = (uint8_t const*)m->sbuf.data + m->sbuf.size - RBUS_MESSAGE_META_TRAILER_SIZE;
+    rbusMessageItem item;
+    size_t n;
+    uint32_t count, i;
+
+    while(p < end && (n = rbusMessage_Decode(p, end, &item)) != 0)
+    {
+        p += n;
+        if(item.type != MSGPACK_OBJECT_EXT || item.ext_type != RBUS_MESSAGE_EXT_FIELD_INDEX)
+            continue;
+        if(item.size % 4 != 0)
+            return false;
+        count = item.size / 4;
+        if(count == 0)
+        {
+            m->field_count = 0;
+            m->fields_end = m->body_offset;
+            return meta == m->body_offset;
+        }
+        if(rbusMessage_ReserveFields(m, count) != 0)
+            return false;
+        rbusMessage_Swap32(m->field_index, item.ptr, count);
+        if(m->field_index[0] != 0 || m->field_index[count - 1] >= meta - m->body_offset)
+            return false;
+        for(i = 1; i < count; i++)
+        {
+            if(m->field_index[i] <= m->field_index[i - 1])
+                return false;
+        }
+        m->field_count = count;
+        m->fields_end = meta;
+        return true;
+    }
+    return false;
+}
+
+static int rbusMessage_BuildIndex(struct _rbusMessage* m)
+{
+    size_t meta = SIZE_MAX;
+
+    if(m->field_index_valid)
+        return 0;
+    if(m->segment_count && rbusMessage_Flatten(m) != 0)
+        return -1;
+    if(rbusMessage_GetMetaOffset(m, &meta) != RT_OK)
+        meta = SIZE_MAX;
+
+    /*a trailer that isn't on a field boundary only looked like one, and belongs to the last field*/
+    if((meta == SIZE_MAX || !rbusMessage_LoadFieldIndex(m, meta)) &&
+        rbusMessage_WalkFields(m, meta, rbusMessage_BodyEnd(m)) != 0)
+        return -1;
+    m->field_index_valid = true;
+    return 0;
+}
+
+/*The number of the field at the read offset, or of the next one if the offset is not on a field.*/
+static uint32_t rbusMessage_CurrentField(struct _rbusMessage const* m)
+{
+    uint32_t lo = 0;
+    uint32_t hi = m->field_count;
+    size_t target;
+
+    if(m->read_offset >= m->fields_end)
+        return m->field_count;
+    target = m->read_offset > m->body_offset ? m->read_offset - m->body_offset : 0;
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(m->field_index[mid] < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void rbusMessage_SetField(struct _rbusMessage* m, uint32_t index)
+{
+    m->read_offset = index == m->field_count ? m->fields_end : m->body_offset + m->field_index[index];
+}
+
+rbusMessageFieldType rbusMessage_PeekType(rbusMessage const message)
+{
+    rbusMessageItem item;
+    uint8_t const* data;
+    size_t meta;
+
+    if(message->segment_count && rbusMessage_Flatten(message) != 0)
+        return RBUS_MESSAGE_FIELD_NONE;
+    if(message->field_index_valid ? message->read_offset >= message->fields_end :
+        rbusMessage_GetMetaOffset(message, &meta) == RT_OK && message->read_offset == meta)
+        return RBUS_MESSAGE_FIELD_NONE;
+    data = (uint8_t const*)message->sbuf.data;
+    if(message->read_offset >= rbusMessage_BodyEnd(message) ||
+        rbusMessage_Decode(data + message->read_offset, data + rbusMessage_BodyEnd(message), &item) == 0)
+        return RBUS_MESSAGE_FIELD_NONE;
+
+    switch(item.type)
+    {
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        return RBUS_MESSAGE_FIELD_INT;
+    case MSGPACK_OBJECT_FLOAT:
+        return RBUS_MESSAGE_FIELD_DOUBLE;
+    case MSGPACK_OBJECT_STR:
+        return RBUS_MESSAGE_FIELD_STRING;
+    case MSGPACK_OBJECT_BIN:
+        return RBUS_MESSAGE_FIELD_BYTES;
+    case MSGPACK_OBJECT_MAP:
+        return RBUS_MESSAGE_FIELD_MAP;
+    case MSGPACK_OBJECT_EXT:
+        switch(item.ext_type)
+        {
+        case RBUS_MESSAGE_EXT_INT32_ARRAY:
+            return RBUS_MESSAGE_FIELD_INT32_ARRAY;
+        case RBUS_MESSAGE_EXT_INT64_ARRAY:
+            return RBUS_MESSAGE_FIELD_INT64_ARRAY;
+        case RBUS_MESSAGE_EXT_DOUBLE_ARRAY:
+            return RBUS_MESSAGE_FIELD_DOUBLE_ARRAY;
+        case RBUS_MESSAGE_EXT_NAME:
+            return RBUS_MESSAGE_FIELD_STRING;
+        default:
+            return RBUS_MESSAGE_FIELD_UNKNOWN;
+        }
+    default:
+        return RBUS_MESSAGE_FIELD_UNKNOWN;
+    }
+}
+
+rtError rbusMessage_Skip(rbusMessage const message, uint32_t count)
+{
+    uint32_t current;
+
+    if(rbusMessage_BuildIndex(message) != 0)
+        return RT_FAIL;
+    current = rbusMessage_CurrentField(message);
+    if(count > message->field_count - current)
+    {
+        RBUSCORELOG_ERROR("%s cannot skip %u of the %u remaining fields", __FUNCTION__, count, message->field_count - current);
+        return RT_FAIL;
+    }
+    rbusMessage_SetField(message, current + count);
+    return RT_OK;
+}
+
+void rbusMessage_Rewind(rbusMessage const message)
+{
+    message->read_offset = message->body_offset;
+}
+
+rtError rbusMessage_Seek(rbusMessage const message, uint32_t index)
+{
+    if(rbusMessage_BuildIndex(message) != 0)
+        return RT_FAIL;
+    if(index > message->field_count)
+    {
+        RBUSCORELOG_ERROR("%s field %u is out of range, the message has %u", __FUNCTION__, index, message->field_count);
+        return RT_FAIL;
+    }
+    rbusMessage_SetField(message, index);
+    return RT_OK;
+}
+
+uint32_t rbusMessage_CountFields(rbusMessage const message)
+{
+    if(rbusMessage_BuildIndex(message) != 0)
+        return 0;
+    return message->field_count;
+}
+
+void rbusMessage_EnableFieldIndex(rbusMessage message, int enable)
+{
+    message->write_field_index = enable != 0;
+}
+
+/*Read field 'index' with GET and put the read position back where it was.*/
+#define GET_AT(GET)\
+    size_t saved_offset;\
+    rtError err;\
+    if(rbusMessage_BuildIndex(message) != 0)\
+        return RT_FAIL;\
+    if(index >= message->field_count)\
+    {\
+        RBUSCORELOG_ERROR("%s field %u is out of range, the message has %u", __FUNCTION__, index, message->field_count);\
+        return RT_FAIL;\
+    }\
+    saved_offset = message->read_offset;\
+    rbusMessage_SetField(message, index);\
+    err = GET;\
+    message->read_offset = saved_offset;\
+    return err;
+
+rtError rbusMessage_GetStringAt(rbusMessage const message, uint32_t index, char const** value)
+{
+    GET_AT(rbusMessage_GetString(message, value))
+}
+
+rtError rbusMessage_GetBytesAt(rbusMessage const message, uint32_t index, uint8_t const** value, uint32_t* size)
+{
+    GET_AT(rbusMessage_GetBytes(message, value, size))
+}
+
+rtError rbusMessage_GetInt32At(rbusMessage const message, uint32_t index, int32_t* value)
+{
+    GET_AT(rbusMessage_GetInt32(message, value))
+}
+
+rtError rbusMessage_GetInt64At(rbusMessage const message, uint32_t index, int64_t* value)
+{
+    GET_AT(rbusMessage_GetInt64(message, value))
+}
+
+rtError rbusMessage_GetDoubleAt(rbusMessage const message, uint32_t index, double* value)
+{
+    GET_AT(rbusMessage_GetDouble(message, value))
+}
+#undef GET_AT
+/* End cursor.*/
+
+/* Begin maps.
+  A map is one field: a msgpack map header written by rbusMessage_SetMap followed by its keys and values, each written
+  with the usual Set functions. Lookups hash the string keys of the map opened last, on first use.*/
+static uint32_t rbusMessage_HashBytes(char const* p, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    while(length--)
+    {
+        hash ^= (uint8_t)*p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+rtError rbusMessage_SetMap(rbusMessage message, uint32_t count)
+{
+    if(msgpack_pack_map(&message->pk, count) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack map header", __FUNCTION__);
+        return RT_FAIL;
+    }
+    return RT_OK;
+}
+
+rtError rbusMessage_GetMap(rbusMessage const message, uint32_t* count)
+{
+    size_t start = message->read_offset;
+    size_t n;
+
+    /*on failure the field is left unread, as with arrays*/
+    VERIFY_UNPACK_NEXT_ITEM()
+    if(next.type != MSGPACK_OBJECT_MAP)
+    {
+        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, next.type);
+        message->read_offset = start;
+        return RT_FAIL;
+    }
+    n = rbusMessage_SkipItem((uint8_t const*)message->sbuf.data + start, (uint8_t const*)message->sbuf.data + rbusMessage_BodyEnd(message));
+    if(n == 0)
+    {
+        RBUSCORELOG_ERROR("%s malformed map", __FUNCTION__);
+        message->read_offset = start;
+        return RT_FAIL;
+    }
+    /*reopening the same map keeps its hash*/
+    if(!message->map_open || message->map_offset != message->read_offset)
+        message->map_index_valid = false;
+    message->map_open = true;
+    message->map_offset = message->read_offset;
+    message->map_end = start + n;
+    message->map_count = next.size;
+    *count = next.size;
+    return RT_OK;
+}
+
+static int rbusMessage_BuildMapIndex(struct _rbusMessage* m)
+{
+    uint8_t const* data = (uint8_t const*)m->sbuf.data;
+    uint8_t const* end = data + m->map_end;
+    uint32_t slot_count = 8;
+    size_t offset = m->map_offset;
+    rbusMessageItem item;
+    uint32_t i;
+
+    while(slot_count < (uint64_t)m->map_count * 2)
+        slot_count *= 2;
+    if(slot_count > m->map_slot_alloc)
+    {
+        rbusMessageMapSlot* slots = rt_try_realloc(m->map_slots, (size_t)slot_count * sizeof(rbusMessageMapSlot));
+        if(!slots)
+        {
+            RBUSCORELOG_ERROR("%s failed to allocate %u slots", __FUNCTION__, slot_count);
+            return -1;
+        }
+        m->map_slots = slots;
+        m->map_slot_alloc = slot_count;
+    }
+    m->map_slot_count = slot_count;
+    memset(m->map_slots, 0, slot_count * sizeof(rbusMessageMapSlot));
+
+    /*GetMap checked the whole map, so every key and value decodes*/
+    for(i = 0; i < m->map_count; i++)
+    {
+        size_t n = rbusMessage_Decode(data + offset, end, &item);
+        char const* key = NULL;
+        uint32_t key_length = 0;
+
+        if(item.type == MSGPACK_OBJECT_STR)
+        {
+            /*rbusMessage_SetString writes the terminating NUL*/
+            key = item.ptr;
+            key_length = item.size && item.ptr[item.size - 1] == '\0' ? item.size - 1 : item.size;
+        }
+        else if(item.type == MSGPACK_OBJECT_EXT && item.ext_type == RBUS_MESSAGE_EXT_NAME)
+        {
+            /*the name table applies to keys too*/
+            if(rbusMessage_UnpackName(m, offset, &item, &key) != RT_OK)
+                return -1;
+            key_length = (uint32_t)strlen(key);
+        }
+        else
+        {
+            n = rbusMessage_SkipItem(data + offset, end); /*not a string, so it can't be looked up*/
+        }
+        offset += n;
+        if(key)
+        {
+            uint32_t hash = rbusMessage_HashBytes(key, key_length);
+            uint32_t slot = hash & (slot_count - 1);
+            rbusMessageMapSlot* s;
+
+            /*the first of duplicate keys wins, as in a linear search*/
+            while((s = &m->map_slots[slot])->key &&
+                !(s->hash == hash && s->key_length == key_length && memcmp(s->key, key, key_length) == 0))
+                slot = (slot + 1) & (slot_count - 1);
+            if(!s->key)
+            {
+                s->key = key;
+                s->key_length = key_length;
+                s->hash = hash;
+                s->value = offset;
+            }
+        }
+        offset += rbusMessage_SkipItem(data + offset, end);
+    }
+    m->map_index_valid = true;
+    return 0;
+}
+
+rtError rbusMessage_GetMapValue(rbusMessage const message, char const* key)
+{
+    size_t length = strlen(key);
+    uint32_t hash = rbusMessage_HashBytes(key, length);
+    uint32_t slot;
+    rbusMessageMapSlot const* s;
+
+    if(!message->map_open)
+    {
+        RBUSCORELOG_ERROR("%s no map is open", __FUNCTION__);
+        return RT_FAIL;
+    }
+    if(!message->map_index_valid && rbusMessage_BuildMapIndex(message) != 0)
+        return RT_FAIL;
+    for(slot = hash & (message->map_slot_count - 1); (s = &message->map_slots[slot])->key; slot = (slot + 1) & (message->map_slot_count - 1))
+    {
+        if(s->hash == hash && s->key_length == length && memcmp(s->key, key, length) == 0)
+        {
+            message->read_offset = s->value;
+            return RT_OK;
+        }
+    }
+    return RT_FAIL;
+}
+
+void rbusMessage_EndMapRead(rbusMessage const message)
+{
+    if(message->map_open)
+        message->read_offset = message->map_end;
+}
+/* End maps.*/
+
+/* Begin numeric arrays.*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RBUS_MESSAGE_HOST_BIG_ENDIAN 1
+#endif
+
+/*Copy 'count' 4-byte elements from src to dst, converting between host and network byte order.*/
+static void rbusMessage_Swap32(void* dst, void const* src, uint32_t count)
+{
+#ifdef RBUS_MESSAGE_HOST_BIG_ENDIAN
+    memcpy(dst, src, (size_t)count * 4);
+#else
+    uint8_t* d = (uint8_t*)dst;
+    uint8_t const* s = (uint8_t const*)src;
+    uint32_t i = 0;
+    uint32_t v;
+#if defined(__SSSE3__)
+    __m128i const mask = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    for(; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(d + i * 4), _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + i * 4)), mask));
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= count; i += 4)
+        vst1q_u8(d + i * 4, vrev32q_u8(vld1q_u8(s + i * 4)));
+#endif
+    for(; i < count; ++i)
+    {
+        memcpy(&v, s + i * 4, 4);
+        v = __builtin_bswap32(v);
+        memcpy(d + i * 4, &v, 4);
+    }
+#endif
+}
+
+/*Copy 'count' 8-byte elements from src to dst, converting between host and network byte order.*/
+static void rbusMessage_Swap64(void* dst, void const* src, uint32_t count)
+{
+#ifdef RBUS_MESSAGE_HOST_BIG_ENDIAN
+    memcpy(dst, src, (size_t)count * 8);
+#else
+    uint8_t* d = (uint8_t*)dst;
+    uint8_t const* s = (uint8_t const*)src;
+    uint32_t i = 0;
+    uint64_t v;
+#if defined(__SSSE3__)
+    __m128i const mask = _mm_set_epi8(8,9,10,11,12,13,14,15, 0,1,2,3,4,5,6,7);
+    for(; i + 2 <= count; i += 2)
+        _mm_storeu_si128((__m128i*)(d + i * 8), _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + i * 8)), mask));
+#elif defined(__ARM_NEON)
+    for(; i + 2 <= count; i += 2)
+        vst1q_u8(d + i * 8, vrev64q_u8(vld1q_u8(s + i * 8)));
+#endif
+    for(; i < count; ++i)
+    {
+        memcpy(&v, s + i * 8, 8);
+        v = __builtin_bswap64(v);
+        memcpy(d + i * 8, &v, 8);
+    }
+#endif
+}
+
+static rtError rbusMessage_SetArray(rbusMessage message, int8_t type, void const* values, uint32_t count, uint32_t width)
+{
+    size_t length = (size_t)count * width;
+
+    if(length > UINT32_MAX)
+    {
+        RBUSCORELOG_ERROR("%s array of %u elements is too large", __FUNCTION__, count);
+        return RT_FAIL;
+    }
+    if(msgpack_pack_ext(&message->pk, length, type) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack array header", __FUNCTION__);
+        return RT_FAIL;
+    }
+    /*the header write above already detached a foreign buffer, so the body is swapped straight into our storage*/
+    if(rbusMessage_StorageReserve(message, &message->sbuf, message->sbuf.size + length, false) != 0)
+    {
+        RBUSCORELOG_ERROR("%s failed pack array body", __FUNCTION__);
+        return RT_FAIL;
+    }
+    if(width == 4)
+        rbusMessage_Swap32(message->sbuf.data + message->sbuf.size, values, count);
+    else
+        rbusMessage_Swap64(message->sbuf.data + message->sbuf.size, values, count);
+    message->sbuf.size += length;
+    return RT_OK;
+}
+
+/*On any failure the field is left unread, so the caller can retry with a larger array.*/
+static rtError rbusMessage_GetArray(rbusMessage message, int8_t type, void* values, uint32_t capacity, uint32_t* count, uint32_t width)
+{
+    size_t saved_offset = message->read_offset;
+    uint32_t n;
+
+    VERIFY_UNPACK_NEXT_ITEM()
+    if(next.type != MSGPACK_OBJECT_EXT || next.ext_type != type || next.size % width != 0)
+    {
+        RBUSCORELOG_ERROR("%s unexpected date type %d", __FUNCTION__, next.type);
+        message->read_offset = saved_offset;
+        return RT_FAIL;
+    }
+    n = next.size / width;
+    *count = n;
+    if(n > capacity)
+    {
+        RBUSCORELOG_ERROR("%s array of %u elements does not fit in %u", __FUNCTION__, n, capacity);
+        message->read_offset = saved_offset;
+        return RT_FAIL;
+    }
+    if(width == 4)
+        rbusMessage_Swap32(values, next.ptr, n);
+    else
+        rbusMessage_Swap64(values, next.ptr, n);
+    return RT_OK;
+}
+
+rtError rbusMessage_SetInt32Array(rbusMessage message, int32_t const* values, uint32_t count)
+{
+    return rbusMessage_SetArray(message, RBUS_MESSAGE_EXT_INT32_ARRAY, values, count, sizeof(int32_t));
+}
+
+rtError rbusMessage_GetInt32Array(rbusMessage const message, int32_t* values, uint32_t capacity, uint32_t* count)
+{
+    return rbusMessage_GetArray(message, RBUS_MESSAGE_EXT_INT32_ARRAY, values, capacity, count, sizeof(int32_t));
+}
+
+rtError rbusMessage_SetInt64Array(rbusMessage message, int64_t const* values, uint32_t count)
+{
+    return rbusMessage_SetArray(message, RBUS_MESSAGE_EXT_INT64_ARRAY, values, count, sizeof(int64_t));
+}
+
+rtError rbusMessage_GetInt64Array(rbusMessage const message, int64_t* values, uint32_t capacity, uint32_t* count)
+{
+    return rbusMessage_GetArray(message, RBUS_MESSAGE_EXT_INT64_ARRAY, values, capacity, count, sizeof(int64_t));
+}
+
+rtError rbusMessage_SetDoubleArray(rbusMessage message, double const* values, uint32_t count)
+{
+    return rbusMessage_SetArray(message, RBUS_MESSAGE_EXT_DOUBLE_ARRAY, values, count, sizeof(double));
+}
+
+rtError rbusMessage_GetDoubleArray(rbusMessage const message, double* values, uint32_t capacity, uint32_t* count)
+{
+    return rbusMessage_GetArray(message, RBUS_MESSAGE_EXT_DOUBLE_ARRAY, values, capacity, count, sizeof(double));
+}
+/* End numeric arrays.*/
+
+/* Begin JSON.
+  ToJson batches its output in a buffer on the stack and passes it to the writer in pieces, so it allocates nothing beyond
+  the names rebuilt from the name table. FromJson packs strings straight from the input unless they have escapes.*/
+#define RBUS_MESSAGE_JSON_CHUNK 1024
+#define RBUS_MESSAGE_JSON_MAX_DEPTH 64
+
+static char const rbusMessage_Base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+typedef struct
+{
+    rbusMessageJsonWriter writer;
+    void* user_data;
+    bool failed;
+    uint32_t size;
+    char buf[RBUS_MESSAGE_JSON_CHUNK];
+} rbusMessageJsonOut;
+
+static void rbusMessageJson_Flush(rbusMessageJsonOut* out)
+{
+    if(out->size && !out->failed && out->writer(out->user_data, out->buf, out->size) != 0)
+        out->failed = true;
+    out->size = 0;
+}
+
+static void rbusMessageJson_Put(rbusMessageJsonOut* out, char const* data, size_t length)
+{
+    /*large runs, such as long strings, go to the writer without the copy*/
+    if(length >= RBUS_MESSAGE_JSON_CHUNK)
+    {
+        rbusMessageJson_Flush(out);
+        while(length && !out->failed)
+        {
+            uint32_t n = length > UINT32_MAX ? UINT32_MAX : (uint32_t)length;
+            if(out->writer(out->user_data, data, n) != 0)
+                out->failed = true;
+            data += n;
+            length -= n;
+        }
+        return;
+    }
+    if(length > RBUS_MESSAGE_JSON_CHUNK - out->size)
+        rbusMessageJson_Flush(out);
+    memcpy(out->buf + out->size, data, length);
+    out->size += length;
+}
+
+static inline void rbusMessageJson_PutChar(rbusMessageJsonOut* out, char c)
+{
+    if(out->size == RBUS_MESSAGE_JSON_CHUNK)
+        rbusMessageJson_Flush(out);
+    out->buf[out->size++] = c;
+}
+
+static void rbusMessageJson_PutString(rbusMessageJsonOut* out, char const* s, size_t length)
+{
+    size_t run = 0;
+    size_t i;
+
+    rbusMessageJson_PutChar(out, '"');
+    for(i = 0; i < length; ++i)
+    {
+        uint8_t c = (uint8_t)s[i];
+        char escape[8];
+
+        if(c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        rbusMessageJson_Put(out, s + run, i - run);
+        run = i + 1;
+        escape[0] = '\\';
+        switch(c)
+        {
+        case '"': escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        default:
+            snprintf(escape + 1, sizeof(escape) - 1, "u%04x", c);
+            rbusMessageJson_Put(out, escape, 6);
+            continue;
+        }
+        rbusMessageJson_Put(out, escape, 2);
+    }
+    rbusMessageJson_Put(out, s + run, length - run);
+    rbusMessageJson_PutChar(out, '"');
+}
+
+static void rbusMessageJson_PutBase64(rbusMessageJsonOut* out, uint8_t const* p, uint32_t size)
+{
+    uint32_t i = 0;
+
+    rbusMessageJson_PutChar(out, '"');
+    for(; i + 3 <= size; i += 3)
+    {
+        uint32_t v = ((uint32_t)p[i] << 16) | ((uint32_t)p[i + 1] << 8) | p[i + 2];
+        if(RBUS_MESSAGE_JSON_CHUNK - out->size < 4)
+            rbusMessageJson_Flush(out);
+        out->buf[out->size++] = rbusMessage_Base64[v >> 18];
+        out->buf[out->size++] = rbusMessage_Base64[(v >> 12) & 0x3f];
+        out->buf[out->size++] = rbusMessage_Base64[(v >> 6) & 0x3f];
+        out->buf[out->size++] = rbusMessage_Base64[v & 0x3f];
+    }
+    if(i < size)
+    {
+        uint32_t v = (uint32_t)p[i] << 16 | (i + 1 < size ? (uint32_t)p[i + 1] << 8 : 0);
+        char tail[4];
+        tail[0] = rbusMessage_Base64[v >> 18];
+        tail[1] = rbusMessage_Base64[(v >> 12) & 0x3f];
+        tail[2] = i + 1 < size ? rbusMessage_Base64[(v >> 6) & 0x3f] : '=';
+        tail[3] = '=';
+        rbusMessageJson_Put(out, tail, 4);
+    }
+    rbusMessageJson_PutChar(out, '"');
+}
+
+static void rbusMessageJson_PutDouble(rbusMessageJsonOut* out, double value)
+{
+    char buf[32];
+    int i;
+    int n = 0;
+
+    if(!isfinite(value))
+    {
+        rbusMessageJson_Put(out, "null", 4);
+        return;
+    }
+    /*17 digits round-trip any double. snprintf writes the radix character of LC_NUMERIC, which can be ',' or more than
+      one byte, and it is the only thing in the output that isn't a digit, a sign or the 'e', so it becomes '.'*/
+    snprintf(buf, sizeof(buf) - 2, "%.17g", value);
+    for(i = 0; buf[i]; ++i)
+    {
+        char c = buf[i];
+        if((c >= '0' && c <= '9') || c == '-' || c == '+' || c == 'e')
+            buf[n++] = c;
+        else if(n == 0 || buf[n - 1] != '.')
+            buf[n++] = '.';
+    }
+    /*the '.' keeps it a double when parsed back*/
+    if(!memchr(buf, '.', n) && !memchr(buf, 'e', n))
+    {
+        buf[n++] = '.';
+        buf[n++] = '0';
+    }
+    rbusMessageJson_Put(out, buf, n);
+}
+
+static int rbusMessageJson_PutItem(struct _rbusMessage* m, rbusMessageJsonOut* out, size_t* offset, size_t end, int depth)
+{
+    uint8_t const* data = (uint8_t const*)m->sbuf.data;
+    size_t field = *offset;
+    rbusMessageItem item;
+    char buf[32];
+    char const* name;
+    size_t n;
+    uint32_t i;
+
+    if(depth > RBUS_MESSAGE_JSON_MAX_DEPTH || (n = rbusMessage_Decode(data + field, data + end, &item)) == 0)
+        return -1;
+    *offset += n;
+    switch(item.type)
+    {
+    case MSGPACK_OBJECT_STR:
+        /*rbusMessage_SetString includes the terminator*/
+        rbusMessageJson_PutString(out, item.ptr, item.size && item.ptr[item.size - 1] == '\0' ? item.size - 1 : item.size);
+        return 0;
+    case MSGPACK_OBJECT_BIN:
+        rbusMessageJson_Put(out, "{\"$bin\":", 8);
+        rbusMessageJson_PutBase64(out, (uint8_t const*)item.ptr, item.size);
+        rbusMessageJson_PutChar(out, '}');
+        return 0;
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        /*above INT64_MAX the value only fits unsigned*/
+        if(item.via.i64 < 0)
+            n = snprintf(buf, sizeof(buf), "%" PRIu64, (uint64_t)item.via.i64);
+        else
+            n = snprintf(buf, sizeof(buf), "%" PRId64, item.via.i64);
+        rbusMessageJson_Put(out, buf, n);
+        return 0;
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        n = snprintf(buf, sizeof(buf), "%" PRId64, item.via.i64);
+        rbusMessageJson_Put(out, buf, n);
+        return 0;
+    case MSGPACK_OBJECT_FLOAT:
+        rbusMessageJson_PutDouble(out, item.via.f64);
+        return 0;
+    case MSGPACK_OBJECT_NIL:
+        rbusMessageJson_Put(out, "null", 4);
+        return 0;
+    case MSGPACK_OBJECT_BOOLEAN:
+        if(item.via.i64)
+            rbusMessageJson_Put(out, "true", 4);
+        else
+            rbusMessageJson_Put(out, "false", 5);
+        return 0;
+    case MSGPACK_OBJECT_ARRAY:
+        rbusMessageJson_PutChar(out, '[');
+        for(i = 0; i < item.size; ++i)
+        {
+            if(i)
+                rbusMessageJson_PutChar(out, ',');
+            if(rbusMessageJson_PutItem(m, out, offset, end, depth + 1) != 0)
+                return -1;
+        }
+        rbusMessageJson_PutChar(out, ']');
+        return 0;
+    case MSGPACK_OBJECT_MAP:
+        rbusMessageJson_PutChar(out, '{');
+        for(i = 0; i < item.size; ++i)
+        {
+            rbusMessageItem key;
+            if(i)
+                rbusMessageJson_PutChar(out, ',');
+            /*JSON keys are strings, so only string keys can be written*/
+            if(rbusMessage_Decode(data + *offset, data + end, &key) == 0 ||
+                (key.type != MSGPACK_OBJECT_STR && (key.type != MSGPACK_OBJECT_EXT || key.ext_type != RBUS_MESSAGE_EXT_NAME)) ||
+                rbusMessageJson_PutItem(m, out, offset, end, depth + 1) != 0)
+                return -1;
+            rbusMessageJson_PutChar(out, ':');
+            if(rbusMessageJson_PutItem(m, out, offset, end, depth + 1) != 0)
+                return -1;
+        }
+        rbusMessageJson_PutChar(out, '}');
+        return 0;
+    case MSGPACK_OBJECT_EXT:
+        switch(item.ext_type)
+        {
+        case RBUS_MESSAGE_EXT_NAME:
+            if(rbusMessage_UnpackName(m, field, &item, &name) != RT_OK)
+                return -1;
+            rbusMessageJson_PutString(out, name, strlen(name));
+            return 0;
+        case RBUS_MESSAGE_EXT_INT32_ARRAY:
+            rbusMessageJson_Put(out, "{\"$int32\":[", 11);
+            for(i = 0; i + 4 <= item.size; i += 4)
+            {
+                if(i)
+                    rbusMessageJson_PutChar(out, ',');
+                n = snprintf(buf, sizeof(buf), "%" PRId32, (int32_t)rbusMessage_Load32((uint8_t const*)item.ptr + i));
+                rbusMessageJson_Put(out, buf, n);
+            }
+            rbusMessageJson_Put(out, "]}", 2);
+            return item.size % 4 ? -1 : 0;
+        case RBUS_MESSAGE_EXT_INT64_ARRAY:
+        case RBUS_MESSAGE_EXT_DOUBLE_ARRAY:
+            if(item.ext_type == RBUS_MESSAGE_EXT_INT64_ARRAY)
+                rbusMessageJson_Put(out, "{\"$int64\":[", 11);
+            else
+                rbusMessageJson_Put(out, "{\"$double\":[", 12);
+            for(i = 0; i + 8 <= item.size; i += 8)
+            {
+                uint64_t bits = rbusMessage_Load64((uint8_t const*)item.ptr + i);
+                double d;
+                if(i)
+                    rbusMessageJson_PutChar(out, ',');
+                if(item.ext_type == RBUS_MESSAGE_EXT_INT64_ARRAY)
+                {
+                    n = snprintf(buf, sizeof(buf), "%" PRId64, (int64_t)bits);
+                    rbusMessageJson_Put(out, buf, n);
+                }
+                else
+                {
+                    memcpy(&d, &bits, sizeof(d));
+                    rbusMessageJson_PutDouble(out, d);
+                }
+            }
+            rbusMessageJson_Put(out, "]}", 2);
+            return item.size % 8 ? -1 : 0;
+        default:
+            return -1;
+        }
+    default:
+        return -1;
+    }
+}
+
+rtError rbusMessage_ToJson(rbusMessage const message, rbusMessageJsonWriter writer, void* user_data)
+{
+    rbusMessageJsonOut out;
+    uint32_t i;
+
+    if(rbusMessage_BuildIndex(message) != 0)
+        return RT_FAIL;
+    out.writer = writer;
+    out.user_data = user_data;
+    out.failed = false;
+    out.size = 0;
+    rbusMessageJson_PutChar(&out, '[');
+    for(i = 0; i < message->field_count && !out.failed; ++i)
+    {
+        size_t offset = message->body_offset + message->field_index[i];
+        if(i)
+            rbusMessageJson_PutChar(&out, ',');
+        if(rbusMessageJson_PutItem(message, &out, &offset, message->fields_end, 0) != 0)
+        {
+            RBUSCORELOG_ERROR("%s field %u has no JSON form", __FUNCTION__, i);
+            return RT_FAIL;
+        }
+    }
+    rbusMessageJson_PutChar(&out, ']');
+    rbusMessageJson_Flush(&out);
+    return out.failed ? RT_FAIL : RT_OK;
+}
+
+typedef struct
+{
+    char* data;
+    size_t size;
+    size_t alloc;
+} rbusMessageJsonString;
+
+static int rbusMessageJson_Append(void* user_data, char const* data, uint32_t length)
+{
+    rbusMessageJsonString* s = (rbusMessageJsonString*)user_data;
+
+    if(s->alloc - s->size <= length)
+    {
+        size_t alloc = s->alloc ? s->alloc : 256;
+        char* p;
+        while(alloc - s->size <= length)
+            alloc *= 2;
+        if((p = rt_try_realloc(s->data, alloc)) == NULL)
+            return -1;
+        s->data = p;
+        s->alloc = alloc;
+    }
+    memcpy(s->data + s->size, data, length);
+    s->size += length;
+    return 0;
+}
+
+rtError rbusMessage_ToJsonString(rbusMessage const message, char** s, uint32_t* n)
+{
+    rbusMessageJsonString json = { NULL, 0, 0 };
+
+    *s = NULL;
+    *n = 0;
+    if(rbusMessage_ToJson(message, rbusMessageJson_Append, &json) != RT_OK || json.size > UINT32_MAX - 1)
+    {
+        rt_free(json.data);
+        return RT_FAIL;
+    }
+    json.data[json.size] = '\0';
+    *s = json.data;
+    *n = (uint32_t)json.size;
+    return RT_OK;
+}
+
+typedef struct
+{
+    char const* p;
+    char const* end;
+    struct _rbusMessage* m;
+    char* text; /*strings with escapes, unescaped*/
+    size_t text_alloc;
+    uint8_t* values; /*decoded bytes and array elements*/
+    size_t values_alloc;
+} rbusMessageJsonIn;
+
+static int rbusMessageJson_Grow(void** buf, size_t* alloc, size_t size)
+{
+    size_t n = *alloc ? *alloc : 256;
+    void* p;
+
+    if(size <= *alloc)
+        return 0;
+    while(n < size)
+        n *= 2;
+    if((p = rt_try_realloc(*buf, n)) == NULL)
+        return -1;
+    *buf = p;
+    *alloc = n;
+    return 0;
+}
+
+static inline void rbusMessageJson_SkipSpace(rbusMessageJsonIn* in)
+{
+    while(in->p < in->end && (*in->p == ' ' || *in->p == '\n' || *in->p == '\r' || *in->p == '\t'))
+        in->p++;
+}
+
+static bool rbusMessageJson_Expect(rbusMessageJsonIn* in, char c)
+{
+    rbusMessageJson_SkipSpace(in);
+    if(in->p == in->end || *in->p != c)
+        return false;
+    in->p++;
+    return true;
+}
+
+static int rbusMessageJson_Hex(char const* p, uint32_t* v)
+{
+    int i;
+
+    *v = 0;
+    for(i = 0; i < 4; ++i)
+    {
+        char c = p[i];
+        *v <<= 4;
+        if(c >= '0' && c <= '9')
+            *v |= c - '0';
+        else if(c >= 'a' && c <= 'f')
+            *v |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')
+            *v |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+/*Parses the string at the current position. '*s' points into the input when there are no escapes, else into in->text.*/
+static int rbusMessageJson_ParseString(rbusMessageJsonIn* in, char const** s, size_t* length)
+{
+    char const* start;
+    char const* p;
+    size_t n = 0;
+
+    if(!rbusMessageJson_Expect(in, '"'))
+        return -1;
+    start = in->p;
+    for(p = start; p < in->end && *p != '"' && *p != '\\'; ++p)
+        ;
+    if(p == in->end)
+        return -1;
+    if(*p == '"')
+    {
+        *s = start;
+        *length = p - start;
+        in->p = p + 1;
+        return 0;
+    }
+
+    /*unescaping never makes a string longer*/
+    if(rbusMessageJson_Grow((void**)&in->text, &in->text_alloc, in->end - start) != 0)
+        return -1;
+    memcpy(in->text, start, p - start);
+    n = p - start;
+    while(p < in->end && *p != '"')
+    {
+        uint32_t c;
+        if(*p != '\\')
+        {
+            in->text[n++] = *p++;
+            continue;
+        }
+        if(++p == in->end)
+            return -1;
+        switch(*p++)
+        {
+        case '"': in->text[n++] = '"'; break;
+        case '\\': in->text[n++] = '\\'; break;
+        case '/': in->text[n++] = '/'; break;
+        case 'n': in->text[n++] = '\n'; break;
+        case 'r': in->text[n++] = '\r'; break;
+        case 't': in->text[n++] = '\t'; break;
+        case 'b': in->text[n++] = '\b'; break;
+        case 'f': in->text[n++] = '\f'; break;
+        case 'u':
+            if(in->end - p < 4 || rbusMessageJson_Hex(p, &c) != 0)
+                return -1;
+            p += 4;
+            /*a surrogate pair is one code point*/
+            if(c >= 0xd800 && c < 0xdc00)
+            {
+                uint32_t low;
+                if(in->end - p < 6 || p[0] != '\\' || p[1] != 'u' || rbusMessageJson_Hex(p + 2, &low) != 0 ||
+                    low < 0xdc00 || low >= 0xe000)
+                    return -1;
+                p += 6;
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+            }
+            /*as UTF-8, which takes no more than the 6 or 12 bytes of its escape*/
+            if(c < 0x80)
+                in->text[n++] = (char)c;
+            else if(c < 0x800)
+            {
+                in->text[n++] = (char)(0xc0 | (c >> 6));
+                in->text[n++] = (char)(0x80 | (c & 0x3f));
+            }
+            else if(c < 0x10000)
+            {
+                in->text[n++] = (char)(0xe0 | (c >> 12));
+                in->text[n++] = (char)(0x80 | ((c >> 6) & 0x3f));
+                in->text[n++] = (char)(0x80 | (c & 0x3f));
+            }
+            else
+            {
+                in->text[n++] = (char)(0xf0 | (c >> 18));
+                in->text[n++] = (char)(0x80 | ((c >> 12) & 0x3f));
+                in->text[n++] = (char)(0x80 | ((c >> 6) & 0x3f));
+                in->text[n++] = (char)(0x80 | (c & 0x3f));
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+    if(p == in->end)
+        return -1;
+    in->p = p + 1;
+    *s = in->text;
+    *length = n;
+    return 0;
+}
+
+/*Strings are packed the way rbusMessage_SetString packs them, terminator included.*/
+static int rbusMessageJson_PackString(rbusMessageJsonIn* in, char const* s, size_t length)
+{
+    if(length >= UINT32_MAX ||
+        msgpack_pack_str(&in->m->pk, length + 1) != 0 ||
+        msgpack_pack_str_body(&in->m->pk, s, length) != 0 ||
+        msgpack_pack_str_body(&in->m->pk, "", 1) != 0)
+        return -1;
+    return 0;
+}
+
+typedef enum
+{
+    RBUS_MESSAGE_JSON_INTEGER,
+    RBUS_MESSAGE_JSON_UNSIGNED, /*above INT64_MAX*/
+    RBUS_MESSAGE_JSON_DOUBLE
+} rbusMessageJsonNumberType;
+
+static int rbusMessageJson_ParseNumber(rbusMessageJsonIn* in, rbusMessageJsonNumberType* type, int64_t* i64, uint64_t* u64, double* f64)
+{
+    char buf[64];
+    char* end;
+    char const* p;
+    char const* q;
+    char const* radix = ".";
+    size_t radix_length = 1;
+    size_t n = 0;
+    bool integer = true;
+
+    /*-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?*/
+    rbusMessageJson_SkipSpace(in);
+    p = in->p;
+    if(p < in->end && *p == '-')
+        ++p;
+    if(p == in->end || *p < '0' || *p > '9')
+        return -1;
+    if(*p++ == '0' && p < in->end && *p >= '0' && *p <= '9')
+        return -1;
+    while(p < in->end && *p >= '0' && *p <= '9')
+        ++p;
+    if(p < in->end && *p == '.')
+    {
+        ++p;
+        integer = false;
+        if(p == in->end || *p < '0' || *p > '9')
+            return -1;
+        while(p < in->end && *p >= '0' && *p <= '9')
+            ++p;
+    }
+    if(p < in->end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        integer = false;
+        if(p < in->end && (*p == '+' || *p == '-'))
+            ++p;
+        if(p == in->end || *p < '0' || *p > '9')
+            return -1;
+        while(p < in->end && *p >= '0' && *p <= '9')
+            ++p;
+    }
+    /*strtod wants the radix character of LC_NUMERIC in place of the '.'*/
+    if(!integer)
+    {
+        struct lconv const* lc = localeconv();
+        if(lc->decimal_point && *lc->decimal_point)
+        {
+            radix = lc->decimal_point;
+            radix_length = strlen(radix);
+        }
+    }
+    for(q = in->p; q < p; ++q)
+    {
+        if(*q == '.')
+        {
+            if(n + radix_length >= sizeof(buf))
+                return -1;
+            memcpy(buf + n, radix, radix_length);
+            n += radix_length;
+        }
+        else
+        {
+            if(n + 1 >= sizeof(buf))
+                return -1;
+            buf[n++] = *q;
+        }
+    }
+    buf[n] = '\0';
+    errno = 0;
+    if(!integer)
+    {
+        *type = RBUS_MESSAGE_JSON_DOUBLE;
+        *f64 = strtod(buf, &end);
+    }
+    else if(buf[0] == '-')
+    {
+        *type = RBUS_MESSAGE_JSON_INTEGER;
+        *i64 = strtoll(buf, &end, 10);
+    }
+    else
+    {
+        *u64 = strtoull(buf, &end, 10);
+        *type = *u64 > INT64_MAX ? RBUS_MESSAGE_JSON_UNSIGNED : RBUS_MESSAGE_JSON_INTEGER;
+        *i64 = (int64_t)*u64;
+    }
+    if(end != buf + n || errno == ERANGE)
+        return -1;
+    in->p = p;
+    return 0;
+}
+
+static int rbusMessageJson_ParseBase64(rbusMessageJsonIn* in, uint32_t* size)
+{
+    char const* s;
+    size_t length;
+    size_t i;
+    uint32_t n = 0;
+    uint32_t bits = 0;
+    int count = 0;
+
+    if(rbusMessageJson_ParseString(in, &s, &length) != 0 ||
+        rbusMessageJson_Grow((void**)&in->values, &in->values_alloc, length / 4 * 3 + 3) != 0)
+        return -1;
+    for(i = 0; i < length && s[i] != '='; ++i)
+    {
+        char c = s[i];
+        uint32_t v;
+        if(c >= 'A' && c <= 'Z')
+            v = c - 'A';
+        else if(c >= 'a' && c <= 'z')
+            v = c - 'a' + 26;
+        else if(c >= '0' && c <= '9')
+            v = c - '0' + 52;
+        else if(c == '+')
+            v = 62;
+        else if(c == '/')
+            v = 63;
+        else
+            return -1;
+        bits = (bits << 6) | v;
+        if(++count == 4)
+        {
+            in->values[n++] = (uint8_t)(bits >> 16);
+            in->values[n++] = (uint8_t)(bits >> 8);
+            in->values[n++] = (uint8_t)bits;
+            bits = 0;
+            count = 0;
+        }
+    }
+    if(count == 1)
+        return -1;
+    if(count == 2)
+        in->values[n++] = (uint8_t)(bits >> 4);
+    else if(count == 3)
+    {
+        in->values[n++] = (uint8_t)(bits >> 10);
+        in->values[n++] = (uint8_t)(bits >> 2);
+    }
+    for(; i < length; ++i)
+    {
+        if(s[i] != '=')
+            return -1;
+    }
+    *size = n;
+    return 0;
+}
+
+/*The elements of a "$int32", "$int64" or "$double" array, stored in in->values.*/
+static int rbusMessageJson_ParseArray(rbusMessageJsonIn* in, int8_t type, uint32_t* count)
+{
+    uint32_t width = type == RBUS_MESSAGE_EXT_INT32_ARRAY ? 4 : 8;
+    uint32_t n = 0;
+
+    if(!rbusMessageJson_Expect(in, '['))
+        return -1;
+    if(rbusMessageJson_Expect(in, ']'))
+    {
+        *count = 0;
+        return 0;
+    }
+    do
+    {
+        rbusMessageJsonNumberType number;
+        int64_t i64 = 0;
+        uint64_t u64 = 0;
+        double f64 = 0;
+
+        if(rbusMessageJson_Grow((void**)&in->values, &in->values_alloc, (size_t)(n + 1) * width) != 0)
+            return -1;
+        rbusMessageJson_SkipSpace(in);
+        if(type == RBUS_MESSAGE_EXT_DOUBLE_ARRAY && in->end - in->p >= 4 && memcmp(in->p, "null", 4) == 0)
+        {
+            in->p += 4;
+            f64 = NAN;
+        }
+        else if(rbusMessageJson_ParseNumber(in, &number, &i64, &u64, &f64) != 0)
+            return -1;
+        else if(type == RBUS_MESSAGE_EXT_DOUBLE_ARRAY)
+        {
+            if(number != RBUS_MESSAGE_JSON_DOUBLE)
+                f64 = number == RBUS_MESSAGE_JSON_UNSIGNED ? (double)u64 : (double)i64;
+        }
+        else if(number != RBUS_MESSAGE_JSON_INTEGER || (type == RBUS_MESSAGE_EXT_INT32_ARRAY && (i64 < INT32_MIN || i64 > INT32_MAX)))
+            return -1;
+
+        if(type == RBUS_MESSAGE_EXT_INT32_ARRAY)
+        {
+            int32_t v = (int32_t)i64;
+            memcpy(in->values + (size_t)n * 4, &v, 4);
+        }
+        else if(type == RBUS_MESSAGE_EXT_INT64_ARRAY)
+            memcpy(in->values + (size_t)n * 8, &i64, 8);
+        else
+            memcpy(in->values + (size_t)n * 8, &f64, 8);
+        if(++n == UINT32_MAX / 8)
+            return -1;
+    } while(rbusMessageJson_Expect(in, ','));
+    if(!rbusMessageJson_Expect(in, ']'))
+        return -1;
+    *count = n;
+    return 0;
+}
+
+/*Maps and arrays get 32-bit headers, so the count can be filled in once the elements have been packed.*/
+static int rbusMessageJson_BeginContainer(rbusMessageJsonIn* in, uint8_t tag, size_t* header)
+{
+    uint8_t bytes[5] = { tag, 0, 0, 0, 0 };
+
+    *header = in->m->sbuf.size;
+    return rbusMessage_Write(in->m, (char const*)bytes, sizeof(bytes));
+}
+
+static int rbusMessageJson_ParseValue(rbusMessageJsonIn* in, int depth);
+
+static int rbusMessageJson_ParseObject(rbusMessageJsonIn* in, int depth)
+{
+    char const* key;
+    size_t length;
+    size_t header;
+    uint32_t count = 0;
+
+    if(rbusMessageJson_Expect(in, '}'))
+        return msgpack_pack_map(&in->m->pk, 0);
+    if(rbusMessageJson_ParseString(in, &key, &length) != 0 || !rbusMessageJson_Expect(in, ':'))
+        return -1;
+
+    /*the forms of the types JSON lacks*/
+    if(length > 1 && key[0] == '$')
+    {
+        uint32_t n;
+        int8_t type = 0;
+        if(length == 4 && memcmp(key, "$bin", 4) == 0)
+        {
+            if(rbusMessageJson_ParseBase64(in, &n) != 0 ||
+                msgpack_pack_bin(&in->m->pk, n) != 0 || msgpack_pack_bin_body(&in->m->pk, in->values, n) != 0)
+                return -1;
+            return rbusMessageJson_Expect(in, '}') ? 0 : -1;
+        }
+        if(length == 6 && memcmp(key, "$int32", 6) == 0)
+            type = RBUS_MESSAGE_EXT_INT32_ARRAY;
+        else if(length == 6 && memcmp(key, "$int64", 6) == 0)
+            type = RBUS_MESSAGE_EXT_INT64_ARRAY;
+        else if(length == 7 && memcmp(key, "$double", 7) == 0)
+            type = RBUS_MESSAGE_EXT_DOUBLE_ARRAY;
+        if(type)
+        {
+            if(rbusMessageJson_ParseArray(in, type, &n) != 0 ||
+                rbusMessage_SetArray(in->m, type, in->values, n, type == RBUS_MESSAGE_EXT_INT32_ARRAY ? 4 : 8) != RT_OK)
+                return -1;
+            return rbusMessageJson_Expect(in, '}') ? 0 : -1;
+        }
+    }
+
+    if(rbusMessageJson_BeginContainer(in, 0xdf, &header) != 0)
+        return -1;
+    for(;;)
+    {
+        if(rbusMessageJson_PackString(in, key, length) != 0 || rbusMessageJson_ParseValue(in, depth + 1) != 0)
+            return -1;
+        count++;
+        if(!rbusMessageJson_Expect(in, ','))
+            break;
+        if(rbusMessageJson_ParseString(in, &key, &length) != 0 || !rbusMessageJson_Expect(in, ':'))
+            return -1;
+    }
+    if(!rbusMessageJson_Expect(in, '}'))
+        return -1;
+    rbusMessage_Store32((uint8_t*)in->m->sbuf.data + header + 1, count);
+    return 0;
+}
+
+static int rbusMessageJson_ParseValue(rbusMessageJsonIn* in, int depth)
+{
+    rbusMessageJsonNumberType number;
+    int64_t i64 = 0;
+    uint64_t u64 = 0;
+    double f64 = 0;
+    char const* s;
+    size_t length;
+    size_t header;
+    uint32_t count = 0;
+
+    if(depth > RBUS_MESSAGE_JSON_MAX_DEPTH)
+        return -1;
+    rbusMessageJson_SkipSpace(in);
+    if(in->p == in->end)
+        return -1;
+    switch(*in->p)
+    {
+    case '"':
+        if(rbusMessageJson_ParseString(in, &s, &length) != 0)
+            return -1;
+        return rbusMessageJson_PackString(in, s, length);
+    case '{':
+        in->p++;
+        return rbusMessageJson_ParseObject(in, depth);
+    case '[':
+        in->p++;
+        if(rbusMessageJson_Expect(in, ']'))
+            return msgpack_pack_array(&in->m->pk, 0);
+        if(rbusMessageJson_BeginContainer(in, 0xdd, &header) != 0)
+            return -1;
+        do
+        {
+            if(rbusMessageJson_ParseValue(in, depth + 1) != 0)
+                return -1;
+            count++;
+        } while(rbusMessageJson_Expect(in, ','));
+        if(!rbusMessageJson_Expect(in, ']'))
+            return -1;
+        rbusMessage_Store32((uint8_t*)in->m->sbuf.data + header + 1, count);
+        return 0;
+    case 't':
+        if(in->end - in->p < 4 || memcmp(in->p, "true", 4) != 0)
+            return -1;
+        in->p += 4;
+        return msgpack_pack_true(&in->m->pk);
+    case 'f':
+        if(in->end - in->p < 5 || memcmp(in->p, "false", 5) != 0)
+            return -1;
+        in->p += 5;
+        return msgpack_pack_false(&in->m->pk);
+    case 'n':
+        if(in->end - in->p < 4 || memcmp(in->p, "null", 4) != 0)
+            return -1;
+        in->p += 4;
+        return msgpack_pack_nil(&in->m->pk);
+    default:
+        if(rbusMessageJson_ParseNumber(in, &number, &i64, &u64, &f64) != 0)
+            return -1;
+        if(number == RBUS_MESSAGE_JSON_DOUBLE)
+            return msgpack_pack_double(&in->m->pk, f64);
+        if(number == RBUS_MESSAGE_JSON_UNSIGNED)
+            return msgpack_pack_uint64(&in->m->pk, u64);
+        return msgpack_pack_int64(&in->m->pk, i64);
+    }
+}
+
+rtError rbusMessage_FromJson(rbusMessage* message, char const* json, uint32_t length)
+{
+    rbusMessageJsonIn in;
+    int rc = -1;
+
+    memset(&in, 0, sizeof(in));
+    in.p = json;
+    in.end = json + length;
+    rbusMessage_Init(message);
+    in.m = *message;
+
+    if(rbusMessageJson_Expect(&in, '['))
+    {
+        if(rbusMessageJson_Expect(&in, ']'))
+            rc = 0;
+        else
+        {
+            do
+            {
+                rc = rbusMessageJson_ParseValue(&in, 0);
+            } while(rc == 0 && rbusMessageJson_Expect(&in, ','));
+            if(rc == 0 && !rbusMessageJson_Expect(&in, ']'))
+                rc = -1;
+        }
+        rbusMessageJson_SkipSpace(&in);
+        if(in.p != in.end)
+            rc = -1;
+    }
+    rt_free(in.text);
+    rt_free(in.values);
+    if(rc != 0)
+    {
+        RBUSCORELOG_ERROR("%s invalid JSON at offset %lu", __FUNCTION__, (unsigned long)(in.p - json));
+        rbusMessage_Release(*message);
+        *message = NULL;
+        return RT_FAIL;
+    }
+    return RT_OK;
+}
+/* End JSON.*/
+
+/*The size functions mirror the encodings msgpack picks in the matching Set call.*/
+static uint32_t rbusMessage_SizeOfStrHeader(uint32_t length)
+{
+    if(length < 32)
+        return 1;
+    else if(length < 256)
+        return 2;
+    else if(length < 65536)
+        return 3;
+    return 5;
+}
+
+static uint32_t rbusMessage_SizeOfBinHeader(uint32_t length)
+{
+    if(length < 256)
+        return 2;
+    else if(length < 65536)
+        return 3;
+    return 5;
+}
+
+uint32_t rbusMessage_SizeOfString(char const* value)
+{
+    uint32_t length = (value ? strlen(value) : 0) + 1;
+    return rbusMessage_SizeOfStrHeader(length) + length;
+}
+
+uint32_t rbusMessage_SizeOfBytes(uint32_t size)
+{
+    return rbusMessage_SizeOfBinHeader(size) + size;
+}
+
+uint32_t rbusMessage_SizeOfInt64(int64_t value)
+{
+    if(value < -(1LL<<5))
+    {
+        if(value < -(1LL<<31))
+            return 9;
+        else if(value < -(1LL<<15))
+            return 5;
+        else if(value < -(1LL<<7))
+            return 3;
+        return 2;
+    }
+    else if(value < (1LL<<7))
+        return 1;
+    else if(value < (1LL<<8))
+        return 2;
+    else if(value < (1LL<<16))
+        return 3;
+    else if(value < (1LL<<32))
+        return 5;
+    return 9;
+}
+
+uint32_t rbusMessage_SizeOfInt32(int32_t value)
+{
+    return rbusMessage_SizeOfInt64(value);
+}
+
+uint32_t rbusMessage_SizeOfDouble(double value)
+{
+    (void)value;
+    return 9;
+}
+
+uint32_t rbusMessage_SizeOfMessage(rbusMessage const item)
+{
+    return rbusMessage_SizeOfBytes(item->sbuf.size - rbusMessage_WireStart(item) + item->segment_bytes);
+}
+
+static uint32_t rbusMessage_SizeOfExtHeader(uint32_t length)
+{
+    if(length == 1 || length == 2 || length == 4 || length == 8 || length == 16)
+        return 2;
+    else if(length < 256)
+        return 3;
+    else if(length < 65536)
+        return 4;
+    else
+        return 6;
+}
+
+uint32_t rbusMessage_SizeOfInt32Array(uint32_t count)
+{
+    return rbusMessage_SizeOfExtHeader(count * 4) + count * 4;
+}
+
+uint32_t rbusMessage_SizeOfInt64Array(uint32_t count)
+{
+    return rbusMessage_SizeOfExtHeader(count * 8) + count * 8;
+}
+
+uint32_t rbusMessage_SizeOfDoubleArray(uint32_t count)
+{
+    return rbusMessage_SizeOfExtHeader(count * 8) + count * 8;
+}
+
+uint32_t rbusMessage_SizeOfMap(uint32_t count)
+{
+    return count < 16 ? 1 : count < 65536 ? 3 : 5;
+}
+
+void rbusMessage_BeginMetaSectionWrite(rbusMessage message)
+{
+    rbusMessage_PrepareWrite(message);
+    /*an offset into the flattened message as it goes on the wire*/
+    message->meta_offset = message->sbuf.size + message->segment_bytes - message->body_offset;
+    message->meta_writing = true;
+}
+
+/*Best effort: a receiver that finds no index builds its own.*/
+static void rbusMessage_WriteFieldIndex(rbusMessage message)
+{
+    if(message->segment_count && rbusMessage_Flatten(message) != 0)
+        return;
+    if(rbusMessage_WalkFields(message, SIZE_MAX, message->body_offset + message->meta_offset) != 0)
+        return;
+    rbusMessage_SetArray(message, RBUS_MESSAGE_EXT_FIELD_INDEX, message->field_index, message->field_count, sizeof(uint32_t));
+    message->field_index_valid = false;
+}
+
+void rbusMessage_EndMetaSectionWrite(rbusMessage message)
+{
+    if(message->write_field_index)
+        rbusMessage_WriteFieldIndex(message);
+    msgpack_pack_int32(&message->pk, message->meta_offset | 0x80000000);
+    message->sbuf.data[message->sbuf.size - 4] &= 0x7F; //Clear the effects of mask, now that offset is stored as a 4-byte integer.
+    message->meta_writing = false;
+}
+
+/*Decode the trailer written by rbusMessage_EndMetaSectionWrite directly rather than through msgpack.*/
+static rtError rbusMessage_GetMetaOffset(rbusMessage message, size_t* offset)
+{
+    uint8_t const* p;
+    size_t section_offset;
+
+    if(message->wire_version == 2 || message->sbuf.size < message->body_offset + RBUS_MESSAGE_META_TRAILER_SIZE)
+        return RT_FAIL;
+    p = (uint8_t const*)message->sbuf.data + message->sbuf.size - RBUS_MESSAGE_META_TRAILER_SIZE;
+    if(p[0] != 0xd2)
+        return RT_FAIL;
+    section_offset = message->body_offset + rbusMessage_Load32(p + 1);
+    if(section_offset > message->sbuf.size - RBUS_MESSAGE_META_TRAILER_SIZE)
+        return RT_FAIL;
+    *offset = section_offset;
+    return RT_OK;
+}
+
+void rbusMessage_BeginMetaSectionRead(rbusMessage message)
+{
+    size_t section_offset = 0;
+    rbusMessage_Flatten(message);
+    message->meta_offset = message->read_offset; //For safekeeping.
+    if(rbusMessage_GetMetaOffset(message, &section_offset) != RT_OK)
+        section_offset = rbusMessage_BodyEnd(message); /*nothing to read*/
+    message->read_offset = section_offset;
+}
+
+void rbusMessage_EndMetaSectionRead(rbusMessage message)
+{
+    message->read_offset = message->meta_offset;
+}
+
+static rbusMessageMeta const* rbusMessage_GetMeta(rbusMessage message)
+{
+    rbusMessageMeta* meta = &message->meta;
+    rbusMessageItem item;
+    size_t offset = 0;
+    uint8_t const* p;
+    uint8_t const* end;
+    size_t n;
+
+    if(meta->parsed)
+        return meta;
+    rbusMessage_Flatten(message);
+
+    meta->fields = 0;
+    meta->name = NULL;
+    meta->object_name = NULL;
+    meta->is_rbus2 = 0;
+    meta->flags = 0;
+    meta->method_id = 0;
+    meta->sequence = 0;
+    meta->deadline = 0;
+    meta->parsed = true;
+
+    if(message->wire_version == 2)
+    {
+        /*plain loads from the fixed header; the names follow the body*/
+        uint8_t const* p = (uint8_t const*)message->sbuf.data + message->body_offset - RBUS_MESSAGE_V2_HEADER_SIZE;
+        uint32_t flags = rbusMessage_Load16(p + 2);
+        meta->method_id = rbusMessage_Load32(p + 4);
+        meta->sequence = rbusMessage_Load32(p + 16);
+        meta->deadline = ((uint64_t)rbusMessage_Load32(p + 20) << 32) | rbusMessage_Load32(p + 24);
+        char const* object_name;
+        if(flags & RBUS_MESSAGE_V2_FLAG_INTERNED)
+        {
+            /*NULL until rbusMessage_ResolveNames*/
+            meta->name = message->route_name;
+            object_name = message->route_object;
+        }
+        else
+        {
+            meta->name = message->sbuf.data + message->body_offset + message->body_length;
+            object_name = rbusMessage_Load16(p + 10) ? meta->name + rbusMessage_Load16(p + 8) : NULL;
+        }
+        if(!meta->name)
+            return meta;
+        meta->fields = 1;
+        if(flags & RBUS_MESSAGE_V2_FLAG_EVENT)
+        {
+            if(object_name)
+            {
+                meta->object_name = object_name;
+                meta->is_rbus2 = (flags & RBUS_MESSAGE_V2_FLAG_RBUS2) ? 1 : 0;
+                meta->fields = 3;
+            }
+        }
+        else
+        {
+            meta->flags = (int32_t)(flags >> RBUS_MESSAGE_V2_REQUEST_FLAGS_SHIFT);
+        }
+        return meta;
+    }
+
+    if(rbusMessage_GetMetaOffset(message, &offset) != RT_OK)
+        return meta;
+    p = (uint8_t const*)message->sbuf.data + offset;
+    end = (uint8_t const*)message->sbuf.data + message->sbuf.size - RBUS_MESSAGE_META_TRAILER_SIZE;
+
+    /*decoded with a local cursor, which leaves the sequential one untouched*/
+    if((n = rbusMessage_Decode(p, end, &item)) != 0 && item.type == MSGPACK_OBJECT_STR)
+    {
+        p += n;
+        meta->name = item.ptr;
+        meta->fields = 1;
+        if((n = rbusMessage_Decode(p, end, &item)) != 0)
+        {
+            p += n;
+            if(item.type == MSGPACK_OBJECT_POSITIVE_INTEGER || item.type == MSGPACK_OBJECT_NEGATIVE_INTEGER)
+            {
+                meta->flags = (int32_t)item.via.i64;
+            }
+            else if(item.type == MSGPACK_OBJECT_STR)
+            {
+                meta->object_name = item.ptr;
+                meta->fields = 2;
+                if(rbusMessage_Decode(p, end, &item) != 0 &&
+                    (item.type == MSGPACK_OBJECT_POSITIVE_INTEGER || item.type == MSGPACK_OBJECT_NEGATIVE_INTEGER))
+                {
+                    meta->is_rbus2 = (int32_t)item.via.i64;
+                    meta->fields = 3;
+                }
+            }
+        }
+    }
+    return meta;
+}
+
+rtError rbusMessage_GetMetaMethod(rbusMessage message, char const** method)
+{
+    rbusMessageMeta const* meta = rbusMessage_GetMeta(message);
+    if(meta->fields < 1)
+        return RT_FAIL;
+    *method = meta->name;
+    return RT_OK;
+}
+
+rtError rbusMessage_GetMetaEvent(rbusMessage message, char const** event_name, char const** object_name, int32_t* is_rbus2)
+{
+    rbusMessageMeta const* meta = rbusMessage_GetMeta(message);
+    if(meta->fields < 3)
+        return RT_FAIL;
+    *event_name = meta->name;
+    *object_name = meta->object_name;
+    *is_rbus2 = meta->is_rbus2;
+    return RT_OK;
+}
+
+int32_t rbusMessage_GetMetaFlags(rbusMessage message)
+{
+    return rbusMessage_GetMeta(message)->flags;
+}
+
+uint64_t rbusMessage_GetMetaDeadline(rbusMessage message)
+{
+    return rbusMessage_GetMeta(message)->deadline;
+}
+
+int rbusMessage_GetWireVersion(rbusMessage message)
+{
+    return message->wire_version;
+}
+
+/*FNV-1a, carried in the v2 header so receivers can look methods up without hashing the name themselves.*/
+uint32_t rbusMessage_HashName(char const* name)
+{
+    return rbusMessage_HashBytes(name, strlen(name));
+}
+
+/*The hash of the method name, from the v2 header when there is one.*/
+uint32_t rbusMessage_GetMetaMethodHash(rbusMessage message)
+{
+    rbusMessageMeta const* meta = rbusMessage_GetMeta(message);
+    if(message->wire_version == 2)
+        return meta->method_id;
+    return meta->fields < 1 ? 0 : rbusMessage_HashName(meta->name);
+}
+
+/* Begin string tables.
+  Names in the v2 trailer can be encoded against a table kept per peer, one table for each direction. Each name field is
+  a uvarint code, followed by the NUL-terminated name unless the code refers to an id the peer already knows:
+    0                 the name follows and is not in the table (the table is full)
+    (id + 1) << 1 | 1 the name follows and is entry 'id' from now on
+    (id + 1) << 1     entry 'id'
+  A sender keeps defining an id until a message carrying the definition has been sent, which rbusMessage_ConfirmNames
+  records, so a message that refers to an id is never ahead of its definition. A receiver that gets an id it doesn't know,
+  for instance after restarting, fails rbusMessage_ResolveNames and the sender is expected to reset its table.*/
+#define RBUS_MESSAGE_STRING_TABLE_SIZE 256
+#define RBUS_MESSAGE_STRING_TABLE_SLOTS 512 /*power of 2, at least twice the size*/
+
+struct _rbusMessageStringTable
+{
+    uint32_t count;
+    char* strings[RBUS_MESSAGE_STRING_TABLE_SIZE];
+    bool confirmed[RBUS_MESSAGE_STRING_TABLE_SIZE];
+    uint16_t slots[RBUS_MESSAGE_STRING_TABLE_SLOTS]; /*sender only: id + 1, or 0 if free*/
+};
+typedef struct _rbusMessageStringTable* rbusMessageStringTable;
+
+rbusMessageStringTable rbusMessageStringTable_Create(void)
+{
+    return rt_try_calloc(1, sizeof(struct _rbusMessageStringTable));
+}
+
+void rbusMessageStringTable_Reset(rbusMessageStringTable table)
+{
+    uint32_t i;
+
+    for(i = 0; i < RBUS_MESSAGE_STRING_TABLE_SIZE; ++i)
+        free(table->strings[i]);
+    memset(table, 0, sizeof(struct _rbusMessageStringTable));
+}
+
+void rbusMessageStringTable_Destroy(rbusMessageStringTable table)
+{
+    if(!table)
+        return;
+    rbusMessageStringTable_Reset(table);
+    free(table);
+}
+
+static char* rbusMessage_CopyName(char const* name, size_t length)
+{
+    char* copy = rt_try_malloc(length);
+    if(copy)
+        memcpy(copy, name, length);
+    return copy;
+}
+
+/*Returns the id of 'name', adding it if needed, or -1 if the table is full. Sets 'define' if the peer may not know it yet.*/
+static int32_t rbusMessageStringTable_Intern(rbusMessageStringTable table, char const* name, bool* define)
+{
+    uint32_t slot = rbusMessage_HashName(name) & (RBUS_MESSAGE_STRING_TABLE_SLOTS - 1);
+    uint32_t id;
+
+    while(table->slots[slot])
+    {
+        id = table->slots[slot] - 1;
+        if(strcmp(table->strings[id], name) == 0)
+        {
+            *define = !table->confirmed[id];
+            return (int32_t)id;
+        }
+        slot = (slot + 1) & (RBUS_MESSAGE_STRING_TABLE_SLOTS - 1);
+    }
+    *define = true;
+    if(table->count == RBUS_MESSAGE_STRING_TABLE_SIZE)
+        return -1;
+    id = table->count;
+    if((table->strings[id] = rbusMessage_CopyName(name, strlen(name) + 1)) == NULL)
+        return -1;
+    table->count++;
+    table->slots[slot] = (uint16_t)(id + 1);
+    return (int32_t)id;
+}
+
+/*Rewrites the v2 name trailer from route_name and route_object, against 'table' if it's not NULL.*/
+static int rbusMessage_WriteRoute(struct _rbusMessage* m, rbusMessageStringTable table)
+{
+    char const* names[2];
+    size_t lengths[2];
+    uint8_t* p;
+    uint32_t flags;
+    int i;
+
+    names[0] = m->route_name;
+    names[1] = m->route_object;
+    m->sbuf.size = m->body_offset + m->body_length;
+    for(i = 0; i < 2; ++i)
+    {
+        size_t start = m->sbuf.size;
+        bool define = true;
+
+        m->route_defined[i] = -1;
+        lengths[i] = 0;
+        if(!names[i])
+            continue;
+        if(table)
+        {
+            uint8_t code[10];
+            int32_t id = rbusMessageStringTable_Intern(table, names[i], &define);
+            uint64_t v = id < 0 ? 0 : (((uint64_t)id + 1) << 1) | (define ? 1 : 0);
+            if(rbusMessage_StorageWrite(m, &m->sbuf, (char const*)code, rbusMessage_PutUvarint(code, v)) != 0)
+                return -1;
+            if(id >= 0 && define)
+                m->route_defined[i] = id;
+        }
+        if(define && rbusMessage_StorageWrite(m, &m->sbuf, names[i], strlen(names[i]) + 1) != 0)
+            return -1;
+        lengths[i] = m->sbuf.size - start;
+        if(lengths[i] > UINT16_MAX)
+            return -1;
+    }
+    p = (uint8_t*)m->sbuf.data + m->body_offset - RBUS_MESSAGE_V2_HEADER_SIZE;
+    flags = rbusMessage_Load16(p + 2) & ~RBUS_MESSAGE_V2_FLAG_INTERNED;
+    rbusMessage_Store16(p + 2, flags | (table ? RBUS_MESSAGE_V2_FLAG_INTERNED : 0));
+    rbusMessage_Store16(p + 8, (uint32_t)lengths[0]);
+    rbusMessage_Store16(p + 10, (uint32_t)lengths[1]);
+    m->meta.parsed = false;
+    return 0;
+}
+
+/*Marks the ids defined by the last rbusMessage_ToBytesV2 against 'table' as known to the peer, once the message is sent.*/
+void rbusMessage_ConfirmNames(rbusMessage message, rbusMessageStringTable table)
+{
+    char const* names[2];
+    int i;
+
+    if(message->wire_version != 2)
+        return;
+    names[0] = message->route_name;
+    names[1] = message->route_object;
+    for(i = 0; i < 2; ++i)
+    {
+        int32_t id = message->route_defined[i];
+        /*the table may have been reset since*/
+        if(id >= 0 && table->strings[id] && strcmp(table->strings[id], names[i]) == 0)
+            table->confirmed[id] = true;
+    }
+}
+
+/*Decodes the names of a v2 message encoded against a string table, updating 'table' with what the sender defined.
+  Fails if the message refers to an id 'table' doesn't have. A no-op for other messages.*/
+rtError rbusMessage_ResolveNames(rbusMessage message, rbusMessageStringTable table)
+{
+    uint8_t const* hdr;
+    uint8_t const* p;
+    char const** routes[2];
+    int i;
+
+    if(message->wire_version != 2 || message->route_name)
+        return RT_OK;
+    hdr = (uint8_t const*)message->sbuf.data + message->body_offset - RBUS_MESSAGE_V2_HEADER_SIZE;
+    if(!(rbusMessage_Load16(hdr + 2) & RBUS_MESSAGE_V2_FLAG_INTERNED))
+        return RT_OK;
+    if(!table)
+        return RT_FAIL;
+
+    routes[0] = &message->route_name;
+    routes[1] = &message->route_object;
+    p = (uint8_t const*)message->sbuf.data + message->body_offset + message->body_length;
+    for(i = 0; i < 2; ++i)
+    {
+        uint8_t const* end = p + rbusMessage_Load16(hdr + 8 + 2 * i);
+        char const* name = NULL;
+        size_t length;
+        uint64_t v;
+        char* copy;
+
+        if(p == end)
+            continue;
+        if(!rbusMessage_GetUvarint(&p, end, &v) || v == 1 || (v >> 1) > RBUS_MESSAGE_STRING_TABLE_SIZE)
+            goto malformed;
+        if(v == 0 || (v & 1))
+        {
+            if(p == end || end[-1] != '\0' || strlen((char const*)p) + 1 != (size_t)(end - p))
+                goto malformed;
+            name = (char const*)p;
+            if(v)
+            {
+                uint32_t id = (uint32_t)(v >> 1) - 1;
+                free(table->strings[id]);
+                table->strings[id] = rbusMessage_CopyName(name, end - p);
+            }
+        }
+        else if(p != end || (name = table->strings[(v >> 1) - 1]) == NULL)
+        {
+            RBUSCORELOG_DEBUG("%s unknown string id %u", __FUNCTION__, (unsigned)(v >> 1) - 1);
+            return RT_FAIL;
+        }
+        /*copied, so the names stay valid if the table changes or the message detaches from its buffer*/
+        length = strlen(name) + 1;
+        if((copy = rbusMessage_ArenaAlloc(message, length)) == NULL)
+            return RT_FAIL;
+        memcpy(copy, name, length);
+        *routes[i] = copy;
+        p = end;
+    }
+    if(!message->route_name)
+        goto malformed;
+    message->meta.parsed = false;
+    return RT_OK;
+
+malformed:
+    RBUSCORELOG_ERROR("%s malformed name trailer", __FUNCTION__);
+    message->route_name = NULL;
+    message->route_object = NULL;
+    return RT_FAIL;
+}
+/* End string tables.*/
+
+/*Keeps arena copies of the names so the trailer can be rewritten for each peer.*/
+static int rbusMessage_SetRoute(struct _rbusMessage* m, char const* name, char const* object_name)
+{
+    char* copy;
+    size_t length;
+
+    length = strlen(name) + 1;
+    if((copy = rbusMessage_ArenaAlloc(m, length)) == NULL)
+        return -1;
+    memcpy(copy, name, length);
+    m->route_name = copy;
+    m->route_object = NULL;
+    if(object_name)
+    {
+        length = strlen(object_name) + 1;
+        if((copy = rbusMessage_ArenaAlloc(m, length)) == NULL)
+            return -1;
+        memcpy(copy, object_name, length);
+        m->route_object = copy;
+    }
+    return 0;
+}
+
+/*Like rbusMessage_ToBytes, but in wire format v2. The meta section is replaced by the name trailer, and the v2 header
+  goes into the headroom in front of the body, so the body doesn't move. With a 'table' the names are encoded against the
+  string table of the peer the message is for. Fails for messages that have no headroom, such as ones created from bytes
+  in v0 format; the caller should send those as v0.*/
+rtError rbusMessage_ToBytesV2(rbusMessage message, rbusMessageStringTable table, uint32_t sequence, uint64_t deadline,
+    uint8_t** buff, uint32_t* n)
+{
+    uint8_t* p;
+
+    if(rbusMessage_IsForeign(message) && rbusMessage_Detach(message) != 0)
+        return RT_FAIL;
+    if(message->wire_version != 2)
+    {
+        rbusMessageMeta const* meta;
+        size_t meta_start = 0;
+        uint32_t flags;
+
+        if(rbusMessage_Flatten(message) != 0)
+            return RT_FAIL;
+        if(message->body_offset < RBUS_MESSAGE_V2_HEADER_SIZE || rbusMessage_GetMetaOffset(message, &meta_start) != RT_OK)
+            return RT_FAIL;
+        meta = rbusMessage_GetMeta(message);
+        if(meta->fields < 1 || strlen(meta->name) > RBUS_MESSAGE_V2_MAX_NAME_LENGTH ||
+            (meta->fields == 3 && strlen(meta->object_name) > RBUS_MESSAGE_V2_MAX_NAME_LENGTH))
+            return RT_FAIL;
+        if(meta->fields == 3)
+            flags = RBUS_MESSAGE_V2_FLAG_EVENT | (meta->is_rbus2 ? RBUS_MESSAGE_V2_FLAG_RBUS2 : 0);
+        else
+            flags = ((uint32_t)meta->flags & 0xff) << RBUS_MESSAGE_V2_REQUEST_FLAGS_SHIFT;
+        if(rbusMessage_SetRoute(message, meta->name, meta->fields == 3 ? meta->object_name : NULL) != 0)
+            return RT_FAIL;
+
+        p = (uint8_t*)message->sbuf.data + message->body_offset - RBUS_MESSAGE_V2_HEADER_SIZE;
+        p[0] = RBUS_MESSAGE_V2_MAGIC;
+        p[1] = RBUS_MESSAGE_V2_VERSION;
+        rbusMessage_Store16(p + 2, flags);
+        rbusMessage_Store32(p + 4, rbusMessage_HashName(message->route_name));
+        rbusMessage_Store32(p + 12, (uint32_t)(meta_start - message->body_offset));
+        message->body_length = (uint32_t)(meta_start - message->body_offset);
+        message->wire_version = 2;
+        message->name_base_valid = false;
+    }
+    else if(!message->route_name)
+    {
+        /*received in v2: take the names from the trailer; encoded against a table they must have been resolved*/
+        rbusMessageMeta const* meta = rbusMessage_GetMeta(message);
+        if(meta->fields < 1 || rbusMessage_SetRoute(message, meta->name, meta->object_name) != 0)
+            return RT_FAIL;
+    }
+    /*receivers decompress before they resolve names, so a compressed message must name itself in plain text*/
+    if(table && strcmp(message->route_name, RBUS_MESSAGE_COMPRESSED_MARKER) == 0)
+        table = NULL;
+    if(rbusMessage_WriteRoute(message, table) != 0)
+        return RT_FAIL;
+    p = (uint8_t*)message->sbuf.data + rbusMessage_WireStart(message);
+    rbusMessage_Store32(p + 16, sequence);
+    rbusMessage_Store32(p + 20, (uint32_t)(deadline >> 32));
+    rbusMessage_Store32(p + 24, (uint32_t)deadline);
+    *buff = p;
+    *n = message->sbuf.size - rbusMessage_WireStart(message);
+    return RT_OK;
+}
+
+#ifdef ENABLE_RBUS_COMPRESSION
+static bool rbusMessage_IsCompressed(rbusMessage message)
+{
+    char const* method = NULL;
+    return rbusMessage_GetMetaMethod(message, &method) == RT_OK && strcmp(method, RBUS_MESSAGE_COMPRESSED_MARKER) == 0;
+}
+
+rtError rbusMessage_Compress(rbusMessage message, uint32_t threshold, rbusMessage* compressed)
+{
+    struct _rbusMessage* z;
+    uLongf zlen;
+    Bytef* zbuf;
+    uint32_t size;
+
+    *compressed = NULL;
+    if(rbusMessage_Flatten(message) != 0)
+        return RT_FAIL;
+    /*the copy inside must not depend on any peer's string table*/
+    if(message->wire_version == 2 && message->route_name && rbusMessage_WriteRoute(message, NULL) != 0)
+        return RT_FAIL;
+    size = message->sbuf.size - rbusMessage_WireStart(message);
+    if(size < threshold || size > INT32_MAX || rbusMessage_IsCompressed(message))
+        return RT_OK;
+
+    zlen = compressBound(size);
+    if((zbuf = rt_try_malloc(zlen)) == NULL)
+    {
+        RBUSCORELOG_ERROR("%s failed to allocate %lu bytes", __FUNCTION__, (unsigned long)zlen);
+        return RT_FAIL;
+    }
+    if(compress2(zbuf, &zlen, (Bytef const*)message->sbuf.data + rbusMessage_WireStart(message), size, Z_BEST_SPEED) != Z_OK)
+    {
+        RBUSCORELOG_ERROR("%s failed to compress %u bytes", __FUNCTION__, size);
+        free(zbuf);
+        return RT_FAIL;
+    }
+    if(zlen + RBUS_MESSAGE_COMPRESSED_OVERHEAD >= size)
+    {
+        free(zbuf);
+        return RT_OK; /*incompressible, send as is*/
+    }
+
+    z = rbusMessage_Create();
+    rbusMessage_Reserve(z, rbusMessage_SizeOfInt32(size) + rbusMessage_SizeOfBytes(zlen));
+    rbusMessage_SetInt32(z, (int32_t)size);
+    rbusMessage_SetBytes(z, zbuf, zlen);
+    rbusMessage_BeginMetaSectionWrite(z);
+    rbusMessage_SetString(z, RBUS_MESSAGE_COMPRESSED_MARKER);
+    rbusMessage_EndMetaSectionWrite(z);
+    free(zbuf);
+    *compressed = z;
+    return RT_OK;
+}
+
+/*Replace a compressed message's contents with the original message, leaving anything else untouched.*/
+static void rbusMessage_Inflate(rbusMessage m)
+{
+    int32_t size = 0;
+    uint8_t const* zbuf = NULL;
+    uint32_t zlen = 0;
+    uLongf len;
+    char* data;
+
+    if(!rbusMessage_IsCompressed(m))
+        return;
+    if(rbusMessage_GetInt32(m, &size) != RT_OK || size < 0 || rbusMessage_GetBytes(m, &zbuf, &zlen) != RT_OK)
+    {
+        RBUSCORELOG_ERROR("%s malformed compressed message", __FUNCTION__);
+        m->read_offset = m->body_offset;
+        return;
+    }
+    if((uint64_t)size > (uint64_t)zlen * RBUS_MESSAGE_MAX_INFLATE_RATIO)
+    {
+        RBUSCORELOG_ERROR("%s %u bytes can't inflate to %d", __FUNCTION__, zlen, size);
+        m->read_offset = m->body_offset;
+        return;
+    }
+    len = size;
+    data = rt_try_malloc(size ? size : 1);
+    if(!data || uncompress((Bytef*)data, &len, zbuf, zlen) != Z_OK || len != (uLongf)size)
+    {
+        RBUSCORELOG_ERROR("%s failed to decompress %u bytes", __FUNCTION__, zlen);
+        free(data);
+        m->read_offset = m->body_offset;
+        return;
+    }
+    rbusMessage_ReleaseForeign(m);
+    rbusMessage_StorageFree(m, &m->sbuf);
+    m->sbuf.data = data;
+    m->sbuf.size = size;
+    m->sbuf.alloc = size ? size : 1;
+    rbusMessage_DetectWireVersion(m);
+}
+#else
+rtError rbusMessage_Compress(rbusMessage message, uint32_t threshold, rbusMessage* compressed)
+{
+    (void)message;
+    (void)threshold;
+    *compressed = NULL;
+    RBUSCORELOG_ERROR("%s rbus-core was built without ENABLE_RBUS_COMPRESSION", __FUNCTION__);
+    return RT_FAIL;
+}
+#endif
+
 #if 0
 
 #define VERIFY(T)\
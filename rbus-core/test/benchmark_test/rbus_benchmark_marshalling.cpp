@@ -0,0 +1,262 @@
+/*
+  * If not stated otherwise in this file or this component's Licenses.txt file
+  * the following copyright and licenses apply:
+  *
+  * Copyright 2019 RDK Management
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+*/
+#include <stdio.h>
+#include <string>
+#include <benchmark/benchmark.h>
+#include <msgpack.h>
+#include "rbus_message.h"
+
+extern "C" {
+/*meta section helpers used by rbus_core.c, not part of the public header*/
+void rbusMessage_BeginMetaSectionWrite(rbusMessage message);
+void rbusMessage_EndMetaSectionWrite(rbusMessage message);
+}
+
+/*Marshalling only, no broker needed. Messages are shaped like a METHOD_GETPARAMETERVALUES response.*/
+#define PARAMETER_COUNT 20
+
+static void build_response(rbusMessage* msg)
+{
+    char name[64];
+    int i;
+
+    rbusMessage_Init(msg);
+    rbusMessage_SetInt32(*msg, 0);
+    rbusMessage_SetInt32(*msg, PARAMETER_COUNT);
+    for(i = 0; i < PARAMETER_COUNT; i++)
+    {
+        snprintf(name, sizeof(name), "Device.WiFi.AccessPoint.%d.AssociatedDevice.1.SignalStrength", i);
+        rbusMessage_SetString(*msg, name);
+        rbusMessage_SetInt32(*msg, 3);
+        rbusMessage_SetString(*msg, "-67");
+        rbusMessage_SetInt64(*msg, 1600000000000LL + i);
+    }
+}
+
+static void BM_MessageEncode(benchmark::State& state)
+{
+    rbusMessage msg;
+    uint8_t* data;
+    uint32_t length;
+
+    for(auto _ : state)
+    {
+        build_response(&msg);
+        rbusMessage_ToBytes(msg, &data, &length);
+        benchmark::DoNotOptimize(data);
+        rbusMessage_Release(msg);
+    }
+}
+BENCHMARK(BM_MessageEncode);
+
+static void BM_MessageDecode(benchmark::State& state)
+{
+    rbusMessage msg, in;
+    uint8_t* data;
+    uint32_t length;
+    std::string bytes;
+    char const* str;
+    int32_t i32;
+    int64_t i64;
+    int i;
+
+    build_response(&msg);
+    rbusMessage_ToBytes(msg, &data, &length);
+    bytes.assign((char const*)data, length);
+    rbusMessage_Release(msg);
+
+    for(auto _ : state)
+    {
+        rbusMessage_FromBytesNoCopy(&in, (uint8_t const*)bytes.data(), bytes.size());
+        rbusMessage_GetInt32(in, &i32);
+        rbusMessage_GetInt32(in, &i32);
+        for(i = 0; i < PARAMETER_COUNT; i++)
+        {
+            rbusMessage_GetString(in, &str);
+            rbusMessage_GetInt32(in, &i32);
+            rbusMessage_GetString(in, &str);
+            rbusMessage_GetInt64(in, &i64);
+        }
+        benchmark::DoNotOptimize(str);
+        rbusMessage_Release(in);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_MessageDecode);
+
+/*The same items through msgpack_unpack_next, which the rbusMessage_Get* functions used before.*/
+static void BM_MsgpackUnpackNext(benchmark::State& state)
+{
+    rbusMessage msg;
+    uint8_t* data;
+    uint32_t length;
+    std::string bytes;
+    msgpack_unpacked upk;
+    size_t offset;
+
+    build_response(&msg);
+    rbusMessage_ToBytes(msg, &data, &length);
+    bytes.assign((char const*)data, length);
+    rbusMessage_Release(msg);
+
+    msgpack_unpacked_init(&upk);
+    for(auto _ : state)
+    {
+        offset = 0;
+        while(msgpack_unpack_next(&upk, bytes.data(), bytes.size(), &offset) == MSGPACK_UNPACK_SUCCESS)
+            benchmark::DoNotOptimize(upk.data.via.i64);
+    }
+    msgpack_unpacked_destroy(&upk);
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_MsgpackUnpackNext);
+
+/*Reading only the last parameter value: sequentially, then by index with and without the index sent in the meta section.*/
+static void BM_MessageGetLast(benchmark::State& state)
+{
+    rbusMessage msg, in;
+    uint8_t* data;
+    uint32_t length;
+    std::string bytes;
+    char const* str;
+    int32_t i32;
+    int64_t i64;
+    int i;
+
+    build_response(&msg);
+    rbusMessage_EnableFieldIndex(msg, state.range(0) == 2);
+    rbusMessage_BeginMetaSectionWrite(msg);
+    rbusMessage_SetString(msg, "METHOD_GETPARAMETERVALUES");
+    rbusMessage_EndMetaSectionWrite(msg);
+    rbusMessage_ToBytes(msg, &data, &length);
+    bytes.assign((char const*)data, length);
+    rbusMessage_Release(msg);
+
+    for(auto _ : state)
+    {
+        rbusMessage_FromBytesNoCopy(&in, (uint8_t const*)bytes.data(), bytes.size());
+        if(state.range(0) == 0)
+        {
+            rbusMessage_GetInt32(in, &i32);
+            rbusMessage_GetInt32(in, &i32);
+            for(i = 0; i < PARAMETER_COUNT; i++)
+            {
+                rbusMessage_GetString(in, &str);
+                rbusMessage_GetInt32(in, &i32);
+                rbusMessage_GetString(in, &str);
+                rbusMessage_GetInt64(in, &i64);
+            }
+        }
+        else
+        {
+            rbusMessage_GetInt64At(in, 1 + PARAMETER_COUNT * 4, &i64);
+        }
+        benchmark::DoNotOptimize(i64);
+        rbusMessage_Release(in);
+    }
+}
+BENCHMARK(BM_MessageGetLast)->Arg(0)->Arg(1)->Arg(2);
+
+/*A data model dump as a gateway would transcode it: 'count' parameters, some binary.*/
+static void build_dump(rbusMessage* msg, int count)
+{
+    char name[96];
+    uint8_t mac[6] = {0x00, 0x1a, 0x2b, 0x3c, 0x4d, 0x5e};
+    int i;
+
+    rbusMessage_Init(msg);
+    rbusMessage_SetInt32(*msg, 0);
+    rbusMessage_SetInt32(*msg, count);
+    for(i = 0; i < count; i++)
+    {
+        snprintf(name, sizeof(name), "Device.WiFi.AccessPoint.%d.AssociatedDevice.%d.MACAddress", i / 16, i % 16);
+        rbusMessage_SetString(*msg, name);
+        if(i % 4 == 0)
+        {
+            mac[5] = (uint8_t)i;
+            rbusMessage_SetBytes(*msg, mac, sizeof(mac));
+        }
+        else if(i % 4 == 1)
+            rbusMessage_SetString(*msg, "Connected \"5GHz\"");
+        else if(i % 4 == 2)
+            rbusMessage_SetInt64(*msg, 1600000000000LL + i);
+        else
+            rbusMessage_SetDouble(*msg, -67.5 + i);
+    }
+}
+
+static int count_json(void* user_data, char const* data, uint32_t length)
+{
+    benchmark::DoNotOptimize(data);
+    *(size_t*)user_data += length;
+    return 0;
+}
+
+static void BM_MessageToJson(benchmark::State& state)
+{
+    rbusMessage msg;
+    size_t size = 0;
+
+    build_dump(&msg, state.range(0));
+    for(auto _ : state)
+    {
+        size = 0;
+        rbusMessage_ToJson(msg, count_json, &size);
+    }
+    rbusMessage_Release(msg);
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_MessageToJson)->Arg(100)->Arg(10000);
+
+static void BM_MessageFromJson(benchmark::State& state)
+{
+    rbusMessage msg;
+    char* json;
+    uint32_t length;
+
+    build_dump(&msg, state.range(0));
+    rbusMessage_ToJsonString(msg, &json, &length);
+    rbusMessage_Release(msg);
+    for(auto _ : state)
+    {
+        rbusMessage_FromJson(&msg, json, length);
+        rbusMessage_Release(msg);
+    }
+    free(json);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_MessageFromJson)->Arg(100)->Arg(10000);
+
+/*What the gateway used before: a 2 KB debug string, truncated for larger dumps.*/
+static void BM_MessageToDebugString(benchmark::State& state)
+{
+    rbusMessage msg;
+    char* s;
+    uint32_t length = 0;
+
+    build_dump(&msg, state.range(0));
+    for(auto _ : state)
+    {
+        rbusMessage_ToDebugString(msg, &s, &length);
+        free(s);
+    }
+    rbusMessage_Release(msg);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_MessageToDebugString)->Arg(100)->Arg(10000);
@@ -19,6 +19,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string>
+#include <vector>
 #include <benchmark/benchmark.h>
 extern "C" {
 #include "rbus_core.h"
@@ -427,4 +429,111 @@ static void BM_InvokeRemoteMethodGet (benchmark::State& state) {
 }
 BENCHMARK(BM_InvokeRemoteMethodGet)->Iterations(1);
 
+/*The object registry with 10, 1k and 10k objects: registering and unregistering all of them, and looking them up*/
+static std::vector<std::string> registry_object_names(char const* component_name, int64_t count)
+{
+    std::vector<std::string> names;
+    char buffer[DEFAULT_RESULT_BUFFERSIZE];
+
+    for(int64_t i = 0; i < count; i++)
+    {
+        snprintf(buffer, (sizeof(buffer) - 1), "%s.obj%lld", component_name, (long long)i);
+        names.push_back(buffer);
+    }
+    return names;
+}
+
+static void BM_RegistryRegisterUnregister(benchmark::State& state) {
+    char component_name[] = "component_registry";
+    std::vector<std::string> names = registry_object_names(component_name, state.range(0));
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+
+    CALL_RBUS_OPEN_BROKER_CONNECTION(component_name);
+
+    for (auto _ : state)
+    {
+        for(size_t i = 0; i < names.size() && RTMESSAGE_BUS_SUCCESS == err; i++)
+            err = rbus_registerObj(names[i].c_str(), callback, NULL);
+        for(size_t i = 0; i < names.size() && RTMESSAGE_BUS_SUCCESS == err; i++)
+            err = rbus_unregisterObj(names[i].c_str());
+    }
+    if(RTMESSAGE_BUS_SUCCESS != err)
+        printf("rbus_registerObj/rbus_unregisterObj failed!!");
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+
+    CALL_RBUS_CLOSE_BROKER_CONNECTION();
+}
+BENCHMARK(BM_RegistryRegisterUnregister)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_RegistryLookup(benchmark::State& state) {
+    char component_name[] = "component_registry";
+    std::vector<std::string> names = registry_object_names(component_name, state.range(0));
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+    size_t next = 0;
+
+    CALL_RBUS_OPEN_BROKER_CONNECTION(component_name);
+    for(size_t i = 0; i < names.size() && RTMESSAGE_BUS_SUCCESS == err; i++)
+    {
+        err = rbus_registerObj(names[i].c_str(), callback, NULL);
+        if(RTMESSAGE_BUS_SUCCESS == err)
+            err = rbus_registerEvent(names[i].c_str(), "event", NULL, NULL);
+    }
+
+    /*publishing without subscribers only reads the registry: it finds the object and its event, and sends nothing. The
+      message is the same at every size, so the difference between sizes is the lookup.*/
+    for (auto _ : state)
+    {
+        rbusMessage msg;
+        char const* name = names[next].c_str();
+
+        next = (next + 1) % names.size();
+        rbusMessage_Init(&msg);
+        if(RTMESSAGE_BUS_SUCCESS == err)
+            err = rbus_publishEvent(name, "event", msg);
+        rbusMessage_Release(msg);
+    }
+    if(RTMESSAGE_BUS_SUCCESS != err)
+        printf("rbus_registerEvent/rbus_publishEvent failed!!");
+
+    for(size_t i = 0; i < names.size(); i++)
+        rbus_unregisterObj(names[i].c_str());
+    CALL_RBUS_CLOSE_BROKER_CONNECTION();
+}
+BENCHMARK(BM_RegistryLookup)->Arg(10)->Arg(1000)->Arg(10000);
+
+/*Publishing from 1 to 8 threads at once while the registry is read without g_mutex. There are no subscribers, so
+  nothing is sent and what's measured is finding the object and the event.*/
+static void BM_PublishEventThreads(benchmark::State& state) {
+    char component_name[] = "component_publisher";
+    char const* object_name = "component_publisher.obj";
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+
+    if(state.thread_index() == 0)
+    {
+        CALL_RBUS_OPEN_BROKER_CONNECTION(component_name);
+        rbus_registerObj(object_name, callback, NULL);
+        rbus_registerEvent(object_name, "event", NULL, NULL);
+    }
+
+    for (auto _ : state)
+    {
+        rbusMessage msg;
+
+        rbusMessage_Init(&msg);
+        if(RTMESSAGE_BUS_SUCCESS == err)
+            err = rbus_publishEvent(object_name, "event", msg);
+        rbusMessage_Release(msg);
+    }
+    if(RTMESSAGE_BUS_SUCCESS != err)
+        printf("rbus_publishEvent failed!!");
+    state.SetItemsProcessed(state.iterations());
+
+    if(state.thread_index() == 0)
+    {
+        rbus_unregisterObj(object_name);
+        CALL_RBUS_CLOSE_BROKER_CONNECTION();
+    }
+}
+BENCHMARK(BM_PublishEventThreads)->ThreadRange(1, 8)->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -24,6 +24,8 @@ Test Case : Testing rbus communications from client end
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
+#include <time.h>
 extern "C" {
 #include "rbus_core.h"
 
@@ -39,6 +41,79 @@ extern "C" {
 
 static test_array_data_t client_data;
 
+static int64_t elapsed_millisecs(struct timespec const* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static bool INVOKE_TIMEOUT_METHOD(char const* server_obj, int timeout)
+{
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+    rbusMessage setter;
+    rbusMessage response = NULL;
+    rbusMessage_Init(&setter);
+    rbusMessage_SetString(setter, "rbus_setDispatchThreads_test1");
+    rbusMessage_SetInt32(setter, timeout);
+    err = rbus_invokeRemoteMethod(server_obj, METHOD_SET_TIMEOUT_RPC, setter, ((timeout * 1000) + BUS_LATENCY_MARGIN), &response);
+    EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "RPC invocation failed";
+    if(NULL != response)
+        rbusMessage_Release(response);
+    return err == RTMESSAGE_BUS_SUCCESS;
+}
+
+static void* invoke_slow_method(void* server_obj)
+{
+    INVOKE_TIMEOUT_METHOD((char const*)server_obj, 3);
+    return NULL;
+}
+
+#define RACE_TEST_DURATION 3000
+
+static int race_events_received = 0;
+static bool race_stop = false;
+
+static int race_event_callback(const char * object_name, const char * event_name, rbusMessage message, void * user_data)
+{
+    (void)object_name;
+    (void)event_name;
+    (void)message;
+    (void)user_data;
+    __sync_fetch_and_add(&race_events_received, 1);
+    return 0;
+}
+
+/*Publishes to an object that stays registered and to one that comes and goes.*/
+static void* race_publish(void* server_obj)
+{
+    while(!__atomic_load_n(&race_stop, __ATOMIC_ACQUIRE))
+    {
+        rbusMessage msg;
+        rbusMessage_Init(&msg);
+        rbusMessage_SetString(msg, "race");
+        rbus_publishEvent((char const*)server_obj, "event_race", msg);
+        rbusMessage_Release(msg);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+/*Calls an object or element that comes and goes. Any answer will do, as long as the server is still there to give one.*/
+static void* race_invoke(void* server_obj)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(elapsed_millisecs(&start) < RACE_TEST_DURATION)
+    {
+        rbusMessage response = NULL;
+        if(rbus_pullObj((char const*)server_obj, 200, &response) == RTMESSAGE_BUS_SUCCESS)
+            rbusMessage_Release(response);
+    }
+    return NULL;
+}
+
 static bool OPEN_BROKER_CONNECTION(char* connection_name)
 {
     bool result = false;
@@ -1848,3 +1923,149 @@ TEST_F(StressTestServer, rbus_registerSubscribeHandler_test1)
         printf("fork failed \n");
     }
 }
+
+TEST_F(StressTestServer, rbus_setDispatchThreads_test1)
+{
+    int counter = 8;
+    char client_name[] = "TEST_CLIENT_1";
+    char server_obj1[] = "test_server_8.obj1";
+    char server_obj2[] = "test_server_8.obj2";
+    bool conn_status = false;
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        err = rbus_setDispatchThreads(2);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_setDispatchThreads failed";
+        CREATE_RBUS_SERVER_INSTANCE(counter);
+        err = rbus_registerMethod(server_obj1, METHOD_SET_TIMEOUT_RPC, handle_timeout, NULL);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_registerMethod failed";
+        err = rbus_registerObj(server_obj2, callback, NULL);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_registerObj failed";
+        err = rbus_registerMethod(server_obj2, METHOD_SET_TIMEOUT_RPC, handle_timeout, NULL);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_registerMethod failed";
+        printf("********** SERVER ENTERING PAUSED STATE******************** \n");
+        pause();
+    }
+    else if (pid > 0)
+    {
+        pthread_t slow_call;
+        struct timespec start;
+
+        EXPECT_EQ(rbus_setDispatchThreads(1000), RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+        sleep(4);
+        conn_status = OPEN_BROKER_CONNECTION(client_name);
+
+        /*obj2 answers while a worker is busy with obj1*/
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ASSERT_EQ(pthread_create(&slow_call, NULL, invoke_slow_method, server_obj1), 0);
+        usleep(500000);
+        EXPECT_TRUE(INVOKE_TIMEOUT_METHOD(server_obj2, 0));
+        EXPECT_LT(elapsed_millisecs(&start), 3000);
+        pthread_join(slow_call, NULL);
+        EXPECT_GE(elapsed_millisecs(&start), 3000);
+
+        /*requests to one object still run one at a time*/
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ASSERT_EQ(pthread_create(&slow_call, NULL, invoke_slow_method, server_obj1), 0);
+        usleep(500000);
+        EXPECT_TRUE(INVOKE_TIMEOUT_METHOD(server_obj1, 0));
+        EXPECT_GE(elapsed_millisecs(&start), 3000);
+        pthread_join(slow_call, NULL);
+
+        if(conn_status)
+            CLOSE_BROKER_CONNECTION();
+
+        kill(pid,SIGTERM);
+        return;
+    }
+    else{
+        printf("fork failed \n");
+    }
+}
+
+TEST_F(StressTestServer, rbus_registerObj_race_test1)
+{
+    int counter = 9, i = 0;
+    char client_name[] = "TEST_CLIENT_1";
+    char server_obj1[] = "test_server_9.obj1";
+    char server_obj2[] = "test_server_9.obj2";
+    char server_element[] = "server_element9.x";
+    bool conn_status = false;
+    rbus_error_t err = RTMESSAGE_BUS_SUCCESS;
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        pthread_t publisher;
+        struct timespec start;
+
+        CREATE_RBUS_SERVER_INSTANCE(counter);
+        err = rbus_registerEvent(server_obj1, "event_race", NULL, NULL);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_registerEvent failed";
+        EXPECT_EQ(pthread_create(&publisher, NULL, race_publish, server_obj1), 0);
+
+        /*register and unregister while requests for obj2 and its element are being delivered, first dispatching them
+          on the bus thread and then on the dispatch executor*/
+        rbus_method_table_entry_t table[2] = {{METHOD_SETPARAMETERVALUES, NULL, handle_set1}, {METHOD_GETPARAMETERVALUES, NULL, handle_get1}};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while(elapsed_millisecs(&start) < 2 * RACE_TEST_DURATION + 2000)
+        {
+            if(elapsed_millisecs(&start) > RACE_TEST_DURATION && i++ == 0)
+            {
+                EXPECT_EQ(rbus_setDispatchThreads(2), RTMESSAGE_BUS_SUCCESS);
+            }
+            EXPECT_EQ(rbus_registerObj(server_obj2, callback, NULL), RTMESSAGE_BUS_SUCCESS);
+            EXPECT_EQ(rbus_registerMethodTable(server_obj2, table, 2), RTMESSAGE_BUS_SUCCESS);
+            EXPECT_EQ(rbus_addElement(server_obj2, server_element), RTMESSAGE_BUS_SUCCESS);
+            usleep(1000);
+            EXPECT_EQ(rbus_removeElement(server_obj2, server_element), RTMESSAGE_BUS_SUCCESS);
+            EXPECT_EQ(rbus_unregisterObj(server_obj2), RTMESSAGE_BUS_SUCCESS);
+        }
+        EXPECT_EQ(rbus_registerObj(server_obj2, callback, NULL), RTMESSAGE_BUS_SUCCESS);
+        EXPECT_EQ(rbus_registerMethodTable(server_obj2, table, 2), RTMESSAGE_BUS_SUCCESS);
+        __atomic_store_n(&race_stop, true, __ATOMIC_RELEASE);
+        pthread_join(publisher, NULL);
+        printf("********** SERVER ENTERING PAUSED STATE******************** \n");
+        pause();
+    }
+    else if (pid > 0)
+    {
+        pthread_t clients[4];
+        rbusMessage response = NULL;
+
+        sleep(2);
+        conn_status = OPEN_BROKER_CONNECTION(client_name);
+        err = rbus_subscribeToEvent(server_obj1, "event_race", race_event_callback, NULL, NULL, NULL);
+        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_subscribeToEvent failed";
+
+        for(i = 0; i < 4; i++)
+            ASSERT_EQ(pthread_create(&clients[i], NULL, race_invoke, (i & 1) ? server_element : server_obj2), 0);
+        for(i = 0; i < 4; i++)
+            pthread_join(clients[i], NULL);
+
+        /*the server survived the race and keeps serving both objects*/
+        sleep((2 * RACE_TEST_DURATION) / 1000);
+        EXPECT_EQ(rbus_pullObj(server_obj2, 1000, &response), RTMESSAGE_BUS_SUCCESS);
+        if(response)
+            rbusMessage_Release(response);
+        response = NULL;
+        EXPECT_EQ(rbus_pullObj(server_obj1, 1000, &response), RTMESSAGE_BUS_SUCCESS);
+        if(response)
+            rbusMessage_Release(response);
+        EXPECT_GT(__atomic_load_n(&race_events_received, __ATOMIC_RELAXED), 0);
+        rbus_unsubscribeFromEvent(server_obj1, "event_race", NULL);
+
+        if(conn_status)
+            CLOSE_BROKER_CONNECTION();
+
+        kill(pid,SIGTERM);
+        return;
+    }
+    else{
+        printf("fork failed \n");
+    }
+}
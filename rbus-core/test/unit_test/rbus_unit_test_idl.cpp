@@ -0,0 +1,285 @@
+/*
+  * If not stated otherwise in this file or this component's Licenses.txt file
+  * the following copyright and licenses apply:
+  *
+  * Copyright 2019 RDK Management
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+*/
+/*****************************************
+Test Case : Testing code generated by rbus_idl.py from rbus_test_idl.idl
+******************************************/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include "rbus_test_idl.h"
+#include "gtest_app.h"
+#include "rbus_test_util.h"
+
+static uint8_t const test_photo[] = {0x89, 'P', 'N', 'G', 0x00, 0xff};
+
+typedef struct
+{
+    student_t student;
+    int32_t updates;
+    char last_name[100];
+}test_registry_t;
+
+static rbus_error_t test_setStudentInfo(void* user_data, student_t const* student)
+{
+    test_registry_t* registry = (test_registry_t*)user_data;
+    registry->student = *student;
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+static rbus_error_t test_getStudentInfo(void* user_data, student_t* student)
+{
+    test_registry_t* registry = (test_registry_t*)user_data;
+    *student = registry->student;
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+static rbus_error_t test_update(void* user_data, char const* name, record_t const* record, int32_t* count, char const** previous)
+{
+    test_registry_t* registry = (test_registry_t*)user_data;
+    if(strcmp(name, record->name) != 0)
+        return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
+    *count = ++registry->updates;
+    *previous = registry->last_name;
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+static rbus_error_t test_lookup(void* user_data, char const* name, record_t* record, uint8_t const** thumbnail, uint32_t* thumbnail_length)
+{
+    test_registry_t* registry = (test_registry_t*)user_data;
+    if(strcmp(name, registry->last_name) != 0)
+        return RTMESSAGE_BUS_ERROR_INVALID_PARAM;
+    snprintf(record->name, sizeof(record->name), "%s", name);
+    record->age = 30;
+    record->status = true;
+    record->student = registry->student;
+    *thumbnail = test_photo;
+    *thumbnail_length = sizeof(test_photo);
+    return RTMESSAGE_BUS_SUCCESS;
+}
+
+static registry_ops_t const test_ops = { test_setStudentInfo, test_getStudentInfo, test_update, test_lookup };
+
+static void handle_idl_server_term(int sig)
+{
+    (void) sig;
+    rbus_closeBrokerConnection();
+    kill(getpid(), SIGKILL);
+}
+
+class TestIdlGenerator : public ::testing::Test{
+
+protected:
+
+void SetUp()
+{
+    memset(&registry, 0, sizeof(registry));
+    snprintf(registry.last_name, sizeof(registry.last_name), "%s", "alice");
+    server.ops = &test_ops;
+    server.user_data = &registry;
+}
+
+test_registry_t registry;
+registry_server_t server;
+};
+
+TEST_F(TestIdlGenerator, pack_unpack_test1)
+{
+    rbusMessage message;
+    record_t in, out;
+    int32_t age = 0;
+
+    memset(&in, 0, sizeof(in));
+    snprintf(in.name, sizeof(in.name), "%s", "bob");
+    in.age = 41;
+    in.status = true;
+    in.id = -9000000000LL;
+    in.score = 2.5;
+    in.photo = test_photo;
+    in.photo_length = sizeof(test_photo);
+    snprintf(in.student.object_name, sizeof(in.student.object_name), "%s", "school.class1");
+    snprintf(in.student.student_name, sizeof(in.student.student_name), "%s", "bob");
+
+    rbusMessage_Init(&message);
+    EXPECT_EQ(record_t_pack(message, &in), RT_OK);
+    /*fields go on the wire in declaration order, nested structs inline*/
+    EXPECT_EQ(rbusMessage_CountFields(message), 8u);
+    memset(&out, 0, sizeof(out));
+    EXPECT_EQ(record_t_unpack(message, &out), RT_OK);
+    EXPECT_STREQ(out.name, "bob");
+    EXPECT_EQ(out.age, 41);
+    EXPECT_TRUE(out.status);
+    EXPECT_EQ(out.id, -9000000000LL);
+    EXPECT_EQ(out.score, 2.5);
+    ASSERT_EQ(out.photo_length, sizeof(test_photo));
+    EXPECT_EQ(memcmp(out.photo, test_photo, sizeof(test_photo)), 0);
+    EXPECT_STREQ(out.student.object_name, "school.class1");
+    EXPECT_STREQ(out.student.student_name, "bob");
+
+    /*a message with the wrong layout fails as a whole*/
+    rbusMessage_Rewind(message);
+    rbusMessage_Skip(message, 1);
+    EXPECT_EQ(rbusMessage_GetInt32(message, &age), RT_OK);
+    EXPECT_NE(student_t_unpack(message, &out.student), RT_OK);
+    rbusMessage_Release(message);
+}
+
+TEST_F(TestIdlGenerator, dispatch_test1)
+{
+    rbusMessage request, response;
+    student_t student;
+    record_t record;
+    int32_t status = 0, count = 0;
+    char const* previous = NULL;
+    uint8_t const* thumbnail = NULL;
+    uint32_t length = 0;
+
+    memset(&student, 0, sizeof(student));
+    snprintf(student.object_name, sizeof(student.object_name), "%s", "school.class1");
+    snprintf(student.student_name, sizeof(student.student_name), "%s", "alice");
+    rbusMessage_Init(&request);
+    student_t_pack(request, &student);
+    EXPECT_EQ(registry_setStudentInfo_dispatch("obj", REGISTRY_SETSTUDENTINFO_METHOD, request, &server, &response, NULL), 0);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &status), RT_OK);
+    EXPECT_EQ(status, RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbusMessage_CountFields(response), 1u);
+    EXPECT_STREQ(registry.student.student_name, "alice");
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*the reply is the status followed by the outputs*/
+    memset(&record, 0, sizeof(record));
+    snprintf(record.name, sizeof(record.name), "%s", "carol");
+    rbusMessage_Init(&request);
+    rbusMessage_SetString(request, "carol");
+    record_t_pack(request, &record);
+    registry_update_dispatch("obj", REGISTRY_UPDATE_METHOD, request, &server, &response, NULL);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &status), RT_OK);
+    EXPECT_EQ(status, RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &count), RT_OK);
+    EXPECT_EQ(count, 1);
+    EXPECT_EQ(rbusMessage_GetString(response, &previous), RT_OK);
+    EXPECT_STREQ(previous, "alice");
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    rbusMessage_Init(&request);
+    rbusMessage_SetString(request, "alice");
+    registry_lookup_dispatch("obj", REGISTRY_LOOKUP_METHOD, request, &server, &response, NULL);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &status), RT_OK);
+    EXPECT_EQ(status, RTMESSAGE_BUS_SUCCESS);
+    memset(&record, 0, sizeof(record));
+    EXPECT_EQ(record_t_unpack(response, &record), RT_OK);
+    EXPECT_EQ(record.age, 30);
+    EXPECT_STREQ(record.student.object_name, "school.class1");
+    EXPECT_EQ(rbusMessage_GetBytes(response, &thumbnail, &length), RT_OK);
+    EXPECT_EQ(length, sizeof(test_photo));
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*an error from the handler sends only the status*/
+    rbusMessage_Init(&request);
+    rbusMessage_SetString(request, "dave");
+    registry_lookup_dispatch("obj", REGISTRY_LOOKUP_METHOD, request, &server, &response, NULL);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &status), RT_OK);
+    EXPECT_EQ(status, RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    EXPECT_EQ(rbusMessage_CountFields(response), 1u);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*a request that doesn't match the method is rejected before the handler runs*/
+    rbusMessage_Init(&request);
+    rbusMessage_SetInt32(request, 7);
+    registry_update_dispatch("obj", REGISTRY_UPDATE_METHOD, request, &server, &response, NULL);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &status), RT_OK);
+    EXPECT_EQ(status, RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    EXPECT_EQ(registry.updates, 1);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+}
+
+TEST_F(TestIdlGenerator, roundtrip_test1)
+{
+    char server_name[] = "idl_server";
+    char client_name[] = "idl_client";
+    student_t student;
+    record_t record;
+    rbusMessage response = NULL;
+    int32_t count = 0;
+    char const* previous = NULL;
+    uint8_t const* thumbnail = NULL;
+    uint32_t length = 0;
+    pid_t pid;
+
+    pid = fork();
+    if(pid == 0)
+    {
+        signal(SIGTERM, handle_idl_server_term);
+        EXPECT_EQ(rbus_openBrokerConnection(server_name), RTMESSAGE_BUS_SUCCESS);
+        EXPECT_EQ(rbus_registerObj("idl.registry", callback, NULL), RTMESSAGE_BUS_SUCCESS);
+        EXPECT_EQ(registry_register("idl.registry", &server), RTMESSAGE_BUS_SUCCESS);
+        pause();
+    }
+
+    sleep(2);
+    ASSERT_EQ(rbus_openBrokerConnection(client_name), RTMESSAGE_BUS_SUCCESS);
+
+    /*the proxies pack the inputs, the provider's stubs run the handlers and the replies are unpacked into the outputs*/
+    memset(&student, 0, sizeof(student));
+    snprintf(student.object_name, sizeof(student.object_name), "%s", "school.class1");
+    snprintf(student.student_name, sizeof(student.student_name), "%s", "alice");
+    EXPECT_EQ(registry_setStudentInfo("idl.registry", 1000, &student), RTMESSAGE_BUS_SUCCESS);
+    memset(&student, 0, sizeof(student));
+    EXPECT_EQ(registry_getStudentInfo("idl.registry", 1000, &student, &response), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_STREQ(student.student_name, "alice");
+    rbusMessage_Release(response);
+
+    memset(&record, 0, sizeof(record));
+    snprintf(record.name, sizeof(record.name), "%s", "carol");
+    EXPECT_EQ(registry_update("idl.registry", 1000, "carol", &record, &count, &previous, &response), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(count, 1);
+    EXPECT_STREQ(previous, "alice");
+    rbusMessage_Release(response);
+
+    memset(&record, 0, sizeof(record));
+    EXPECT_EQ(registry_lookup("idl.registry", 1000, "alice", &record, &thumbnail, &length, &response), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(record.age, 30);
+    EXPECT_STREQ(record.student.student_name, "alice");
+    ASSERT_EQ(length, sizeof(test_photo));
+    EXPECT_EQ(memcmp(thumbnail, test_photo, sizeof(test_photo)), 0);
+    rbusMessage_Release(response);
+
+    /*an error from the handler comes back as the status, with no reply to release*/
+    EXPECT_EQ(registry_lookup("idl.registry", 1000, "dave", &record, &thumbnail, &length, &response), RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    EXPECT_TRUE(response == NULL);
+
+    /*a registration that fails partway leaves none of the interface registered*/
+    EXPECT_EQ(rbus_registerObj("idl.partial", callback, NULL), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbus_registerMethod("idl.partial", REGISTRY_LOOKUP_METHOD, callback, NULL), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_NE(registry_register("idl.partial", &server), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_NE(rbus_unregisterMethod("idl.partial", REGISTRY_SETSTUDENTINFO_METHOD), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbus_unregisterMethod("idl.partial", REGISTRY_LOOKUP_METHOD), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(registry_register("idl.partial", &server), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(registry_unregister("idl.partial"), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_NE(rbus_unregisterMethod("idl.partial", REGISTRY_LOOKUP_METHOD), RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbus_unregisterObj("idl.partial"), RTMESSAGE_BUS_SUCCESS);
+
+    EXPECT_EQ(rbus_closeBrokerConnection(), RTMESSAGE_BUS_SUCCESS);
+    kill(pid, SIGTERM);
+}
@@ -23,10 +23,31 @@ Test Case : Testing Marshalling APIs
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <locale.h>
+#include <string>
 #include "rbus_message.h"
+#include "rbus_message.hpp"
+#include "rbus_rpc.hpp"
 
 extern "C" {
-
+/*meta section helpers used by rbus_core.c, not part of the public header*/
+void rbusMessage_BeginMetaSectionWrite(rbusMessage message);
+void rbusMessage_EndMetaSectionWrite(rbusMessage message);
+rtError rbusMessage_GetMetaMethod(rbusMessage message, char const** method);
+rtError rbusMessage_GetMetaEvent(rbusMessage message, char const** event_name, char const** object_name, int32_t* is_rbus2);
+int32_t rbusMessage_GetMetaFlags(rbusMessage message);
+uint64_t rbusMessage_GetMetaDeadline(rbusMessage message);
+int rbusMessage_GetWireVersion(rbusMessage message);
+typedef struct _rbusMessageStringTable* rbusMessageStringTable;
+rbusMessageStringTable rbusMessageStringTable_Create(void);
+void rbusMessageStringTable_Reset(rbusMessageStringTable table);
+void rbusMessageStringTable_Destroy(rbusMessageStringTable table);
+rtError rbusMessage_ToBytesV2(rbusMessage message, rbusMessageStringTable table, uint32_t sequence, uint64_t deadline,
+    uint8_t** buff, uint32_t* n);
+void rbusMessage_ConfirmNames(rbusMessage message, rbusMessageStringTable table);
+rtError rbusMessage_ResolveNames(rbusMessage message, rbusMessageStringTable table);
+void rbusMessage_FromBytesAdopt(rbusMessage* message, uint8_t* buff, uint32_t n, void (*release_buffer)(uint8_t* buff));
+static void freeAdoptedBuffer(uint8_t* buff) { free(buff); }
 }
 #include "gtest_app.h"
 
@@ -805,3 +826,1492 @@ TEST_F(TestMarshallingAPIs, rbusMessage_SetMessage_test4)
     rbusMessage_Release(childMessage2);
     rbusMessage_Release(parentMessage);
 }
+
+TEST_F(TestMarshallingAPIs, rbusMessage_FromBytesNoCopy_test1)
+{
+    rbusMessage sourceMessage;
+    rbusMessage borrowedMessage;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint8_t* borrowedData = NULL;
+    uint32_t borrowedLength = 0;
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+
+    rbusMessage_Init(&sourceMessage);
+    rbusMessage_SetString(sourceMessage, "TestString1");
+    rbusMessage_SetInt32(sourceMessage, 1234);
+    rbusMessage_ToBytes(sourceMessage, &data, &length);
+
+    rbusMessage_FromBytesNoCopy(&borrowedMessage, data, length);
+    rbusMessage_ToBytes(borrowedMessage, &borrowedData, &borrowedLength);
+    EXPECT_EQ(borrowedData, data) << "rbusMessage_FromBytesNoCopy copied the buffer";
+    EXPECT_EQ(borrowedLength, length);
+    EXPECT_EQ(rbusMessage_GetString(borrowedMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "TestString1");
+    EXPECT_EQ((uint8_t const*)resultValue > data && (uint8_t const*)resultValue < data + length, true) << "string was not decoded in place";
+    EXPECT_EQ(rbusMessage_GetInt32(borrowedMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 1234);
+
+    rbusMessage_Release(borrowedMessage);
+    rbusMessage_Release(sourceMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_FromBytesNoCopy_test2)
+{
+    rbusMessage sourceMessage;
+    rbusMessage borrowedMessage;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint8_t* copy = NULL;
+    uint8_t* retainedData = NULL;
+    uint32_t retainedLength = 0;
+    const char* resultValue = NULL;
+
+    rbusMessage_Init(&sourceMessage);
+    rbusMessage_SetString(sourceMessage, "TestString1");
+    rbusMessage_ToBytes(sourceMessage, &data, &length);
+    copy = (uint8_t*)malloc(length);
+    memcpy(copy, data, length);
+
+    /*retaining a borrowed message must detach it from the transport buffer*/
+    rbusMessage_FromBytesNoCopy(&borrowedMessage, copy, length);
+    rbusMessage_Retain(borrowedMessage);
+    rbusMessage_Release(borrowedMessage);
+    rbusMessage_ToBytes(borrowedMessage, &retainedData, &retainedLength);
+    EXPECT_NE(retainedData, copy) << "rbusMessage_Retain did not detach the borrowed buffer";
+    memset(copy, 0, length);
+    free(copy);
+
+    EXPECT_EQ(retainedLength, length);
+    EXPECT_EQ(rbusMessage_GetString(borrowedMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "TestString1");
+
+    /*writing to a detached message works as for any other message*/
+    EXPECT_EQ(rbusMessage_SetString(borrowedMessage, "TestString2"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(borrowedMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "TestString2");
+
+    rbusMessage_Release(borrowedMessage);
+    rbusMessage_Release(sourceMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Pool_test1)
+{
+    rbusMessage testMessage;
+    rbusMessagePoolStats before, after;
+    const char* resultValue = NULL;
+    int i;
+
+    rbusMessage_ConfigurePool(4, 4096);
+    rbusMessage_GetPoolStats(&before);
+
+    for(i = 0; i < 10; i++)
+    {
+        rbusMessage_Init(&testMessage);
+        rbusMessage_SetString(testMessage, "TestString1");
+        EXPECT_EQ(rbusMessage_GetString(testMessage, &resultValue), RT_OK);
+        EXPECT_STREQ(resultValue, "TestString1");
+        rbusMessage_Release(testMessage);
+    }
+
+    rbusMessage_GetPoolStats(&after);
+    EXPECT_GE(after.hits - before.hits, 9u) << "released messages were not recycled";
+    EXPECT_LE(after.cached, 4u) << "free list grew past its high-water mark";
+
+    /*lowering the limit drains this thread's free list right away*/
+    rbusMessage_ConfigurePool(1, 4096);
+    rbusMessage_GetPoolStats(&after);
+    EXPECT_LE(after.cached, 1u);
+
+    rbusMessage_ConfigurePool(0, 0);
+    rbusMessage_GetPoolStats(&after);
+    EXPECT_EQ(after.cached, 0u);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_InlineStorage_test1)
+{
+    rbusMessage testMessage;
+    rbusMessage copiedMessage;
+    char value[2048];
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = 0;
+
+    /*start small, then spill past the inline buffer and through a couple of size classes*/
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, 42);
+    rbusMessage_SetString(testMessage, value);
+    rbusMessage_SetString(testMessage, value);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_FromBytes(&copiedMessage, data, length);
+
+    EXPECT_EQ(rbusMessage_GetInt32(copiedMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 42);
+    EXPECT_EQ(rbusMessage_GetString(copiedMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, value);
+    EXPECT_EQ(rbusMessage_GetString(copiedMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, value);
+
+    rbusMessage_Release(copiedMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_SizeOf_test1)
+{
+    static const int32_t ints[] = { 0, 1, 127, 128, 255, 256, 65535, 65536, -1, -32, -33, -128, -129, -32768, -32769, INT32_MIN, INT32_MAX };
+    static const int64_t longs[] = { 4294967295LL, 4294967296LL, -2147483648LL, -2147483649LL, INT64_MIN, INT64_MAX };
+    static const uint32_t binSizes[] = { 0, 255, 256, 65535, 65536 };
+    rbusMessage testMessage;
+    rbusMessage childMessage;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint32_t expected = 0;
+    std::string str;
+    size_t i;
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetString(childMessage, "child");
+
+    for(i = 0; i < sizeof(ints)/sizeof(ints[0]); i++)
+    {
+        rbusMessage_SetInt32(testMessage, ints[i]);
+        expected += rbusMessage_SizeOfInt32(ints[i]);
+    }
+    for(i = 0; i < sizeof(longs)/sizeof(longs[0]); i++)
+    {
+        rbusMessage_SetInt64(testMessage, longs[i]);
+        expected += rbusMessage_SizeOfInt64(longs[i]);
+    }
+    for(i = 0; i < sizeof(binSizes)/sizeof(binSizes[0]); i++)
+    {
+        str.assign(binSizes[i], 'a');
+        rbusMessage_SetString(testMessage, str.c_str());
+        expected += rbusMessage_SizeOfString(str.c_str());
+        rbusMessage_SetBytes(testMessage, (const uint8_t*)str.data(), binSizes[i]);
+        expected += rbusMessage_SizeOfBytes(binSizes[i]);
+    }
+    rbusMessage_SetDouble(testMessage, 1.5);
+    expected += rbusMessage_SizeOfDouble(1.5);
+    rbusMessage_SetMessage(testMessage, childMessage);
+    expected += rbusMessage_SizeOfMessage(childMessage);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    EXPECT_EQ(length, expected) << "size estimate does not match the encoded size";
+
+    rbusMessage_Release(childMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_InitWithCapacity_test1)
+{
+    rbusMessage testMessage;
+    std::string value(100000, 'v');
+    uint8_t* data = NULL;
+    uint8_t* dataBefore = NULL;
+    uint32_t length = 0;
+    const char* resultValue = NULL;
+    int i;
+
+    rbusMessage_InitWithCapacity(&testMessage, 10 * rbusMessage_SizeOfString(value.c_str()));
+    rbusMessage_ToBytes(testMessage, &dataBefore, &length);
+    for(i = 0; i < 10; i++)
+        rbusMessage_SetString(testMessage, value.c_str());
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    EXPECT_EQ(data, dataBefore) << "reserved message was reallocated";
+
+    for(i = 0; i < 10; i++)
+    {
+        EXPECT_EQ(rbusMessage_GetString(testMessage, &resultValue), RT_OK);
+        EXPECT_STREQ(resultValue, value.c_str());
+    }
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_GetMessage_View_test1)
+{
+    rbusMessage parentMessage, childMessage, nestedMessage, procuredMessage, procuredNested;
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+
+    rbusMessage_Init(&nestedMessage);
+    rbusMessage_SetString(nestedMessage, "nested");
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetInt32(childMessage, 42);
+    rbusMessage_SetMessage(childMessage, nestedMessage);
+    rbusMessage_Init(&parentMessage);
+    rbusMessage_SetMessage(parentMessage, childMessage);
+    rbusMessage_Release(nestedMessage);
+    rbusMessage_Release(childMessage);
+
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredMessage), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 42);
+    EXPECT_EQ(rbusMessage_GetMessage(procuredMessage, &procuredNested), RT_OK);
+    /*views keep the parent's buffer alive after the parent is released*/
+    rbusMessage_Release(parentMessage);
+    rbusMessage_Release(procuredMessage);
+    EXPECT_EQ(rbusMessage_GetString(procuredNested, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "nested");
+    rbusMessage_Release(procuredNested);
+
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetInt32(childMessage, 42);
+    rbusMessage_Init(&parentMessage);
+    rbusMessage_SetMessage(parentMessage, childMessage);
+    rbusMessage_Release(childMessage);
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredMessage), RT_OK);
+    /*writing to a view gives it a private copy*/
+    rbusMessage_SetString(procuredMessage, "appended");
+    rbusMessage_Release(parentMessage);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 42);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "appended");
+    rbusMessage_Release(procuredMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_GetMessage_View_test2)
+{
+    rbusMessage parentMessage, childMessage, procuredMessage, procuredSmall;
+    std::string large(8192, 'x');
+    std::string growth(65536, 'y');
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetString(childMessage, large.c_str());
+    rbusMessage_Init(&parentMessage);
+    rbusMessage_SetMessage(parentMessage, childMessage);
+    rbusMessage_Release(childMessage);
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetInt32(childMessage, 7);
+    rbusMessage_SetMessage(parentMessage, childMessage);
+    rbusMessage_Release(childMessage);
+
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredMessage), RT_OK);
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredSmall), RT_OK);
+    /*the parent outgrows the buffer its views point into, twice*/
+    EXPECT_EQ(rbusMessage_SetString(parentMessage, growth.c_str()), RT_OK);
+    EXPECT_EQ(rbusMessage_SetString(parentMessage, growth.c_str()), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_EQ(large, resultValue);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredSmall, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 7);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(procuredSmall);
+    EXPECT_EQ(rbusMessage_GetString(parentMessage, &resultValue), RT_OK);
+    EXPECT_EQ(growth, resultValue);
+    rbusMessage_Release(parentMessage);
+
+    /*a parent small enough for its inline storage*/
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetInt32(childMessage, 42);
+    rbusMessage_Init(&parentMessage);
+    rbusMessage_SetMessage(parentMessage, childMessage);
+    rbusMessage_Release(childMessage);
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredMessage), RT_OK);
+    EXPECT_EQ(rbusMessage_SetString(parentMessage, growth.c_str()), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 42);
+    rbusMessage_Release(procuredMessage);
+
+    /*and one whose buffer was adopted from the transport*/
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    rbusMessage_ToBytes(parentMessage, &data, &length);
+    uint8_t* adopted = (uint8_t*)malloc(length);
+    memcpy(adopted, data, length);
+    rbusMessage_Release(parentMessage);
+    rbusMessage_FromBytesAdopt(&parentMessage, adopted, length, freeAdoptedBuffer);
+    EXPECT_EQ(rbusMessage_GetMessage(parentMessage, &procuredMessage), RT_OK);
+    EXPECT_EQ(rbusMessage_SetInt32(parentMessage, 1), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 42);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(parentMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_MetaSection_test1)
+{
+    rbusMessage requestMessage, eventMessage, procuredMessage;
+    const char* method = NULL;
+    const char* eventName = NULL;
+    const char* objectName = NULL;
+    int32_t isRbus2 = 0;
+    int32_t resultInt = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+
+    rbusMessage_Init(&requestMessage);
+    rbusMessage_SetInt32(requestMessage, 7);
+    rbusMessage_BeginMetaSectionWrite(requestMessage);
+    rbusMessage_SetString(requestMessage, "method.one");
+    rbusMessage_EndMetaSectionWrite(requestMessage);
+    rbusMessage_ToBytes(requestMessage, &data, &length);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method.one");
+    EXPECT_NE(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    /*the sequential cursor is untouched*/
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 7);
+    rbusMessage_Release(procuredMessage);
+
+    /*a message that is still being written reparses after every write*/
+    rbusMessage_BeginMetaSectionWrite(requestMessage);
+    rbusMessage_SetString(requestMessage, "method.two");
+    rbusMessage_EndMetaSectionWrite(requestMessage);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(requestMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method.two");
+    rbusMessage_Release(requestMessage);
+
+    rbusMessage_Init(&eventMessage);
+    rbusMessage_BeginMetaSectionWrite(eventMessage);
+    rbusMessage_SetString(eventMessage, "Device.Event!");
+    rbusMessage_SetString(eventMessage, "Device.Object");
+    rbusMessage_SetInt32(eventMessage, 1);
+    rbusMessage_EndMetaSectionWrite(eventMessage);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(eventMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(eventName, "Device.Event!");
+    EXPECT_STREQ(objectName, "Device.Object");
+    EXPECT_EQ(isRbus2, 1);
+    rbusMessage_Release(eventMessage);
+
+    /*no meta section at all*/
+    rbusMessage_Init(&eventMessage);
+    EXPECT_NE(rbusMessage_GetMetaMethod(eventMessage, &method), RT_OK);
+    rbusMessage_Release(eventMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_WireV2_test1)
+{
+    rbusMessage requestMessage, eventMessage, procuredMessage, legacyMessage;
+    const char* method = NULL;
+    const char* eventName = NULL;
+    const char* objectName = NULL;
+    const char* resultValue = NULL;
+    int32_t isRbus2 = 0;
+    int32_t resultInt = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint8_t* legacyData = NULL;
+    uint32_t legacyLength = 0;
+
+    rbusMessage_Init(&requestMessage);
+    rbusMessage_SetInt32(requestMessage, 7);
+    rbusMessage_SetString(requestMessage, "payload");
+    rbusMessage_BeginMetaSectionWrite(requestMessage);
+    rbusMessage_SetString(requestMessage, "method.one");
+    rbusMessage_SetInt32(requestMessage, 1);
+    rbusMessage_EndMetaSectionWrite(requestMessage);
+    rbusMessage_ToBytes(requestMessage, &legacyData, &legacyLength);
+    rbusMessage_FromBytes(&legacyMessage, legacyData, legacyLength);
+
+    ASSERT_EQ(rbusMessage_ToBytesV2(requestMessage, NULL, 42, 1234567, &data, &length), RT_OK);
+    EXPECT_EQ(data[0], 0xC1);
+    EXPECT_EQ(rbusMessage_GetWireVersion(requestMessage), 2);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_GetWireVersion(procuredMessage), 2);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method.one");
+    EXPECT_EQ(rbusMessage_GetMetaFlags(procuredMessage), 1);
+    EXPECT_EQ(rbusMessage_GetMetaDeadline(procuredMessage), 1234567u);
+    EXPECT_NE(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 7);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "payload");
+    /*the routing names are not part of the body*/
+    EXPECT_NE(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    rbusMessage_Release(procuredMessage);
+
+    /*v0 messages from old peers still decode*/
+    EXPECT_EQ(rbusMessage_GetWireVersion(legacyMessage), 0);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(legacyMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method.one");
+    EXPECT_EQ(rbusMessage_GetInt32(legacyMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 7);
+    /*no headroom in front of bytes received as v0, so these stay v0*/
+    EXPECT_NE(rbusMessage_ToBytesV2(legacyMessage, NULL, 1, 0, &data, &length), RT_OK);
+    rbusMessage_Release(legacyMessage);
+
+    /*writing after encoding drops the routing, which is written again before resending*/
+    rbusMessage_SetInt32(requestMessage, 8);
+    rbusMessage_BeginMetaSectionWrite(requestMessage);
+    rbusMessage_SetString(requestMessage, "method.two");
+    rbusMessage_EndMetaSectionWrite(requestMessage);
+    ASSERT_EQ(rbusMessage_ToBytesV2(requestMessage, NULL, 43, 0, &data, &length), RT_OK);
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method.two");
+    EXPECT_EQ(rbusMessage_GetMetaFlags(procuredMessage), 0);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 8);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(requestMessage);
+
+    rbusMessage_Init(&eventMessage);
+    rbusMessage_SetString(eventMessage, "value");
+    rbusMessage_BeginMetaSectionWrite(eventMessage);
+    rbusMessage_SetString(eventMessage, "Device.Event!");
+    rbusMessage_SetString(eventMessage, "Device.Object");
+    rbusMessage_SetInt32(eventMessage, 1);
+    rbusMessage_EndMetaSectionWrite(eventMessage);
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, NULL, 1, 0, &data, &length), RT_OK);
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(eventName, "Device.Event!");
+    EXPECT_STREQ(objectName, "Device.Object");
+    EXPECT_EQ(isRbus2, 1);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "value");
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(eventMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_StringTable_test1)
+{
+    rbusMessageStringTable sender = rbusMessageStringTable_Create();
+    rbusMessageStringTable receiver = rbusMessageStringTable_Create();
+    rbusMessage eventMessage, procuredMessage;
+    const char* eventName = NULL;
+    const char* objectName = NULL;
+    const char* resultValue = NULL;
+    int32_t isRbus2 = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint32_t definedLength = 0;
+    std::string copy;
+
+    rbusMessage_Init(&eventMessage);
+    rbusMessage_SetString(eventMessage, "value");
+    rbusMessage_BeginMetaSectionWrite(eventMessage);
+    rbusMessage_SetString(eventMessage, "Device.WiFi.Radio.1.Stats.Event!");
+    rbusMessage_SetString(eventMessage, "Device.WiFi.Radio.1.Stats");
+    rbusMessage_SetInt32(eventMessage, 1);
+    rbusMessage_EndMetaSectionWrite(eventMessage);
+
+    /*names are defined until a message carrying them has been sent*/
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, sender, 1, 0, &data, &length), RT_OK);
+    definedLength = length;
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, sender, 2, 0, &data, &length), RT_OK);
+    EXPECT_EQ(length, definedLength);
+    copy.assign((const char*)data, length);
+    rbusMessage_ConfirmNames(eventMessage, sender);
+
+    rbusMessage_FromBytes(&procuredMessage, (const uint8_t*)copy.data(), copy.size());
+    EXPECT_NE(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_EQ(rbusMessage_ResolveNames(procuredMessage, receiver), RT_OK);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(eventName, "Device.WiFi.Radio.1.Stats.Event!");
+    EXPECT_STREQ(objectName, "Device.WiFi.Radio.1.Stats");
+    EXPECT_EQ(isRbus2, 1);
+    rbusMessage_Release(procuredMessage);
+
+    /*then only ids are sent*/
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, sender, 3, 0, &data, &length), RT_OK);
+    EXPECT_LT(length + 50, definedLength);
+    copy.assign((const char*)data, length);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, (const uint8_t*)copy.data(), copy.size());
+    EXPECT_EQ(rbusMessage_ResolveNames(procuredMessage, receiver), RT_OK);
+    rbusMessage_Retain(procuredMessage); /*takes a private copy; the names must survive it*/
+    rbusMessage_Release(procuredMessage);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(eventName, "Device.WiFi.Radio.1.Stats.Event!");
+    EXPECT_STREQ(objectName, "Device.WiFi.Radio.1.Stats");
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "value");
+    rbusMessage_Release(procuredMessage);
+
+    /*a receiver that lost its table can't resolve ids until the sender resets*/
+    rbusMessageStringTable_Reset(receiver);
+    rbusMessage_FromBytes(&procuredMessage, (const uint8_t*)copy.data(), copy.size());
+    EXPECT_NE(rbusMessage_ResolveNames(procuredMessage, receiver), RT_OK);
+    rbusMessage_Release(procuredMessage);
+    rbusMessageStringTable_Reset(sender);
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, sender, 4, 0, &data, &length), RT_OK);
+    EXPECT_EQ(length, definedLength);
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_ResolveNames(procuredMessage, receiver), RT_OK);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(eventName, "Device.WiFi.Radio.1.Stats.Event!");
+    rbusMessage_Release(procuredMessage);
+
+    /*without a table the names go out in full again*/
+    ASSERT_EQ(rbusMessage_ToBytesV2(eventMessage, NULL, 5, 0, &data, &length), RT_OK);
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_GetMetaEvent(procuredMessage, &eventName, &objectName, &isRbus2), RT_OK);
+    EXPECT_STREQ(objectName, "Device.WiFi.Radio.1.Stats");
+    rbusMessage_Release(procuredMessage);
+
+    rbusMessage_Release(eventMessage);
+    rbusMessageStringTable_Destroy(sender);
+    rbusMessageStringTable_Destroy(receiver);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_NumericArray_test1)
+{
+    rbusMessage testMessage;
+    int32_t int32Values[37], int32Result[37];
+    int64_t int64Values[37], int64Result[37];
+    double doubleValues[37], doubleResult[37];
+    uint32_t count = 0;
+    uint32_t expected = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    int32_t resultInt = 0;
+    int i;
+
+    for(i = 0; i < 37; i++)
+    {
+        int32Values[i] = (int32_t)(0x01020304 * (i + 1)) - i;
+        int64Values[i] = (int64_t)0x0102030405060708LL * (i + 1) - i;
+        doubleValues[i] = -1.25 * i;
+    }
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32Array(testMessage, int32Values, 37);
+    expected += rbusMessage_SizeOfInt32Array(37);
+    rbusMessage_SetInt64Array(testMessage, int64Values, 37);
+    expected += rbusMessage_SizeOfInt64Array(37);
+    rbusMessage_SetDoubleArray(testMessage, doubleValues, 37);
+    expected += rbusMessage_SizeOfDoubleArray(37);
+    rbusMessage_SetInt32Array(testMessage, int32Values, 1);
+    expected += rbusMessage_SizeOfInt32Array(1);
+    rbusMessage_SetDoubleArray(testMessage, doubleValues, 0);
+    expected += rbusMessage_SizeOfDoubleArray(0);
+    rbusMessage_SetInt32(testMessage, 99);
+    expected += rbusMessage_SizeOfInt32(99);
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    EXPECT_EQ(length, expected);
+
+    /*too small: fails, reports the size needed, and leaves the field unread*/
+    EXPECT_NE(rbusMessage_GetInt32Array(testMessage, int32Result, 10, &count), RT_OK);
+    EXPECT_EQ(count, 37u);
+    /*wrong type: fails without consuming the field*/
+    EXPECT_NE(rbusMessage_GetDoubleArray(testMessage, doubleResult, 37, &count), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32Array(testMessage, int32Result, 37, &count), RT_OK);
+    EXPECT_EQ(count, 37u);
+    EXPECT_EQ(memcmp(int32Result, int32Values, sizeof(int32Values)), 0);
+    EXPECT_EQ(rbusMessage_GetInt64Array(testMessage, int64Result, 37, &count), RT_OK);
+    EXPECT_EQ(count, 37u);
+    EXPECT_EQ(memcmp(int64Result, int64Values, sizeof(int64Values)), 0);
+    EXPECT_EQ(rbusMessage_GetDoubleArray(testMessage, doubleResult, 37, &count), RT_OK);
+    EXPECT_EQ(count, 37u);
+    EXPECT_EQ(memcmp(doubleResult, doubleValues, sizeof(doubleValues)), 0);
+    EXPECT_EQ(rbusMessage_GetInt32Array(testMessage, int32Result, 37, &count), RT_OK);
+    EXPECT_EQ(count, 1u);
+    EXPECT_EQ(int32Result[0], int32Values[0]);
+    EXPECT_EQ(rbusMessage_GetDoubleArray(testMessage, doubleResult, 37, &count), RT_OK);
+    EXPECT_EQ(count, 0u);
+    EXPECT_EQ(rbusMessage_GetInt32(testMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 99);
+    rbusMessage_Release(testMessage);
+
+    /*elements are big-endian on the wire*/
+    int32Values[0] = 0x01020304;
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32Array(testMessage, int32Values, 1);
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    ASSERT_EQ(length, 6u);
+    EXPECT_EQ(data[2], 0x01);
+    EXPECT_EQ(data[5], 0x04);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Segments_test1)
+{
+    rbusMessage testMessage, childMessage, copyMessage, procuredMessage;
+    std::string blob(5000, 'b');
+    struct iovec iov[8];
+    uint32_t count = 0;
+    uint32_t total = 0;
+    uint32_t expected = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint8_t const* resultBytes = NULL;
+    uint32_t resultSize = 0;
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+    std::string flat;
+    uint32_t i;
+
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetString(childMessage, "child");
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, 1);
+    expected += rbusMessage_SizeOfInt32(1);
+    rbusMessage_SetBytesRef(testMessage, (uint8_t const*)blob.data(), blob.size());
+    expected += rbusMessage_SizeOfBytes(blob.size());
+    rbusMessage_AppendMessage(testMessage, childMessage);
+    expected += rbusMessage_SizeOfMessage(childMessage);
+    rbusMessage_Release(childMessage);
+    rbusMessage_SetInt32(testMessage, 2);
+    expected += rbusMessage_SizeOfInt32(2);
+
+    EXPECT_NE(rbusMessage_ToIovec(testMessage, iov, 2, &count), RT_OK);
+    EXPECT_EQ(count, 5u);
+    ASSERT_EQ(rbusMessage_ToIovec(testMessage, iov, 8, &count), RT_OK);
+    ASSERT_EQ(count, 5u);
+    EXPECT_EQ(iov[1].iov_base, (void*)blob.data()) << "referenced bytes were copied";
+    for(i = 0; i < count; i++)
+    {
+        flat.append((const char*)iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    EXPECT_EQ(total, expected);
+
+    /*copying the whole message keeps its segments intact*/
+    rbusMessage_Init(&copyMessage);
+    rbusMessage_SetMessage(copyMessage, testMessage);
+    EXPECT_EQ(rbusMessage_ToIovec(testMessage, iov, 8, &count), RT_OK);
+    EXPECT_EQ(count, 5u);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    ASSERT_EQ(length, expected);
+    EXPECT_EQ(memcmp(data, flat.data(), length), 0);
+    EXPECT_EQ(rbusMessage_GetInt32(testMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 1);
+    EXPECT_EQ(rbusMessage_GetBytes(testMessage, &resultBytes, &resultSize), RT_OK);
+    EXPECT_EQ(std::string((const char*)resultBytes, resultSize), blob);
+    EXPECT_EQ(rbusMessage_GetMessage(testMessage, &procuredMessage), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "child");
+    rbusMessage_Release(procuredMessage);
+    EXPECT_EQ(rbusMessage_GetInt32(testMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 2);
+    rbusMessage_Release(testMessage);
+
+    EXPECT_EQ(rbusMessage_GetMessage(copyMessage, &procuredMessage), RT_OK);
+    rbusMessage_ToBytes(procuredMessage, &data, &length);
+    ASSERT_EQ(length, flat.size());
+    EXPECT_EQ(memcmp(data, flat.data(), length), 0);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(copyMessage);
+}
+
+#ifdef ENABLE_RBUS_COMPRESSION
+extern "C" rtError rbusMessage_Compress(rbusMessage message, uint32_t threshold, rbusMessage* compressed);
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Compress_test1)
+{
+    rbusMessage testMessage, compressedMessage, procuredMessage;
+    std::string value(20000, 'c');
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint8_t* compressedData = NULL;
+    uint32_t compressedLength = 0;
+    const char* resultValue = NULL;
+    const char* method = NULL;
+    int32_t resultInt = 0;
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, 5);
+    rbusMessage_SetString(testMessage, value.c_str());
+    rbusMessage_BeginMetaSectionWrite(testMessage);
+    rbusMessage_SetString(testMessage, "method");
+    rbusMessage_EndMetaSectionWrite(testMessage);
+
+    /*below the threshold nothing is compressed*/
+    EXPECT_EQ(rbusMessage_Compress(testMessage, 100000, &compressedMessage), RT_OK);
+    EXPECT_TRUE(compressedMessage == NULL);
+
+    EXPECT_EQ(rbusMessage_Compress(testMessage, 1024, &compressedMessage), RT_OK);
+    ASSERT_TRUE(compressedMessage != NULL);
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_ToBytes(compressedMessage, &compressedData, &compressedLength);
+    EXPECT_LT(compressedLength, length / 10);
+
+    /*decoding restores the original message*/
+    rbusMessage_FromBytesNoCopy(&procuredMessage, compressedData, compressedLength);
+    rbusMessage_Release(compressedMessage);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method");
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 5);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, value.c_str());
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+
+    /*incompressible data is sent as is*/
+    uint32_t state = 2463534242u;
+    for(size_t i = 0; i < value.size(); i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        value[i] = (char)state;
+    }
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetBytes(testMessage, (const uint8_t*)value.data(), value.size());
+    EXPECT_EQ(rbusMessage_Compress(testMessage, 1024, &compressedMessage), RT_OK);
+    EXPECT_TRUE(compressedMessage == NULL);
+    rbusMessage_Release(testMessage);
+
+    /*a megabyte of zeros still inflates*/
+    std::string zeros(1 << 20, '\0');
+    uint8_t const* zbuf = NULL;
+    uint32_t zlen = 0;
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetBytes(testMessage, (const uint8_t*)zeros.data(), zeros.size());
+    ASSERT_EQ(rbusMessage_Compress(testMessage, 1024, &compressedMessage), RT_OK);
+    ASSERT_TRUE(compressedMessage != NULL);
+    rbusMessage_ToBytes(compressedMessage, &compressedData, &compressedLength);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, compressedData, compressedLength);
+    EXPECT_EQ(rbusMessage_GetBytes(procuredMessage, &zbuf, &zlen), RT_OK);
+    EXPECT_EQ(zlen, zeros.size());
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+
+    /*an original size the stream can't inflate to is rejected before anything is allocated, leaving the message as is*/
+    EXPECT_EQ(rbusMessage_GetInt32(compressedMessage, &resultInt), RT_OK);
+    EXPECT_EQ(rbusMessage_GetBytes(compressedMessage, &zbuf, &zlen), RT_OK);
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, INT32_MAX);
+    rbusMessage_SetBytes(testMessage, zbuf, zlen);
+    rbusMessage_BeginMetaSectionWrite(testMessage);
+    rbusMessage_SetString(testMessage, "_rbus_zlib");
+    rbusMessage_EndMetaSectionWrite(testMessage);
+    rbusMessage_Release(compressedMessage);
+    rbusMessage_ToBytes(testMessage, &compressedData, &compressedLength);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, compressedData, compressedLength);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, INT32_MAX);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Compress_test2)
+{
+    rbusMessageStringTable sender = rbusMessageStringTable_Create();
+    rbusMessageStringTable receiver = rbusMessageStringTable_Create();
+    rbusMessage testMessage, compressedMessage, procuredMessage;
+    std::string value(20000, 'c');
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    const char* resultValue = NULL;
+    const char* method = NULL;
+    int32_t resultInt = 0;
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, 5);
+    rbusMessage_SetString(testMessage, value.c_str());
+    rbusMessage_BeginMetaSectionWrite(testMessage);
+    rbusMessage_SetString(testMessage, "method");
+    rbusMessage_EndMetaSectionWrite(testMessage);
+
+    /*sent in v2 against a string table, the compressed message is decoded the way onMessage does it*/
+    ASSERT_EQ(rbusMessage_Compress(testMessage, 1024, &compressedMessage), RT_OK);
+    ASSERT_TRUE(compressedMessage != NULL);
+    ASSERT_EQ(rbusMessage_ToBytesV2(compressedMessage, sender, 1, 0, &data, &length), RT_OK);
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    rbusMessage_ConfirmNames(compressedMessage, sender);
+    rbusMessage_Release(compressedMessage);
+    EXPECT_EQ(rbusMessage_ResolveNames(procuredMessage, receiver), RT_OK);
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "method");
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 5);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, value.c_str());
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+
+    rbusMessageStringTable_Destroy(sender);
+    rbusMessageStringTable_Destroy(receiver);
+}
+#endif
+
+TEST_F(TestMarshallingAPIs, rbusMessage_NameTable_test1)
+{
+    rbusMessage plainMessage, testMessage, procuredMessage;
+    std::string names[64];
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    uint32_t plainLength = 0;
+    const char* resultValue = NULL;
+    const char* method = NULL;
+    int32_t resultInt = 0;
+    int i;
+
+    for(i = 0; i < 64; i++)
+        names[i] = "Device.WiFi.AccessPoint.3.AssociatedDevice." + std::to_string(i / 4 + 1) + (i % 2 ? ".SignalStrength" : ".MACAddress");
+
+    rbusMessage_Init(&plainMessage);
+    rbusMessage_Init(&testMessage);
+    rbusMessage_EnableNameTable(testMessage, 1);
+    for(i = 0; i < 64; i++)
+    {
+        rbusMessage_SetString(plainMessage, names[i].c_str());
+        rbusMessage_SetString(testMessage, names[i].c_str());
+        rbusMessage_SetInt32(plainMessage, i);
+        rbusMessage_SetInt32(testMessage, i);
+    }
+    rbusMessage_SetString(testMessage, "x");
+    rbusMessage_SetString(testMessage, "");
+    rbusMessage_SetString(testMessage, names[0].c_str());
+    rbusMessage_BeginMetaSectionWrite(testMessage);
+    rbusMessage_SetString(testMessage, "Device.WiFi.AccessPoint.3.AssociatedDevice.1.MACAddress");
+    rbusMessage_EndMetaSectionWrite(testMessage);
+
+    rbusMessage_ToBytes(plainMessage, &data, &plainLength);
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    EXPECT_LT(length, plainLength / 2);
+
+    rbusMessage_FromBytes(&procuredMessage, data, length);
+    rbusMessage_Release(testMessage);
+    for(i = 0; i < 64; i++)
+    {
+        EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+        EXPECT_STREQ(resultValue, names[i].c_str());
+        EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+        EXPECT_EQ(resultInt, i);
+    }
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "x");
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "");
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, names[0].c_str());
+    /*the meta section stays readable by older peers*/
+    EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+    EXPECT_STREQ(method, "Device.WiFi.AccessPoint.3.AssociatedDevice.1.MACAddress");
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(plainMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Decoder_test1)
+{
+    rbusMessage testMessage, procuredMessage;
+    int64_t int64Values[] = { 0, 127, 128, 255, 65535, 65536, INT64_MAX, -1, -32, -33, -128, -129, -32769, INT64_MIN };
+    int32_t int32Values[] = { INT32_MAX, INT32_MIN, -1, 300 };
+    const char* resultValue = NULL;
+    uint8_t const* resultBytes = NULL;
+    uint32_t resultSize = 0;
+    int64_t resultInt64 = 0;
+    int32_t resultInt32 = 0;
+    double resultDouble = 0;
+    std::string longString(70000, 's');
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    size_t i;
+
+    rbusMessage_Init(&testMessage);
+    for(i = 0; i < sizeof(int64Values) / sizeof(int64Values[0]); i++)
+        rbusMessage_SetInt64(testMessage, int64Values[i]);
+    for(i = 0; i < sizeof(int32Values) / sizeof(int32Values[0]); i++)
+        rbusMessage_SetInt32(testMessage, int32Values[i]);
+    rbusMessage_SetDouble(testMessage, -0.5);
+    rbusMessage_SetString(testMessage, longString.c_str());
+    rbusMessage_SetBytes(testMessage, (uint8_t const*)longString.data(), 300);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+    for(i = 0; i < sizeof(int64Values) / sizeof(int64Values[0]); i++)
+    {
+        EXPECT_EQ(rbusMessage_GetInt64(procuredMessage, &resultInt64), RT_OK);
+        EXPECT_EQ(resultInt64, int64Values[i]);
+    }
+    for(i = 0; i < sizeof(int32Values) / sizeof(int32Values[0]); i++)
+    {
+        EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt32), RT_OK);
+        EXPECT_EQ(resultInt32, int32Values[i]);
+    }
+    /*a type mismatch fails*/
+    EXPECT_NE(rbusMessage_GetInt32(procuredMessage, &resultInt32), RT_OK);
+    rbusMessage_Release(procuredMessage);
+
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+    for(i = 0; i < sizeof(int64Values) / sizeof(int64Values[0]) + sizeof(int32Values) / sizeof(int32Values[0]); i++)
+        rbusMessage_GetInt64(procuredMessage, &resultInt64);
+    EXPECT_EQ(rbusMessage_GetDouble(procuredMessage, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, -0.5);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_EQ(longString, resultValue);
+    EXPECT_EQ(rbusMessage_GetBytes(procuredMessage, &resultBytes, &resultSize), RT_OK);
+    EXPECT_EQ(resultSize, 300u);
+    EXPECT_NE(rbusMessage_GetBytes(procuredMessage, &resultBytes, &resultSize), RT_OK);
+    rbusMessage_Release(procuredMessage);
+
+    rbusMessage_Release(testMessage);
+
+    /*a truncated item fails rather than reading past the end*/
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetBytes(testMessage, (uint8_t const*)longString.data(), 300);
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_FromBytes(&procuredMessage, data, length - 1);
+    EXPECT_NE(rbusMessage_GetBytes(procuredMessage, &resultBytes, &resultSize), RT_OK);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_FromBytes(&procuredMessage, data, 2);
+    EXPECT_NE(rbusMessage_GetBytes(procuredMessage, &resultBytes, &resultSize), RT_OK);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Cursor_test1)
+{
+    rbusMessage testMessage, childMessage, procuredMessage;
+    int32_t values[3] = { 1, 2, 3 };
+    const char* resultValue = NULL;
+    int32_t resultInt = 0;
+    double resultDouble = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+
+    rbusMessage_Init(&childMessage);
+    rbusMessage_SetInt32(childMessage, 9);
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_SetInt32(testMessage, -5);
+    rbusMessage_SetString(testMessage, "Device.DeviceInfo.SerialNumber");
+    rbusMessage_SetDouble(testMessage, 2.5);
+    rbusMessage_SetBytes(testMessage, (uint8_t const*)"abc", 3);
+    rbusMessage_SetMessage(testMessage, childMessage);
+    rbusMessage_SetInt32Array(testMessage, values, 3);
+    rbusMessage_SetInt32(testMessage, -100000); /*packs like a meta section trailer*/
+    rbusMessage_Release(childMessage);
+
+    /*no meta section yet*/
+    EXPECT_EQ(rbusMessage_CountFields(testMessage), 7u);
+    /*writing drops the index*/
+    rbusMessage_SetInt32(testMessage, 1);
+    EXPECT_EQ(rbusMessage_CountFields(testMessage), 8u);
+    rbusMessage_BeginMetaSectionWrite(testMessage);
+    rbusMessage_SetString(testMessage, "method");
+    rbusMessage_EndMetaSectionWrite(testMessage);
+    EXPECT_EQ(rbusMessage_CountFields(testMessage), 8u);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_INT);
+    EXPECT_EQ(rbusMessage_CountFields(procuredMessage), 8u);
+    EXPECT_EQ(rbusMessage_Skip(procuredMessage, 1), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_STRING);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "Device.DeviceInfo.SerialNumber");
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_DOUBLE);
+    EXPECT_EQ(rbusMessage_Skip(procuredMessage, 2), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_BYTES);
+    EXPECT_EQ(rbusMessage_Skip(procuredMessage, 1), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_INT32_ARRAY);
+    EXPECT_NE(rbusMessage_Skip(procuredMessage, 4), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_INT32_ARRAY);
+    EXPECT_EQ(rbusMessage_Skip(procuredMessage, 3), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_NONE);
+
+    EXPECT_EQ(rbusMessage_Seek(procuredMessage, 6), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, -100000);
+    EXPECT_EQ(rbusMessage_Seek(procuredMessage, 2), RT_OK);
+    EXPECT_EQ(rbusMessage_GetDouble(procuredMessage, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, 2.5);
+    EXPECT_EQ(rbusMessage_Seek(procuredMessage, 8), RT_OK);
+    EXPECT_NE(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_NE(rbusMessage_Seek(procuredMessage, 9), RT_OK);
+    rbusMessage_Rewind(procuredMessage);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, -5);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_GetAt_test1)
+{
+    rbusMessage testMessage[2], procuredMessage;
+    char const* resultValue = NULL;
+    char const* method = NULL;
+    int32_t resultInt = 0;
+    uint8_t* data[2];
+    uint32_t length[2];
+    uint8_t copy[4096];
+    char name[64];
+    int i, j;
+
+    for(j = 0; j < 2; j++)
+    {
+        rbusMessage_Init(&testMessage[j]);
+        rbusMessage_EnableFieldIndex(testMessage[j], j);
+        for(i = 0; i < 50; i++)
+        {
+            snprintf(name, sizeof(name), "Device.WiFi.SSID.%d.Name", i);
+            rbusMessage_SetString(testMessage[j], name);
+            rbusMessage_SetInt32(testMessage[j], i * 1000);
+        }
+        rbusMessage_BeginMetaSectionWrite(testMessage[j]);
+        rbusMessage_SetString(testMessage[j], "METHOD_SETPARAMETERVALUES");
+        rbusMessage_SetInt32(testMessage[j], 0);
+        rbusMessage_EndMetaSectionWrite(testMessage[j]);
+        rbusMessage_ToBytes(testMessage[j], &data[j], &length[j]);
+    }
+    /*4 bytes per field plus the ext header*/
+    EXPECT_EQ(length[1], length[0] + 400 + 4);
+    ASSERT_LE(length[1], sizeof(copy));
+
+    for(j = 0; j < 3; j++)
+    {
+        if(j < 2)
+        {
+            rbusMessage_FromBytesNoCopy(&procuredMessage, data[j], length[j]);
+        }
+        else
+        {
+            /*an index that is out of order is ignored*/
+            memcpy(copy, data[1], length[1]);
+            memcpy(copy + length[1] - 5 - 400 + 60 * 4, copy + length[1] - 5 - 400 + 59 * 4, 4);
+            rbusMessage_FromBytesNoCopy(&procuredMessage, copy, length[1]);
+        }
+        EXPECT_EQ(rbusMessage_GetInt32At(procuredMessage, 99, &resultInt), RT_OK);
+        EXPECT_EQ(resultInt, 49000);
+        EXPECT_EQ(rbusMessage_GetStringAt(procuredMessage, 60, &resultValue), RT_OK);
+        EXPECT_STREQ(resultValue, "Device.WiFi.SSID.30.Name");
+        EXPECT_NE(rbusMessage_GetInt32At(procuredMessage, 60, &resultInt), RT_OK);
+        EXPECT_NE(rbusMessage_GetInt32At(procuredMessage, 100, &resultInt), RT_OK);
+        EXPECT_EQ(rbusMessage_CountFields(procuredMessage), 100u);
+
+        /*the sequential position is untouched*/
+        EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+        EXPECT_STREQ(resultValue, "Device.WiFi.SSID.0.Name");
+        EXPECT_EQ(rbusMessage_GetInt32At(procuredMessage, 3, &resultInt), RT_OK);
+        EXPECT_EQ(resultInt, 1000);
+        EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+        EXPECT_EQ(resultInt, 0);
+
+        EXPECT_EQ(rbusMessage_GetMetaMethod(procuredMessage, &method), RT_OK);
+        EXPECT_STREQ(method, "METHOD_SETPARAMETERVALUES");
+        EXPECT_EQ(rbusMessage_GetMetaFlags(procuredMessage), 0);
+        rbusMessage_Release(procuredMessage);
+    }
+    rbusMessage_Release(testMessage[0]);
+    rbusMessage_Release(testMessage[1]);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Map_test1)
+{
+    rbusMessage testMessage, procuredMessage;
+    char const* resultValue = NULL;
+    int32_t resultInt = 0;
+    uint32_t count = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    char name[64];
+    int i;
+
+    rbusMessage_Init(&testMessage);
+    rbusMessage_EnableNameTable(testMessage, 1);
+    rbusMessage_SetInt32(testMessage, 7);
+    rbusMessage_SetMap(testMessage, 3);
+    rbusMessage_SetString(testMessage, "notify");
+    rbusMessage_SetInt32(testMessage, 1);
+    rbusMessage_SetString(testMessage, "access");
+    rbusMessage_SetString(testMessage, "readWrite");
+    rbusMessage_SetString(testMessage, "notify");
+    rbusMessage_SetInt32(testMessage, 2);
+    rbusMessage_SetMap(testMessage, 200);
+    for(i = 0; i < 200; i++)
+    {
+        snprintf(name, sizeof(name), "Device.WiFi.AccessPoint.%d.Enable", i);
+        rbusMessage_SetString(testMessage, name);
+        rbusMessage_SetInt32(testMessage, i);
+    }
+    rbusMessage_SetInt32(testMessage, 8);
+    EXPECT_EQ(rbusMessage_SizeOfMap(3), 1u);
+    EXPECT_EQ(rbusMessage_SizeOfMap(200), 3u);
+    EXPECT_EQ(rbusMessage_SizeOfMap(70000), 5u);
+
+    rbusMessage_ToBytes(testMessage, &data, &length);
+    rbusMessage_FromBytesNoCopy(&procuredMessage, data, length);
+    EXPECT_EQ(rbusMessage_CountFields(procuredMessage), 4u);
+    EXPECT_NE(rbusMessage_GetMapValue(procuredMessage, "notify"), RT_OK);
+    EXPECT_NE(rbusMessage_GetMap(procuredMessage, &count), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_MAP);
+
+    /*in order*/
+    EXPECT_EQ(rbusMessage_GetMap(procuredMessage, &count), RT_OK);
+    EXPECT_EQ(count, 3u);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "notify");
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 1);
+
+    /*by key; the first of duplicate keys wins*/
+    EXPECT_EQ(rbusMessage_GetMapValue(procuredMessage, "access"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(procuredMessage, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "readWrite");
+    EXPECT_EQ(rbusMessage_GetMapValue(procuredMessage, "notify"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 1);
+    EXPECT_NE(rbusMessage_GetMapValue(procuredMessage, "notif"), RT_OK);
+    EXPECT_NE(rbusMessage_GetMapValue(procuredMessage, "readWrite"), RT_OK);
+    rbusMessage_EndMapRead(procuredMessage);
+
+    /*keys written with the name table*/
+    EXPECT_EQ(rbusMessage_GetMap(procuredMessage, &count), RT_OK);
+    EXPECT_EQ(count, 200u);
+    EXPECT_EQ(rbusMessage_GetMapValue(procuredMessage, "Device.WiFi.AccessPoint.150.Enable"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 150);
+    EXPECT_EQ(rbusMessage_GetMapValue(procuredMessage, "Device.WiFi.AccessPoint.0.Enable"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 0);
+    EXPECT_NE(rbusMessage_GetMapValue(procuredMessage, "Device.WiFi.AccessPoint.200.Enable"), RT_OK);
+    rbusMessage_EndMapRead(procuredMessage);
+    EXPECT_EQ(rbusMessage_GetInt32(procuredMessage, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 8);
+    EXPECT_EQ(rbusMessage_PeekType(procuredMessage), RBUS_MESSAGE_FIELD_NONE);
+    rbusMessage_Release(procuredMessage);
+    rbusMessage_Release(testMessage);
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Cpp_test1)
+{
+    uint8_t const bytes[] = {1, 2, 3};
+    int32_t values[] = {4, 5};
+    int32_t resultValues[2] = {0};
+    uint32_t count = 0;
+    rbus::string_view resultValue;
+    rbus::span<uint8_t const> resultBytes;
+    int32_t resultInt = 0;
+    int64_t resultInt64 = 0;
+    double resultDouble = 0;
+
+    rbus::Message child;
+    child.setInt32(9);
+    rbus::Message testMessage;
+    testMessage.setString("Device.DeviceInfo.SerialNumber")
+        .setString(std::string("abc"))
+        .setBytes(bytes)
+        .setDouble(2.5)
+        .setMessage(child)
+        .setInt32Array(rbus::span<int32_t>(values));
+    EXPECT_EQ(testMessage.status(), RT_OK);
+
+    /*moving does not touch the reference count; sharing does*/
+    rbus::Message moved(std::move(testMessage));
+    EXPECT_FALSE(testMessage);
+    rbus::Message shared = moved.share();
+    EXPECT_EQ(shared.get(), moved.get());
+    moved.reset();
+    EXPECT_TRUE(shared);
+
+    rbus::span<uint8_t const> data = shared.bytes();
+    rbus::Message procuredMessage = rbus::Message::fromBytes(data.data(), (uint32_t)data.size());
+    EXPECT_EQ(procuredMessage.countFields(), 6u);
+    EXPECT_EQ(procuredMessage.getString(resultValue), RT_OK);
+    EXPECT_TRUE(resultValue == rbus::string_view("Device.DeviceInfo.SerialNumber"));
+    EXPECT_EQ(procuredMessage.getString(resultValue), RT_OK);
+    EXPECT_EQ(std::string(resultValue), "abc");
+    EXPECT_EQ(procuredMessage.peekType(), RBUS_MESSAGE_FIELD_BYTES);
+    EXPECT_EQ(procuredMessage.getBytes(resultBytes), RT_OK);
+    ASSERT_EQ(resultBytes.size(), 3u);
+    EXPECT_EQ(resultBytes[2], 3);
+    EXPECT_EQ(procuredMessage.getDouble(resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, 2.5);
+    {
+        rbus::Message procuredChild;
+        EXPECT_EQ(procuredMessage.getMessage(procuredChild), RT_OK);
+        EXPECT_EQ(procuredChild.getInt32(resultInt), RT_OK);
+        EXPECT_EQ(resultInt, 9);
+    }
+    EXPECT_EQ(rbusMessage_GetInt32Array(procuredMessage.get(), resultValues, 2, &count), RT_OK);
+    EXPECT_EQ(resultValues[1], 5);
+    EXPECT_NE(procuredMessage.getInt32(resultInt), RT_OK);
+
+    /*a failed set skips the rest*/
+    rbus::Message adopted = rbus::Message::adopt(procuredMessage.release());
+    EXPECT_FALSE(procuredMessage);
+    adopted.setInt64Array(rbus::span<int64_t const>(&resultInt64, 0x40000000)).setInt32(1);
+    EXPECT_NE(adopted.status(), RT_OK);
+    EXPECT_EQ(adopted.countFields(), 6u);
+}
+
+static int32_t rpcScale(int32_t value, double factor)
+{
+    return (int32_t)(value * factor);
+}
+
+/*a reply value that can't be packed*/
+struct RpcUnpackable {};
+
+namespace rbus
+{
+namespace detail
+{
+template<>
+struct Codec<RpcUnpackable>
+{
+    static rtError set(rbusMessage, RpcUnpackable const&) { return RT_FAIL; }
+};
+}
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Rpc_test1)
+{
+    rbusMessage request, response;
+    char const* resultValue = NULL;
+    int32_t resultInt = 0;
+    int64_t resultInt64 = 0;
+    double resultDouble = 0;
+    uint8_t* data = NULL;
+    uint32_t length = 0;
+    std::string prefix = "Device.";
+
+    /*the hash matches the one in the v2 header*/
+    static_assert(rbus::method_hash("") == 2166136261u, "FNV-1a offset basis");
+    rbusMessage_Init(&request);
+    rbusMessage_BeginMetaSectionWrite(request);
+    rbusMessage_SetString(request, "METHOD_GETPARAMETERVALUES");
+    rbusMessage_SetInt32(request, 0);
+    rbusMessage_EndMetaSectionWrite(request);
+    ASSERT_EQ(rbusMessage_ToBytesV2(request, NULL, 1, 0, &data, &length), RT_OK);
+    EXPECT_EQ(((uint32_t)data[4] << 24 | (uint32_t)data[5] << 16 | (uint32_t)data[6] << 8 | data[7]),
+        rbus::method_hash("METHOD_GETPARAMETERVALUES"));
+    rbusMessage_Release(request);
+
+    /*arguments are packed in order; literals go as strings*/
+    rbusMessage_Init(&request);
+    EXPECT_EQ(rbus::detail::pack(request, 5, (int64_t)-6, 1.5, "name", prefix), RT_OK);
+    EXPECT_EQ(rbusMessage_CountFields(request), 5u);
+    EXPECT_EQ(rbusMessage_GetInt32(request, &resultInt), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt64(request, &resultInt64), RT_OK);
+    EXPECT_EQ(rbusMessage_GetDouble(request, &resultDouble), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(request, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "name");
+    rbusMessage_Release(request);
+
+    /*a view needn't be terminated*/
+    rbusMessage_Init(&request);
+    EXPECT_EQ(rbus::detail::pack(request, rbus::string_view("Device.WiFi", 6)), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(request, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "Device");
+    rbusMessage_Release(request);
+
+    /*a handler returning a tuple*/
+    auto concat = [&prefix](rbus::string_view name, int32_t index) {
+        return std::make_tuple(prefix + std::string(name.data(), name.size()), index + 1);
+    };
+    rbusMessage_Init(&request);
+    rbus::detail::pack(request, "WiFi", 3);
+    rbus::detail::dispatch<decltype(concat)>("obj", "m", request, &concat, &response, NULL);
+    rbus::Result<std::string, int32_t> result;
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, RTMESSAGE_BUS_SUCCESS);
+    EXPECT_EQ(rbus::detail::unpack(response, result.values), RT_OK);
+    EXPECT_EQ(std::get<0>(result.values), "Device.WiFi");
+    EXPECT_EQ(std::get<1>(result.values), 4);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*a function pointer returning one value*/
+    auto scale = &rpcScale;
+    rbusMessage_Init(&request);
+    rbus::detail::pack(request, 10, 2.5);
+    rbus::detail::dispatch<decltype(scale)>("obj", "m", request, &scale, &response, NULL);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, 25);
+    rbusMessage_Release(response);
+
+    /*arguments that don't match the handler are rejected before it runs*/
+    bool invoked = false;
+    auto check = [&invoked](std::string, std::string) -> rbus::Result<> {
+        invoked = true;
+        return RTMESSAGE_BUS_ERROR_GENERAL;
+    };
+    rbus::detail::dispatch<decltype(check)>("obj", "m", request, &check, &response, NULL);
+    EXPECT_FALSE(invoked);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, RTMESSAGE_BUS_ERROR_INVALID_PARAM);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*a handler failing with an error sends only the status*/
+    rbusMessage_Init(&request);
+    rbus::detail::pack(request, "a", "b");
+    rbus::detail::dispatch<decltype(check)>("obj", "m", request, &check, &response, NULL);
+    EXPECT_TRUE(invoked);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, RTMESSAGE_BUS_ERROR_GENERAL);
+    EXPECT_EQ(rbusMessage_CountFields(response), 1u);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+
+    /*a reply that can't be packed is replaced by an error rather than sent in part*/
+    auto broken = []() { return std::make_tuple((int32_t)1, RpcUnpackable()); };
+    rbusMessage_Init(&request);
+    rbus::detail::dispatch<decltype(broken)>("obj", "m", request, &broken, &response, NULL);
+    EXPECT_EQ(rbusMessage_CountFields(response), 1u);
+    EXPECT_EQ(rbusMessage_GetInt32(response, &resultInt), RT_OK);
+    EXPECT_EQ(resultInt, RTMESSAGE_BUS_ERROR_GENERAL);
+    rbusMessage_Release(response);
+    rbusMessage_Release(request);
+}
+
+static int jsonAbortWriter(void* user_data, char const* data, uint32_t length)
+{
+    (void)data;
+    (void)length;
+    ++*(int*)user_data;
+    return -1;
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Json_test1)
+{
+    rbusMessage message, parsed, item;
+    char* json = NULL;
+    char* json2 = NULL;
+    uint32_t length = 0, length2 = 0, count = 0;
+    int32_t const numbers[] = {1, -2, 2147483647};
+    double const ratios[] = {0.5, -1e300};
+    uint8_t const bytes[] = {0x00, 0xfb, 0xff, 'a'};
+    uint8_t const* resultBytes = NULL;
+    char const* resultValue = NULL;
+    int64_t resultInt64 = 0;
+    double resultDouble = 0;
+    int calls = 0;
+
+    rbusMessage_Init(&item);
+    rbusMessage_SetInt32(item, 7);
+    rbusMessage_Init(&message);
+    rbusMessage_EnableNameTable(message, 1);
+    rbusMessage_SetString(message, "Device.WiFi.Radio.1.Enable");
+    rbusMessage_SetString(message, "Device.WiFi.Radio.1.Channel");
+    rbusMessage_SetString(message, "quote\" slash\\ tab\t nl\n ctl\x01 utf8 \xc3\xa9");
+    rbusMessage_SetInt32(message, -5);
+    rbusMessage_SetInt64(message, INT64_MIN);
+    rbusMessage_SetDouble(message, 2.0);
+    rbusMessage_SetDouble(message, 0.1);
+    rbusMessage_SetBytes(message, bytes, sizeof(bytes));
+    rbusMessage_SetMessage(message, item);
+    rbusMessage_SetInt32Array(message, numbers, 3);
+    rbusMessage_SetDoubleArray(message, ratios, 2);
+    rbusMessage_SetMap(message, 2);
+    rbusMessage_SetString(message, "Name");
+    rbusMessage_SetString(message, "eth0");
+    rbusMessage_SetString(message, "Mtu");
+    rbusMessage_SetInt32(message, 1500);
+    /*the meta section is not part of the JSON*/
+    rbusMessage_BeginMetaSectionWrite(message);
+    rbusMessage_SetString(message, "METHOD_GETPARAMETERVALUES");
+    rbusMessage_EndMetaSectionWrite(message);
+
+    ASSERT_EQ(rbusMessage_ToJsonString(message, &json, &length), RT_OK);
+    EXPECT_STREQ(json, "[\"Device.WiFi.Radio.1.Enable\",\"Device.WiFi.Radio.1.Channel\","
+        "\"quote\\\" slash\\\\ tab\\t nl\\n ctl\\u0001 utf8 \xc3\xa9\",-5,-9223372036854775808,2.0,0.10000000000000001,"
+        "{\"$bin\":\"APv/YQ==\"},{\"$bin\":\"Bw==\"},{\"$int32\":[1,-2,2147483647]},{\"$double\":[0.5,-1.0000000000000001e+300]},"
+        "{\"Name\":\"eth0\",\"Mtu\":1500}]");
+    EXPECT_EQ(length, strlen(json));
+
+    /*parsed back, the fields read the same and convert to the same JSON*/
+    ASSERT_EQ(rbusMessage_FromJson(&parsed, json, length), RT_OK);
+    EXPECT_EQ(rbusMessage_CountFields(parsed), 12u);
+    EXPECT_EQ(rbusMessage_GetStringAt(parsed, 2, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "quote\" slash\\ tab\t nl\n ctl\x01 utf8 \xc3\xa9");
+    EXPECT_EQ(rbusMessage_GetInt64At(parsed, 4, &resultInt64), RT_OK);
+    EXPECT_EQ(resultInt64, INT64_MIN);
+    EXPECT_EQ(rbusMessage_GetDoubleAt(parsed, 6, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, 0.1);
+    EXPECT_EQ(rbusMessage_GetBytesAt(parsed, 7, &resultBytes, &length2), RT_OK);
+    ASSERT_EQ(length2, sizeof(bytes));
+    EXPECT_EQ(memcmp(resultBytes, bytes, sizeof(bytes)), 0);
+    EXPECT_EQ(rbusMessage_Seek(parsed, 11), RT_OK);
+    EXPECT_EQ(rbusMessage_GetMap(parsed, &count), RT_OK);
+    EXPECT_EQ(count, 2u);
+    EXPECT_EQ(rbusMessage_GetMapValue(parsed, "Name"), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(parsed, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "eth0");
+    ASSERT_EQ(rbusMessage_ToJsonString(parsed, &json2, &length2), RT_OK);
+    EXPECT_STREQ(json2, json);
+    free(json2);
+    rbusMessage_Release(parsed);
+
+    /*a writer can stop the output*/
+    EXPECT_NE(rbusMessage_ToJson(message, jsonAbortWriter, &calls), RT_OK);
+    EXPECT_EQ(calls, 1);
+    free(json);
+    rbusMessage_Release(message);
+    rbusMessage_Release(item);
+
+    /*escapes, nesting and numbers past int64*/
+    char const* input = " [ \"\\u00e9\\ud83d\\ude00\\/\" , [true, false, null, []], {}, 18446744073709551615, 1e2 ] ";
+    ASSERT_EQ(rbusMessage_FromJson(&parsed, input, strlen(input)), RT_OK);
+    EXPECT_EQ(rbusMessage_GetString(parsed, &resultValue), RT_OK);
+    EXPECT_STREQ(resultValue, "\xc3\xa9\xf0\x9f\x98\x80/");
+    ASSERT_EQ(rbusMessage_ToJsonString(parsed, &json, &length), RT_OK);
+    EXPECT_STREQ(json, "[\"\xc3\xa9\xf0\x9f\x98\x80/\",[true,false,null,[]],{},18446744073709551615,100.0]");
+    free(json);
+    rbusMessage_Release(parsed);
+
+    char const* invalid[] = { "", "{}", "[1,]", "[\"a]", "[{\"$bin\":\"A\"}]", "[{\"$int32\":[2147483648]}]", "[1] x",
+        "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]" };
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        EXPECT_NE(rbusMessage_FromJson(&parsed, invalid[i], strlen(invalid[i])), RT_OK) << invalid[i];
+        EXPECT_EQ(parsed, (rbusMessage)NULL);
+    }
+}
+
+TEST_F(TestMarshallingAPIs, rbusMessage_Json_test2)
+{
+    rbusMessage message, parsed;
+    char* json = NULL;
+    uint32_t length = 0;
+    double resultDouble = 0;
+    char const* numbers = "[0,-0,10,-7,0.5,-1.25e-3,1E+2,2e2]";
+    char const* commaLocales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "ru_RU.UTF-8", "ru_RU.utf8" };
+    std::string saved = setlocale(LC_NUMERIC, NULL);
+    char const* locale = NULL;
+
+    /*numbers follow the JSON grammar*/
+    ASSERT_EQ(rbusMessage_FromJson(&parsed, numbers, strlen(numbers)), RT_OK);
+    ASSERT_EQ(rbusMessage_ToJsonString(parsed, &json, &length), RT_OK);
+    EXPECT_STREQ(json, "[0,0,10,-7,0.5,-0.00125,100.0,200.0]");
+    free(json);
+    rbusMessage_Release(parsed);
+
+    char const* invalid[] = { "[01]", "[-01]", "[00]", "[-00.5]", "[+1]", "[.5]", "[1.]", "[1.e2]", "[1e]", "[1e+]",
+        "[--1]", "[-]", "[1-2]", "[0x10]" };
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        EXPECT_NE(rbusMessage_FromJson(&parsed, invalid[i], strlen(invalid[i])), RT_OK) << invalid[i];
+        EXPECT_EQ(parsed, (rbusMessage)NULL);
+    }
+
+    /*doubles are written and read with a '.' whatever LC_NUMERIC says*/
+    for(size_t i = 0; i < sizeof(commaLocales) / sizeof(commaLocales[0]) && !locale; ++i)
+        locale = setlocale(LC_NUMERIC, commaLocales[i]);
+    if(!locale)
+    {
+        printf("no locale with a ',' radix is installed, skipping that part\n");
+        return;
+    }
+    rbusMessage_Init(&message);
+    rbusMessage_SetDouble(message, 0.5);
+    rbusMessage_SetDouble(message, -1e300);
+    rbusMessage_SetDouble(message, 3.0);
+    ASSERT_EQ(rbusMessage_ToJsonString(message, &json, &length), RT_OK);
+    EXPECT_STREQ(json, "[0.5,-1.0000000000000001e+300,3.0]");
+    rbusMessage_Release(message);
+    ASSERT_EQ(rbusMessage_FromJson(&parsed, json, length), RT_OK);
+    EXPECT_EQ(rbusMessage_GetDouble(parsed, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, 0.5);
+    EXPECT_EQ(rbusMessage_GetDouble(parsed, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, -1e300);
+    EXPECT_EQ(rbusMessage_GetDouble(parsed, &resultDouble), RT_OK);
+    EXPECT_EQ(resultDouble, 3.0);
+    free(json);
+    rbusMessage_Release(parsed);
+    setlocale(LC_NUMERIC, saved.c_str());
+}
@@ -24,6 +24,7 @@ Test Case : Testing nested rbus RPC calls
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
 extern "C" {
 #include "rbus_core.h"
 
@@ -33,6 +34,9 @@ extern "C" {
 
 #define DEFAULT_RESULT_BUFFERSIZE 128
 #define MAX_SERVER_NAME 20
+#define NESTED_QUEUE_CAPACITY 256
+#define FLOOD_REQUESTS (NESTED_QUEUE_CAPACITY + 64)
+#define FLOOD_TIMEOUT 8000
 
 
 static bool OPEN_BROKER_CONNECTION2(const char* connection_name)
@@ -116,6 +120,122 @@ static void RBUS_RPC(const char *object, const char* method, const char * payloa
     return;
 }
 
+/*Keeps the callback thread waiting on a request of its own, so requests that arrive meanwhile go to the nested queue.*/
+static int handle_flood_wait(const char * destination, const char * method, rbusMessage request, void * user_data, rbusMessage *response, const rtMessageHeader* hdr)
+{
+    rbusMessage outbound, inbound;
+    rbus_error_t err;
+    (void) destination;
+    (void) method;
+    (void) request;
+    (void) user_data;
+    (void) hdr;
+
+    rbusMessage_Init(&outbound);
+    rbusMessage_SetString(outbound, "rbus_nestedQueueOverflow_test1");
+    rbusMessage_SetInt32(outbound, 3);
+    err = rbus_invokeRemoteMethod("sleeper", METHOD_SET_TIMEOUT_RPC, outbound, 5000, &inbound);
+    if(RTMESSAGE_BUS_SUCCESS == err)
+        rbusMessage_Release(inbound);
+    rbusMessage_Init(response);
+    rbusMessage_SetInt32(*response, err);
+    return 0;
+}
+
+static int handle_flood_ping(const char * destination, const char * method, rbusMessage request, void * user_data, rbusMessage *response, const rtMessageHeader* hdr)
+{
+    (void) destination;
+    (void) method;
+    (void) request;
+    (void) user_data;
+    (void) hdr;
+    rbusMessage_Init(response);
+    rbusMessage_SetInt32(*response, RTMESSAGE_BUS_SUCCESS);
+    return 0;
+}
+
+/*The reply code of one request to "flood", or RTMESSAGE_BUS_ERROR_GENERAL if there was no reply.*/
+static int FLOOD_RPC(const char * method)
+{
+    rbusMessage setter, response;
+    int32_t result = RTMESSAGE_BUS_ERROR_GENERAL;
+
+    rbusMessage_Init(&setter);
+    if(rbus_invokeRemoteMethod("flood", method, setter, FLOOD_TIMEOUT, &response) == RTMESSAGE_BUS_SUCCESS)
+    {
+        rbusMessage_GetInt32(response, &result);
+        rbusMessage_Release(response);
+    }
+    return result;
+}
+
+static void* flood_wait(void* result)
+{
+    *(int*)result = FLOOD_RPC("wait");
+    return NULL;
+}
+
+static void* flood_ping(void* result)
+{
+    *(int*)result = FLOOD_RPC("ping");
+    return NULL;
+}
+
+/*Fills the nested queue of a server whose handler is waiting on the bus. The requests that don't fit are answered as busy
+  right away and every request that fits is answered once the handler returns.*/
+static void RBUS_QUEUE_FLOOD()
+{
+    char client_name[] = "TEST_CLIENT_1";
+    pid_t pid[2];
+    int i, busy = 0, success = 0, wait_result = RTMESSAGE_BUS_ERROR_GENERAL;
+    static int results[FLOOD_REQUESTS];
+    pthread_t waiter, threads[FLOOD_REQUESTS];
+
+    pid[0] = fork();
+    if(pid[0] == 0)
+    {
+        CREATE_RBUS_SERVER_INSTANCE("sleep_server", "sleeper");
+        EXPECT_EQ(rbus_registerMethod("sleeper", METHOD_SET_TIMEOUT_RPC, handle_timeout, NULL), RTMESSAGE_BUS_SUCCESS);
+        pause();
+    }
+    pid[1] = fork();
+    if(pid[1] == 0)
+    {
+        CREATE_RBUS_SERVER_INSTANCE("flood_server", "flood");
+        EXPECT_EQ(rbus_registerMethod("flood", "wait", handle_flood_wait, NULL), RTMESSAGE_BUS_SUCCESS);
+        EXPECT_EQ(rbus_registerMethod("flood", "ping", handle_flood_ping, NULL), RTMESSAGE_BUS_SUCCESS);
+        pause();
+    }
+
+    sleep(2);
+    if(OPEN_BROKER_CONNECTION2(client_name))
+    {
+        ASSERT_EQ(pthread_create(&waiter, NULL, flood_wait, &wait_result), 0);
+        usleep(500000);
+        for(i = 0; i < FLOOD_REQUESTS; i++)
+            ASSERT_EQ(pthread_create(&threads[i], NULL, flood_ping, &results[i]), 0);
+        for(i = 0; i < FLOOD_REQUESTS; i++)
+        {
+            pthread_join(threads[i], NULL);
+            if(RTMESSAGE_BUS_ERROR_OUT_OF_RESOURCES == results[i])
+                busy++;
+            else if(RTMESSAGE_BUS_SUCCESS == results[i])
+                success++;
+        }
+        pthread_join(waiter, NULL);
+        EXPECT_EQ(wait_result, RTMESSAGE_BUS_SUCCESS);
+        EXPECT_GE(busy, FLOOD_REQUESTS - NESTED_QUEUE_CAPACITY);
+        EXPECT_LE(success, NESTED_QUEUE_CAPACITY);
+        EXPECT_EQ(busy + success, FLOOD_REQUESTS) << "requests went unanswered";
+
+        /*the queue drained, so the server takes requests again*/
+        EXPECT_EQ(FLOOD_RPC("ping"), RTMESSAGE_BUS_SUCCESS);
+        CLOSE_BROKER_CONNECTION2();
+    }
+    kill(pid[0], SIGTERM);
+    kill(pid[1], SIGTERM);
+}
+
 class NestedRPCTest : public ::testing::Test{
 
 protected:
@@ -171,3 +291,8 @@ TEST_F(NestedRPCTest, rbus_multipleServer_test1)
             kill(pid[i],SIGTERM);
     }
 }
+
+TEST_F(NestedRPCTest, rbus_nestedQueueOverflow_test1)
+{
+    RBUS_QUEUE_FLOOD();
+}
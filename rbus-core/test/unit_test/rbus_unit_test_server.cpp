@@ -594,7 +594,7 @@ TEST_F(TestServer, rbus_registerMethod_test1)
     return;
 }
 
-/*Testing MAX_SUPPORTED_METHODS - 32*/
+/*Testing registration beyond MAX_SUPPORTED_METHODS, which is no longer a limit*/
 TEST_F(TestServer, rbus_registerMethod_test2)
 {
     int counter = 1, i = 1;
@@ -604,7 +604,7 @@ TEST_F(TestServer, rbus_registerMethod_test2)
 
     CREATE_RBUS_SERVER_REG_OBJECT(counter);
 
-    for(i = 1; i <= MAX_SUPPORTED_METHODS; i++)
+    for(i = 1; i <= MAX_SUPPORTED_METHODS * 32; i++)
     {
        memset( buffer, 0, DEFAULT_RESULT_BUFFERSIZE );
        snprintf(buffer, (sizeof(buffer) - 1), "METHOD_%d", i);
@@ -612,11 +612,18 @@ TEST_F(TestServer, rbus_registerMethod_test2)
        err = rbus_registerMethod(obj_name, buffer, handle_set1,NULL);
        EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_registerMethod failed";
     }
-    memset( buffer, 0, DEFAULT_RESULT_BUFFERSIZE );
-    snprintf(buffer, (sizeof(buffer) - 1), "METHOD_%d", i);
-    printf("Registering method %s \n", buffer);
-    err = rbus_registerMethod(obj_name, buffer, handle_set1,NULL);
-    EXPECT_EQ(err, RTMESSAGE_BUS_ERROR_OUT_OF_RESOURCES) << "rbus_registerMethod failed";
+    /*every one of them can still be found, and only once*/
+    for(i = 1; i <= MAX_SUPPORTED_METHODS * 32; i += 7)
+    {
+       memset( buffer, 0, DEFAULT_RESULT_BUFFERSIZE );
+       snprintf(buffer, (sizeof(buffer) - 1), "METHOD_%d", i);
+       err = rbus_registerMethod(obj_name, buffer, handle_set1,NULL);
+       EXPECT_EQ(err, RTMESSAGE_BUS_ERROR_INVALID_PARAM) << "rbus_registerMethod accepted a duplicate";
+       err = rbus_unregisterMethod(obj_name, buffer);
+       EXPECT_EQ(err, RTMESSAGE_BUS_SUCCESS) << "rbus_unregisterMethod failed";
+       err = rbus_unregisterMethod(obj_name, buffer);
+       EXPECT_EQ(err, RTMESSAGE_BUS_ERROR_GENERAL) << "rbus_unregisterMethod failed";
+    }
 
     RBUS_CLOSE_BROKER_CONNECTION(RTMESSAGE_BUS_SUCCESS);
     return;
@@ -0,0 +1,545 @@
+#!/usr/bin/env python3
+##########################################################################
+# If not stated otherwise in this file or this component's Licenses.txt
+# file the following copyright and licenses apply:
+#
+# Copyright 2019 RDK Management
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+##########################################################################
+"""Generate rbus-core provider stubs and client proxies from an interface description.
+
+    rbus_idl.py <file.idl> <output directory>
+
+writes <name>.h and <name>.c, where <name> is the idl file name without its extension.
+
+The idl declares structs and interfaces. '#' starts a comment.
+
+    struct student_details_t
+    {
+        string object_name[100];    # copied into a char array
+        string student_name[100];
+    }
+
+    interface student
+    {
+        setInfo(student_details_t details) -> () = "METHOD_SETSTUDENTINFO";
+        getInfo() -> (student_details_t details) = "METHOD_GETSTUDENTINFO";
+        getAge(string name) -> (int32 age);    # sent as "getAge"
+    }
+
+Field and parameter types are int32, int64, double, bool, string, string[N] (structs only), bytes and any struct
+declared earlier. A string is a char const* and bytes are a uint8_t const* plus a uint32_t <name>_length; when
+unpacked, both point into the message they came from.
+
+For each struct the generator emits <struct>_pack and <struct>_unpack, which set or get the fields in order.
+
+For each interface it emits:
+  <interface>_ops_t      a struct of handler function pointers, one per method, that a provider fills in
+  <interface>_register   registers the methods of an object one by one with rbus_registerMethod, passing the
+                         server as user data; if one fails, the ones registered before it are unregistered again
+  <interface>_unregister unregisters them with rbus_unregisterMethodTable
+  <interface>_<method>   a client proxy that packs the inputs, calls rbus_invokeRemoteMethod and unpacks the reply
+
+Replies carry an int32 rbus_error_t followed by the outputs, the layout rbus-core handlers already use. Outputs of a
+proxy that point into the reply stay valid until the caller releases '*response'.
+"""
+
+import os
+import re
+import sys
+
+SCALARS = {
+    # idl type: (C type, rbusMessage function suffix)
+    "int32": ("int32_t", "Int32"),
+    "int64": ("int64_t", "Int64"),
+    "double": ("double", "Double"),
+}
+
+
+class IdlError(Exception):
+    pass
+
+
+class Field(object):
+    def __init__(self, type_name, name, size, line):
+        self.type = type_name
+        self.name = name
+        self.size = size  # string[N] only
+        self.line = line
+
+
+class Struct(object):
+    def __init__(self, name):
+        self.name = name
+        self.fields = []
+
+
+class Method(object):
+    def __init__(self, name, wire_name, inputs, outputs):
+        self.name = name
+        self.wire_name = wire_name
+        self.inputs = inputs
+        self.outputs = outputs
+
+
+class Interface(object):
+    def __init__(self, name):
+        self.name = name
+        self.methods = []
+
+
+IDENT = r"[A-Za-z_][A-Za-z0-9_]*"
+FIELD_RE = re.compile(r"^(%s)\s+(%s)(?:\s*\[\s*(\d+)\s*\])?$" % (IDENT, IDENT))
+METHOD_RE = re.compile(r"^(%s)\s*\((.*?)\)\s*->\s*\((.*?)\)\s*(?:=\s*\"([^\"]+)\")?$" % IDENT)
+
+
+def parse(text):
+    structs = []
+    interfaces = []
+    known = {}
+    block = None
+    pending = None  # 'struct name' or 'interface name' waiting for its '{'
+
+    for number, raw in enumerate(text.splitlines(), 1):
+        line = raw.split("#", 1)[0].strip()
+        if not line:
+            continue
+        if pending is not None:
+            if line != "{":
+                raise IdlError("line %d: expected '{'" % number)
+            block = pending
+            pending = None
+            continue
+        if block is None:
+            match = re.match(r"^(struct|interface)\s+(%s)\s*(\{)?$" % IDENT, line)
+            if not match:
+                raise IdlError("line %d: expected a struct or interface" % number)
+            kind, name = match.group(1), match.group(2)
+            if name in known or name in SCALARS:
+                raise IdlError("line %d: %s is already declared" % (number, name))
+            item = Struct(name) if kind == "struct" else Interface(name)
+            known[name] = item
+            (structs if kind == "struct" else interfaces).append(item)
+            if match.group(3):
+                block = item
+            else:
+                pending = item
+            continue
+        if line in ("}", "};"):
+            if isinstance(block, Struct) and not block.fields:
+                raise IdlError("line %d: struct %s has no fields" % (number, block.name))
+            block = None
+            continue
+        if not line.endswith(";"):
+            raise IdlError("line %d: missing ';'" % number)
+        line = line[:-1].strip()
+        if isinstance(block, Struct):
+            block.fields.append(parse_field(line, number, known, True))
+        else:
+            match = METHOD_RE.match(line)
+            if not match:
+                raise IdlError("line %d: expected 'name(inputs) -> (outputs) = \"wire name\";'" % number)
+            inputs = parse_fields(match.group(2), number, known)
+            outputs = parse_fields(match.group(3), number, known)
+            names = [f.name for f in inputs + outputs]
+            if len(set(names)) != len(names):
+                raise IdlError("line %d: parameter names must be unique" % number)
+            if match.group(1) in [m.name for m in block.methods]:
+                raise IdlError("line %d: %s is already declared" % (number, match.group(1)))
+            block.methods.append(Method(match.group(1), match.group(4) or match.group(1), inputs, outputs))
+
+    if block is not None or pending is not None:
+        raise IdlError("unexpected end of file, missing '}'")
+    return structs, interfaces
+
+
+def parse_fields(text, number, known):
+    text = text.strip()
+    if not text:
+        return []
+    return [parse_field(part.strip(), number, known, False) for part in text.split(",")]
+
+
+def parse_field(text, number, known, in_struct):
+    match = FIELD_RE.match(text)
+    if not match:
+        raise IdlError("line %d: expected 'type name'" % number)
+    type_name, name, size = match.group(1), match.group(2), match.group(3)
+    if size is not None and (type_name != "string" or not in_struct or int(size) == 0):
+        raise IdlError("line %d: only struct fields of type string can have a size" % number)
+    if type_name not in SCALARS and type_name not in ("bool", "string", "bytes"):
+        if not isinstance(known.get(type_name), Struct):
+            raise IdlError("line %d: unknown type %s" % (number, type_name))
+    return Field(type_name, name, int(size) if size else None, number)
+
+
+def c_decls(field):
+    """The C declarations holding 'field'."""
+    if field.type in SCALARS:
+        return ["%s %s" % (SCALARS[field.type][0], field.name)]
+    if field.type == "bool":
+        return ["bool %s" % field.name]
+    if field.type == "string":
+        return ["char %s[%d]" % (field.name, field.size)] if field.size else ["char const* %s" % field.name]
+    if field.type == "bytes":
+        return ["uint8_t const* %s" % field.name, "uint32_t %s_length" % field.name]
+    return ["%s %s" % (field.type, field.name)]
+
+
+def pack_lines(field, value, length=None):
+    """Statements adding 'field', held in 'value', to message 'm'. Each ORs its result into 'err'."""
+    if field.type in SCALARS:
+        return ["err |= rbusMessage_Set%s(m, %s);" % (SCALARS[field.type][1], value)]
+    if field.type == "bool":
+        return ["err |= rbusMessage_SetInt32(m, %s ? 1 : 0);" % value]
+    if field.type == "string":
+        if field.size:
+            return ["err |= rbusMessage_SetString(m, %s);" % value]
+        return ["err |= rbusMessage_SetString(m, %s ? %s : \"\");" % (value, value)]
+    if field.type == "bytes":
+        return ["err |= rbusMessage_SetBytes(m, %s, %s);" % (value, length or value + "_length")]
+    return ["err |= %s_pack(m, &%s);" % (field.type, value)]
+
+
+def unpack_lines(field, value, length=None):
+    """Statements reading 'field' from message 'm' into 'value'."""
+    if field.type in SCALARS:
+        return ["err |= rbusMessage_Get%s(m, &%s);" % (SCALARS[field.type][1], value)]
+    if field.type == "bool":
+        return ["err |= rbusMessage_GetInt32(m, &flag);", "%s = flag != 0;" % value]
+    if field.type == "string":
+        if field.size:
+            return ["err |= rbusMessage_GetString(m, &str);",
+                    "snprintf(%s, sizeof(%s), \"%%s\", str);" % (value, value)]
+        return ["%s = \"\";" % value, "err |= rbusMessage_GetString(m, &%s);" % value]
+    if field.type == "bytes":
+        length = length or value + "_length"
+        return ["%s = NULL;" % value, "%s = 0;" % length,
+                "err |= rbusMessage_GetBytes(m, &%s, &%s);" % (value, length)]
+    return ["err |= %s_unpack(m, &%s);" % (field.type, value)]
+
+
+def temps(fields):
+    """Locals the unpack statements of 'fields' need."""
+    lines = []
+    if any(f.type == "bool" for f in fields):
+        lines.append("int32_t flag = 0;")
+    if any(f.type == "string" and f.size for f in fields):
+        lines.append("char const* str = \"\";")
+    return lines
+
+
+def param_decl(field, output):
+    """The parameters passing 'field' to a handler or proxy."""
+    star = "*" if output else ""
+    if field.type in SCALARS or field.type == "bool":
+        return ["%s%s %s" % (c_decls(field)[0].split(" ")[0], star, field.name)]
+    if field.type == "string":
+        return ["char const*%s %s" % (star, field.name)]
+    if field.type == "bytes":
+        return ["uint8_t const*%s %s" % (star, field.name), "uint32_t%s %s_length" % (star, field.name)]
+    return ["%s* %s" % (field.type, field.name) if output else "%s const* %s" % (field.type, field.name)]
+
+
+def param_args(field, output):
+    """The arguments passing local 'field' to a handler."""
+    if field.type == "bytes":
+        if output:
+            return ["&%s" % field.name, "&%s_length" % field.name]
+        return [field.name, "%s_length" % field.name]
+    if output or (field.type not in SCALARS and field.type not in ("bool", "string")):
+        return ["&%s" % field.name]
+    return [field.name]
+
+
+def proxy_pack_lines(field):
+    """Statements adding proxy input 'field' to the request."""
+    if field.type in SCALARS or field.type in ("bool", "string", "bytes"):
+        return pack_lines(field, field.name)
+    return ["err |= %s_pack(m, %s);" % (field.type, field.name)]
+
+
+def proxy_unpack_lines(field):
+    """Statements reading proxy output 'field' from the reply."""
+    lines = unpack_lines(field, "(*%s)" % field.name, "(*%s_length)" % field.name)
+    return [l.replace("&(*%s_length)" % field.name, "%s_length" % field.name).replace("&(*%s)" % field.name, field.name)
+            for l in lines]
+
+
+def init_lines(field):
+    """Statements clearing handler output 'field' before the handler runs."""
+    if field.type in SCALARS:
+        return ["%s = 0;" % field.name]
+    if field.type == "bool":
+        return ["%s = false;" % field.name]
+    if field.type == "string":
+        return ["%s = NULL;" % field.name]
+    if field.type == "bytes":
+        return ["%s = NULL;" % field.name, "%s_length = 0;" % field.name]
+    return ["memset(&%s, 0, sizeof(%s));" % (field.name, field.name)]
+
+
+def emit_header(name, structs, interfaces):
+    guard = "__%s_H__" % re.sub(r"[^A-Za-z0-9]", "_", name)
+    out = ["/* Generated by rbus_idl.py from %s.idl. Do not edit. */" % name, "",
+           "#ifndef %s" % guard, "#define %s" % guard, "",
+           "#include <stdbool.h>", "#include <stdint.h>", "#include <rbus_core.h>", "#include <rbus_message.h>", "",
+           "#ifdef __cplusplus", "extern \"C\" {", "#endif", ""]
+    for s in structs:
+        out.append("typedef struct")
+        out.append("{")
+        for f in s.fields:
+            out.extend("    %s;" % d for d in c_decls(f))
+        out.append("} %s;" % s.name)
+        out.append("")
+        out.append("rtError %s_pack(rbusMessage m, %s const* v);" % (s.name, s.name))
+        out.append("rtError %s_unpack(rbusMessage m, %s* v);" % (s.name, s.name))
+        out.append("")
+    for i in interfaces:
+        for m in i.methods:
+            out.append("#define %s_%s_METHOD \"%s\"" % (i.name.upper(), m.name.upper(), m.wire_name))
+        out.append("")
+        out.append("typedef struct")
+        out.append("{")
+        for m in i.methods:
+            params = ["void* user_data"]
+            for f in m.inputs:
+                params.extend(param_decl(f, False))
+            for f in m.outputs:
+                params.extend(param_decl(f, True))
+            out.append("    rbus_error_t (*%s)(%s);" % (m.name, ", ".join(params)))
+        out.append("} %s_ops_t;" % i.name)
+        out.append("")
+        out.append("/* 'ops' and 'user_data' are passed to the handlers and must stay valid while the object is registered. */")
+        out.append("typedef struct")
+        out.append("{")
+        out.append("    %s_ops_t const* ops;" % i.name)
+        out.append("    void* user_data;")
+        out.append("} %s_server_t;" % i.name)
+        out.append("")
+        out.append("rbus_error_t %s_register(const char* object_name, %s_server_t* server);" % (i.name, i.name))
+        out.append("rbus_error_t %s_unregister(const char* object_name);" % i.name)
+        out.append("")
+        for m in i.methods:
+            out.append("int %s_%s_dispatch(const char* destination, const char* method, rbusMessage request, void* user_data, "
+                       "rbusMessage* response, const rtMessageHeader* hdr);" % (i.name, m.name))
+        out.append("")
+        for m in i.methods:
+            out.append("rbus_error_t %s;" % proxy_signature(i, m))
+        out.append("")
+    out.extend(["#ifdef __cplusplus", "}", "#endif", "#endif", ""])
+    return "\n".join(out)
+
+
+def proxy_signature(interface, method):
+    params = ["const char* object_name", "int timeout_millisecs"]
+    for f in method.inputs:
+        params.extend(param_decl(f, False))
+    for f in method.outputs:
+        params.extend(param_decl(f, True))
+    if method.outputs:
+        params.append("rbusMessage* response")
+    return "%s_%s(%s)" % (interface.name, method.name, ", ".join(params))
+
+
+def emit_source(name, structs, interfaces):
+    out = ["/* Generated by rbus_idl.py from %s.idl. Do not edit. */" % name, "",
+           "#include <stdio.h>", "#include <string.h>", "#include \"%s.h\"" % name, ""]
+
+    # The Get functions check each field's type. Their results are ORed together and checked once, so the generated
+    # code has no branch per field; reading on after a failure only fails again.
+    for s in structs:
+        out.append("rtError %s_pack(rbusMessage m, %s const* v)" % (s.name, s.name))
+        out.append("{")
+        out.append("    rtError err = RT_OK;")
+        for f in s.fields:
+            out.extend("    " + l for l in pack_lines(f, "v->" + f.name))
+        out.append("    return err == RT_OK ? RT_OK : RT_FAIL;")
+        out.append("}")
+        out.append("")
+        out.append("rtError %s_unpack(rbusMessage m, %s* v)" % (s.name, s.name))
+        out.append("{")
+        out.append("    rtError err = RT_OK;")
+        out.extend("    " + l for l in temps(s.fields))
+        for f in s.fields:
+            out.extend("    " + l for l in unpack_lines(f, "v->" + f.name))
+        out.append("    return err == RT_OK ? RT_OK : RT_FAIL;")
+        out.append("}")
+        out.append("")
+
+    # One method table per interface. The server is passed to rbus_registerMethod as each method's user data, so the
+    # table itself doesn't change and isn't rebuilt on every call.
+    for i in interfaces:
+        for m in i.methods:
+            emit_dispatch(out, i, m)
+        out.append("static rbus_method_table_entry_t %s_methods[] =" % i.name)
+        out.append("{")
+        for m in i.methods:
+            out.append("    { %s_%s_METHOD, NULL, %s_%s_dispatch }," % (i.name.upper(), m.name.upper(), i.name, m.name))
+        out.append("};")
+        out.append("")
+        out.append("rbus_error_t %s_register(const char* object_name, %s_server_t* server)" % (i.name, i.name))
+        out.append("{")
+        out.append("    rbus_error_t status = RTMESSAGE_BUS_SUCCESS;")
+        out.append("    unsigned int n;")
+        out.append("")
+        out.append("    for(n = 0; n < sizeof(%s_methods) / sizeof(%s_methods[0]); n++)" % (i.name, i.name))
+        out.append("    {")
+        out.append("        status = rbus_registerMethod(object_name, %s_methods[n].method, %s_methods[n].callback, server);"
+                   % (i.name, i.name))
+        out.append("        if(status != RTMESSAGE_BUS_SUCCESS)")
+        out.append("        {")
+        out.append("            /*leave none of the interface registered*/")
+        out.append("            if(n > 0)")
+        out.append("                rbus_unregisterMethodTable(object_name, %s_methods, n);" % i.name)
+        out.append("            break;")
+        out.append("        }")
+        out.append("    }")
+        out.append("    return status;")
+        out.append("}")
+        out.append("")
+        out.append("rbus_error_t %s_unregister(const char* object_name)" % i.name)
+        out.append("{")
+        out.append("    return rbus_unregisterMethodTable(object_name, %s_methods, sizeof(%s_methods) / sizeof(%s_methods[0]));"
+                   % (i.name, i.name, i.name))
+        out.append("}")
+        out.append("")
+        for m in i.methods:
+            emit_proxy(out, i, m)
+    return "\n".join(out)
+
+
+def emit_dispatch(out, interface, method):
+    fields = method.inputs + method.outputs
+    out.append("int %s_%s_dispatch(const char* destination, const char* method, rbusMessage request, void* user_data, "
+               "rbusMessage* response, const rtMessageHeader* hdr)" % (interface.name, method.name))
+    out.append("{")
+    out.append("    %s_server_t* server = (%s_server_t*)user_data;" % (interface.name, interface.name))
+    out.append("    rbusMessage m = request;")
+    out.append("    rbus_error_t status = RTMESSAGE_BUS_SUCCESS;")
+    out.append("    rtError err = RT_OK;")
+    for f in fields:
+        for d in c_decls(f):
+            out.append("    %s;" % d)
+    out.extend("    " + l for l in temps(method.inputs))
+    out.append("")
+    out.append("    (void)destination;")
+    out.append("    (void)method;")
+    out.append("    (void)hdr;")
+    for f in method.outputs:
+        out.extend("    " + l for l in init_lines(f))
+    for f in method.inputs:
+        out.extend("    " + l for l in unpack_lines(f, f.name))
+    args = ["server->user_data"]
+    for f in method.inputs:
+        args.extend(param_args(f, False))
+    for f in method.outputs:
+        args.extend(param_args(f, True))
+    out.append("    if(err != RT_OK)")
+    out.append("        status = RTMESSAGE_BUS_ERROR_INVALID_PARAM;")
+    out.append("    else")
+    out.append("        status = server->ops->%s(%s);" % (method.name, ", ".join(args)))
+    out.append("")
+    out.append("    rbusMessage_Init(response);")
+    out.append("    m = *response;")
+    out.append("    err = rbusMessage_SetInt32(m, status);")
+    if method.outputs:
+        out.append("    if(status == RTMESSAGE_BUS_SUCCESS)")
+        out.append("    {")
+        for f in method.outputs:
+            out.extend("        " + l for l in pack_lines(f, f.name))
+        out.append("    }")
+    out.append("    if(err != RT_OK)")
+    out.append("    {")
+    out.append("        /*the reply couldn't be packed, so don't send part of one*/")
+    out.append("        rbusMessage_Release(m);")
+    out.append("        rbusMessage_Init(response);")
+    out.append("        rbusMessage_SetInt32(*response, RTMESSAGE_BUS_ERROR_GENERAL);")
+    out.append("    }")
+    out.append("    return 0;")
+    out.append("}")
+    out.append("")
+
+
+def emit_proxy(out, interface, method):
+    out.append("rbus_error_t %s" % proxy_signature(interface, method))
+    out.append("{")
+    out.append("    rbusMessage m = NULL;")
+    out.append("    rbusMessage reply = NULL;")
+    out.append("    rbus_error_t status;")
+    out.append("    rtError err = RT_OK;")
+    out.append("    int32_t code = 0;")
+    out.extend("    " + l for l in temps(method.outputs))
+    out.append("")
+    if method.outputs:
+        out.append("    *response = NULL;")
+    out.append("    rbusMessage_Init(&m);")
+    for f in method.inputs:
+        out.extend("    " + l for l in proxy_pack_lines(f))
+    out.append("    if(err != RT_OK)")
+    out.append("    {")
+    out.append("        rbusMessage_Release(m);")
+    out.append("        return RTMESSAGE_BUS_ERROR_INVALID_PARAM;")
+    out.append("    }")
+    out.append("    /*rbus_invokeRemoteMethod releases the request*/")
+    out.append("    if((status = rbus_invokeRemoteMethod(object_name, %s_%s_METHOD, m, timeout_millisecs, &reply)) != RTMESSAGE_BUS_SUCCESS)"
+               % (interface.name.upper(), method.name.upper()))
+    out.append("        return status;")
+    out.append("    m = reply;")
+    out.append("    if(rbusMessage_GetInt32(m, &code) != RT_OK)")
+    out.append("    {")
+    out.append("        rbusMessage_Release(reply);")
+    out.append("        return RTMESSAGE_BUS_ERROR_MALFORMED_RESPONSE;")
+    out.append("    }")
+    out.append("    status = (rbus_error_t)code;")
+    if method.outputs:
+        out.append("    if(status == RTMESSAGE_BUS_SUCCESS)")
+        out.append("    {")
+        for f in method.outputs:
+            out.extend("        " + l for l in proxy_unpack_lines(f))
+        out.append("        if(err != RT_OK)")
+        out.append("            status = RTMESSAGE_BUS_ERROR_MALFORMED_RESPONSE;")
+        out.append("    }")
+        out.append("    if(status == RTMESSAGE_BUS_SUCCESS)")
+        out.append("        *response = reply;")
+        out.append("    else")
+        out.append("        rbusMessage_Release(reply);")
+    else:
+        out.append("    rbusMessage_Release(reply);")
+    out.append("    return status;")
+    out.append("}")
+    out.append("")
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write("usage: %s <file.idl> <output directory>\n" % argv[0])
+        return 2
+    name = os.path.splitext(os.path.basename(argv[1]))[0]
+    with open(argv[1]) as f:
+        text = f.read()
+    try:
+        structs, interfaces = parse(text)
+    except IdlError as e:
+        sys.stderr.write("%s: %s\n" % (argv[1], e))
+        return 1
+    for suffix, content in ((".h", emit_header(name, structs, interfaces)), (".c", emit_source(name, structs, interfaces))):
+        path = os.path.join(argv[2], name + suffix)
+        with open(path, "w") as f:
+            f.write(content)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))